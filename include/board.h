@@ -0,0 +1,74 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BOARD_MAX_SIDE 19
+#define BOARD_MAX_CELLS (BOARD_MAX_SIDE * BOARD_MAX_SIDE)
+
+// Compact wire encoding: rows, columns, then 2 bits per cell (0 empty,
+// 1 X, 2 O), four cells per byte, first cell in the high bits
+#define BOARD_ENCODED_MAX (2 + (BOARD_MAX_CELLS + 3) / 4)
+
+// An m,n,k game: 'rows' x 'cols' board, 'k' in a row wins.
+// Classic Tic-Tac-Toe is 3,3,3.
+struct board_shape {
+    uint8_t rows, cols, k;
+};
+
+extern const struct board_shape BOARD_CLASSIC;
+
+// Position as one bit mask per row and player; bit c of row r is the cell
+// at column c, and cells are numbered r * cols + c. Plain value type with
+// no allocation or I/O, so game hosts, simulators and bots can share it.
+struct board {
+    struct board_shape shape;
+    uint8_t lines;          // Win check specialised for this shape
+    uint16_t count;         // Stones placed
+    uint32_t bits[2][BOARD_MAX_SIDE];   // Player 1 (X) and player 2 (O)
+};
+
+// Returns 0, or -1 if the shape is out of range (3-19 per side, 3 <= k <= side)
+int board_init(struct board *b, struct board_shape shape);
+
+// "3x3" (the default for ""), "15x15" or "7x6k4"; k defaults to the
+// shorter side, capped at 5. Returns 0, or -1 if malformed or out of range.
+int board_parse_shape(const char *text, struct board_shape *out);
+void board_format_shape(struct board_shape shape, char *buf, size_t size);
+int board_is_classic(struct board_shape shape);
+
+int board_cells(const struct board *b);
+
+// 0 if empty, otherwise the player owning the cell
+int board_cell(const struct board *b, int cell);
+
+// Cell is on the board and empty
+int board_is_free(const struct board *b, int cell);
+
+// 'cell' must be free; 'player' is 1 or 2
+void board_place(struct board *b, int player, int cell);
+
+// Does 'cell' complete k in a row for its owner? Only the four lines
+// through the cell are looked at, so this is O(k) on any board size.
+int board_wins_at(const struct board *b, int player, int cell);
+
+int board_count(const struct board *b);
+int board_full(const struct board *b);
+
+// Board with at most 16 cells as one mask per player (bit = cell number)
+uint16_t board_small_mask(const struct board *b, int player);
+
+// Cell (0-based) named by a move: a cell number counted from 1 ("5"), or a
+// column letter and row number counted from the top ("h8").
+// Returns -1 if the text is not a move, -2 if it is off the board.
+int board_parse_move(const struct board *b, const char *text);
+
+// Compact encoding (see BOARD_ENCODED_MAX); returns the length
+size_t board_encode(const struct board *b, char *out);
+
+// Load a compact encoding into a board of the same size, which keeps its k.
+// Returns 0, or -1 if the encoding is malformed or for another size.
+int board_decode(struct board *b, const char *in, size_t len);
+
+#endif
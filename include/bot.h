@@ -0,0 +1,24 @@
+#ifndef BOT_H
+#define BOT_H
+
+#include "board.h"
+
+// Server-side opponent strength
+#define BOT_EASY 0      // Random legal moves
+#define BOT_NORMAL 1    // Takes a win or blocks one, otherwise random
+#define BOT_PERFECT 2   // Never loses
+
+// Solve every reachable position once; bot_move() then never searches.
+// Called at startup, and on first use if the host did not.
+void bot_init(void);
+
+// Parse "easy", "normal" or "perfect" ("" means normal); -1 if unknown
+int bot_parse_level(const char *name);
+const char *bot_level_name(int level);
+
+// Cell (0-8) for 'player' to play on a classic board; the position must
+// not be finished.
+// 'seed' is per-game state for the random choices.
+int bot_move(const struct board *b, int player, int level, unsigned *seed);
+
+#endif
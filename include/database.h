@@ -2,14 +2,61 @@
 #define DATABASE_H
 
 #include <stddef.h>     // for size_t
+#include <stdint.h>
 
-// User authentication functions
+struct game_record;
+
+// User authentication functions. users.db is indexed in memory on first
+// use, so these are hash lookups rather than file scans.
 int user_exists(const char *user);
 int validate_login(const char *user, const char *pass);
-void register_user(const char *user, const char *pass);
+int register_user(const char *user, const char *pass);  // -1 if taken or on error
+
+// Statistics tracking functions. Totals live in a memory-mapped file with
+// one record per user, changed only by the stats writer process; setting
+// STATS_LOG_ENV in its environment also appends every result to a text
+// audit log.
+#define STATS_LOG_ENV "TTT_STATS_LOG"
+
+// Elo ratings, kept alongside the totals. Each rated game moves both
+// players by the same amount in opposite directions, worked out from their
+// ratings when the writer applies it; nothing is ever recomputed from the
+// history.
+#define RATING_INITIAL 1500
+#define RATING_K 32             // Most a single game can move a rating
+
+struct user_stats {
+    int wins;
+    int losses;
+    int draws;
+    int rating;                 // RATING_INITIAL until the first rated game
+};
+
+// Queue a finished game for the writer and return at once; the totals
+// change and the game is in the game log a moment later. Returns the
+// game's id, or 0 if the queue is full and the game was dropped. Games
+// against the bot are logged but do not count.
+uint32_t record_game(const struct game_record *game);
 
-// Statistics tracking functions
-void update_stats(const char *user, const char *result); // "WIN", "LOSS", "DRAW"
+// Body of the stats writer process: commits queued games to the game log
+// and the journal in batches (fdatasync after each if 'sync'), applies
+// them, and exits after draining the queue on SIGTERM or SIGINT.
+void stats_writer_run(int sync);
+
+// Name behind a player id in the game log; NULL if there is no such player
+const char *stats_user_name(uint32_t id);
+
+// -1 if no games yet; 'out' still holds the user's rating (or RATING_INITIAL)
+int get_user_stats(const char *user, struct user_stats *out);
+
+// Players are ranked by rating, then wins, then win rate. The order is kept
+// up to date as results come in, so these cost O(log n) per line or lookup;
+// the top 10 is only rendered again after a new result.
+#define LEADERBOARD_PAGE_MAX 50
 void get_leaderboard(char *buf, size_t size);
+void get_leaderboard_page(int offset, int limit, char *buf, size_t size);  // offset from 0
+
+// Position from 1 among 'ranked' players; -1 if the user has no results
+int get_rank(const char *user, int *rank, int *ranked);
 
 #endif
\ No newline at end of file
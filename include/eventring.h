@@ -0,0 +1,62 @@
+#ifndef EVENTRING_H
+#define EVENTRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Game events (starts and results) in a POSIX shared-memory ring of
+// fixed-size records. Any process may publish: it takes a ticket with one
+// atomic add, claims the ticket's slot with a compare-and-swap, fills it
+// and marks it complete. There is no lock and no syscall, and a publisher
+// never waits: the ring overwrites its oldest records, and a record whose
+// slot is still held by a slower publisher is dropped and counted.
+//
+// One consumer follows the ring (./server --tail-events). Every record is
+// either read by it or counted as overflow.
+#define EVENTRING_NAME "/ttt_events"
+#define EVENTRING_SLOTS 4096            // A power of two
+
+#define EVENT_GAME_STARTED 1
+#define EVENT_GAME_WON 2
+#define EVENT_GAME_DRAWN 3
+#define EVENT_GAME_TIMEOUT 4            // The winner's opponent ran out of time
+#define EVENT_GAME_DISCONNECT 5         // The winner's opponent left
+
+struct game_event {
+    uint16_t type;          // EVENT_*
+    uint8_t winner;         // 1 or 2, 0 if none
+    uint8_t reserved;
+    uint32_t time;          // Unix time
+    char player[2][64];     // X and O
+};
+
+struct eventring_counters {
+    uint64_t published;     // Tickets handed out
+    uint64_t dropped;       // Publishers that found their slot still busy
+    uint64_t overflow;      // Never read: overwritten, dropped or skipped
+};
+
+// Server: start an empty ring. Returns 0, or -1 if it cannot be created.
+int eventring_create(void);
+
+// Publishers and the consumer: map the server's ring. Returns 0 or -1.
+int eventring_open(void);
+
+// Server, on shutdown
+void eventring_remove(void);
+
+// Does nothing if the ring is not mapped
+void eventring_publish(int type, const char *p1, const char *p2, int winner);
+
+// Consumer side. 'next' is the ticket to read next. Returns 1 with the
+// record in 'out', 0 if there is nothing newer, or -1 if its publisher is
+// still writing it; a consumer that sees -1 for long may skip the record.
+int eventring_read(uint64_t *next, struct game_event *out);
+void eventring_skip(uint64_t *next);
+uint64_t eventring_head(void);
+void eventring_get_counters(struct eventring_counters *out);
+
+// "Game ended: alice defeats bob" and the like
+void eventring_format(const struct game_event *ev, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef GAME_H
+#define GAME_H
+
+#include <stddef.h>
+#include "board.h"
+#include "gamelog.h"
+#include "timer.h"
+
+#define TURN_TIMEOUT_SEC 30
+#define GAME_MOVE_MAX (7 + 64)  // Largest MOVE_MADE payload
+
+// Game state machine results
+#define GAME_RUNNING 0
+#define GAME_FINISHED 1
+
+struct game;
+
+// Host callback used by the state machine to deliver encoded output to player 1 or 2.
+// Each call into the state machine makes at most one per player (more only if
+// its output overflows the collection buffer), with everything it produced.
+typedef void (*game_send_fn)(struct game *g, int player, const char *msg, size_t len);
+
+// Host callback reporting the game to its spectators: WATCH_MOVE with the
+// player and cell (from 1) just played, or WATCH_END with the winner (0 for
+// a draw) and the GAME_END_* reason
+typedef void (*game_watch_fn)(struct game *g, int event, int a, int b);
+
+// One Tic-Tac-Toe match, driven by whoever owns the player sockets.
+// The state machine never blocks: the host feeds it player input,
+// disconnects and expired deadlines, and it replies through send().
+struct game {
+    struct board board;
+    char user[2][64];     // Player 1 (X) and player 2 (O)
+    int turn;             // 1 or 2
+    int state;            // GAME_RUNNING or GAME_FINISHED
+    struct timer turn_timer;        // Current player's turn deadline
+    struct timer_wheel *timers;     // Wheel enforcing it, NULL if the host times turns
+    int proto[2];         // Wire format per player (PROTO_TEXT after game_init)
+    int bot_player;       // Player the server bot plays, 0 if both are human
+    int bot_level;        // BOT_* strength
+    unsigned bot_seed;    // Random state for the bot's choices
+    struct game_record record;      // Moves so far, submitted when the game ends
+    int table_slot;       // Slot in the live game table, -1 if unlisted
+    game_send_fn send;
+    game_watch_fn watch;  // NULL if the host has no spectators
+    void *host;           // Host-specific context
+};
+
+void game_init(struct game *g, const char *p1_user, const char *p2_user,
+               game_send_fn send, void *host);
+void game_start(struct game *g);
+
+// Play on another m,n,k board (call before game_start). Returns 0 or -1.
+int game_set_shape(struct game *g, struct board_shape shape);
+
+// Enforce turn deadlines on the host's wheel; 'expired' is called with 'arg'
+// when the player to move runs out of time and should then call
+// game_handle_timeout (call before game_start)
+void game_set_timers(struct game *g, struct timer_wheel *timers, timer_fn expired, void *arg);
+
+// Report moves and the result through 'watch' (call before game_start)
+void game_set_watch(struct game *g, game_watch_fn watch);
+
+// Let the server bot play 'player' (call before game_start).
+// Bot games do not count towards the leaderboard.
+void game_set_bot(struct game *g, int player, int level, unsigned seed);
+
+// Each returns GAME_RUNNING or GAME_FINISHED. 'read_us' is when the host's
+// read of the input returned (metrics_now_us); a move is timed from there
+// until its MOVE_MADE has been handed to both players.
+int game_handle_input(struct game *g, int player, const char *line, long long read_us);
+int game_handle_frame(struct game *g, int player, int type, const char *payload, size_t len,
+                      long long read_us);
+int game_handle_move(struct game *g, int player, int move, long long read_us);
+int game_handle_timeout(struct game *g);
+int game_handle_disconnect(struct game *g, int player);
+
+// Handle the complete lines or frames at the front of a player's input
+// buffer and remove them; 'cap' is the buffer's size
+int game_handle_data(struct game *g, int player, char *buf, size_t *len, size_t cap,
+                     long long read_us);
+
+// MOVE_MADE payload for 'player' having taken 'cell' (from 1) on 'b';
+// 'out' holds GAME_MOVE_MAX bytes. Returns the payload length.
+size_t game_encode_move(char *out, const struct board *b, int player, int cell,
+                        const char *name);
+
+#endif
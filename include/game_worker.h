@@ -0,0 +1,9 @@
+#ifndef GAME_WORKER_H
+#define GAME_WORKER_H
+
+// Run a pooled game worker: receive matches (and their two player sockets)
+// from the server over ctl_fd, host them until they finish, and report each
+// completion back on the same channel. Returns when the server goes away.
+int worker_main(int ctl_fd, int index);
+
+#endif
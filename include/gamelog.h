@@ -0,0 +1,78 @@
+#ifndef GAMELOG_H
+#define GAMELOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "board.h"
+
+// Every finished game is kept in data/games as a compact binary record:
+// the players, when it started, the board, the moves and how it ended.
+// Records are appended to segment files that are rotated by size, and an
+// index of fixed-size entries says where game N lives, so looking a game
+// up is one read of the index and one of the record.
+//
+// Game ids are the stats queue tickets the games were submitted under
+// (see record_game), so a host knows its game's id as soon as it ends.
+// Only the stats writer appends; anyone may read.
+#define GAMELOG_DIR "data/games"
+#define GAMELOG_SEGMENT_MAX (1 << 20)    // Start a new segment past this size
+#define GAMELOG_BOT 0xffffffffu          // Player id of the server bot
+
+// Moves are cell numbers (from 0) packed at the fewest bits that hold the
+// largest cell: 4 bits per move on 3x3, 9 on 19x19
+#define GAMELOG_PACKED_MAX ((BOARD_MAX_CELLS * 9 + 7) / 8)
+
+// How a game ended
+#define GAME_END_NORMAL 0       // k in a row or a full board
+#define GAME_END_TIMEOUT 1      // The loser ran out of time
+#define GAME_END_DISCONNECT 2   // The loser left
+
+// A game as its host builds it. Moves are packed into memory as they are
+// played; nothing is written until the game is submitted at the end.
+struct game_record {
+    char player[2][64];     // X and O
+    uint32_t started;       // Unix time
+    struct board_shape shape;
+    uint8_t winner;         // 1 or 2, 0 for a draw
+    uint8_t end;            // GAME_END_*
+    uint8_t bot;            // Player the server bot played, 0 if none
+    uint16_t moves;
+    uint8_t packed[GAMELOG_PACKED_MAX];
+};
+
+// Record header in a segment, followed by the packed moves
+struct gamelog_entry {
+    uint32_t id;
+    uint32_t player[2];     // Stats record numbers, or GAMELOG_BOT
+    uint32_t started;
+    uint8_t rows, cols, k;
+    uint8_t winner;
+    uint8_t end;
+    uint8_t bits;           // Per move
+    uint16_t moves;
+};
+
+int gamelog_move_bits(struct board_shape shape);
+
+void gamelog_begin(struct game_record *r, const char *p1, const char *p2,
+                   struct board_shape shape, int bot);
+void gamelog_move(struct game_record *r, int cell);
+void gamelog_finish(struct game_record *r, int winner, int end);
+
+// Cell of move 'i' (from 0) in a packed move list
+int gamelog_move_at(const uint8_t *packed, int bits, int i);
+
+// Writer side. gamelog_open returns the highest game id in the log (0 if
+// none), or -1 if it cannot be opened.
+long gamelog_open(void);
+
+// Append games in increasing id order: the records in one write, their
+// index entries in another; fdatasync both if 'sync'. Returns 0 or -1.
+int gamelog_append(const struct gamelog_entry *entries, const uint8_t *const *packed,
+                   int n, int sync);
+
+// Reader side: fill 'entry' and up to GAMELOG_PACKED_MAX bytes of packed
+// moves from the log. Returns 0, or -1 if there is no such game.
+int gamelog_read(uint32_t id, struct gamelog_entry *entry, uint8_t *packed);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef GAMETABLE_H
+#define GAMETABLE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "board.h"
+
+// Live games, in a POSIX shared-memory region of fixed-size slots. The
+// server claims a slot when it starts a game and frees it once the game is
+// over; in between, whoever plays the game out (the server itself, a pool
+// worker or a per-game process) writes the position after every move.
+// Each slot has a sequence lock: its one writer makes the count odd while
+// it changes the slot, and a reader keeps its copy only if the count was
+// even and unchanged throughout. Reading never takes a lock, makes a
+// syscall or holds up the host.
+#define GAMETABLE_NAME "/ttt_games"
+#define GAMETABLE_SLOTS 16384
+
+struct live_game {
+    char player[2][64];     // X and O
+    pid_t host;             // Process playing the game out
+    uint32_t started;       // Unix time
+    int turn;               // Player to move, 0 once the game is over
+    int winner;             // Once over: 1 or 2, 0 for a draw
+    int end;                // Once over: GAME_END_*
+    struct board board;
+};
+
+// Server: start an empty table. Returns 0, or -1 if it cannot be created.
+int gametable_create(void);
+
+// Hosts and readers: map the server's table. Returns 0 or -1.
+int gametable_open(void);
+
+// Server, on shutdown
+void gametable_remove(void);
+
+// Server side. Claim returns the slot, or -1 if the table is full or
+// missing, in which case the game goes unlisted.
+int gametable_claim(const char *p1, const char *p2, struct board_shape shape);
+void gametable_release(int slot);
+
+// Master, once a server process has died: free the slots it claimed.
+// Returns how many there were. A forked game process can outlive its
+// server and still be playing; its slot is kept and counted in 'orphans',
+// and gametable_purge_orphans frees it once that process has exited.
+int gametable_purge(pid_t owner, int *orphans);
+int gametable_purge_orphans(int *orphans);
+
+// Host side; a slot of -1 is ignored. A host other than the server says
+// so first. 'turn' is the player to move next.
+void gametable_host(int slot);
+void gametable_update(int slot, const struct board *b, int turn);
+void gametable_finish(int slot, const struct board *b, int winner, int end);
+
+// Reader side: a consistent copy of a slot. Returns 0, or -1 if the slot
+// is free. Slots from 0 up to gametable_used() have ever been claimed.
+int gametable_read(int slot, struct live_game *out);
+int gametable_used(void);
+
+#endif
@@ -2,35 +2,54 @@
 #define IPC_H
 
 #include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/sem.h>
-#include <sys/msg.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include "outq.h"
+#include "board.h"
 
-#define MSG_KEY 0x2222
-#define SEM_KEY 0x3333
-#define FIFO_PATH "/tmp/game_notify"
+// A blocking send to a player that takes longer than this drops the player
+#define GAME_SEND_TIMEOUT_SEC 5
 
-struct game_msg {
-    long mtype;
-    int player;           // 1 or 2
-    int move;             // 1-9
-    char username[64];    // For notifications and additional info
+// Control messages between the server and pooled game workers.
+// START_GAME carries the two player sockets as SCM_RIGHTS ancillary data.
+// Output still queued for the players travels with the sockets: pending[0]
+// then pending[1] bytes follow the struct in the same message, both ways.
+#define WORKER_START_GAME 1
+#define WORKER_GAME_DONE 2
+#define WORKER_WATCH 3        // A struct watch_event rather than a worker_msg
+
+struct worker_msg {
+    int type;
+    int game_id;          // Server-assigned match id
+    char users[2][64];    // Player 1 and player 2 (START_GAME only)
+    int proto[2];         // Wire format of each player (START_GAME only)
+    int pending[2];       // Queued output bytes per player that follow
+    struct board_shape shape;  // Board to play on (START_GAME only)
+    int table_slot;       // Live game table slot, -1 if unlisted (START_GAME only)
 };
 
-// Semaphore functions
-int create_semaphore();
-void sem_lock(int semid);
-void sem_unlock(int semid);
+#define WORKER_MSG_MAX (sizeof(struct worker_msg) + 2 * OUTQ_LIMIT)
+
+// A move or the result of a match hosted outside the server, for the
+// server to pass on to the match's spectators. Pool workers send it on
+// their control channel, game processes on the shard's game event socket.
+// The whole board goes along, so the server's copy never drifts.
+#define WATCH_MOVE 1
+#define WATCH_END 2
 
-// Message queue functions
-int create_msg_queue();
+struct watch_event {
+    int type;             // WORKER_WATCH
+    int game_id;          // Server-assigned match id
+    int event;            // WATCH_MOVE or WATCH_END
+    int player;           // MOVE: who moved; END: the winner, 0 for a draw
+    int cell;             // MOVE: cell number from 1
+    int end;              // END: GAME_END_* reason
+    char board[BOARD_ENCODED_MAX];  // After the move
+};
 
-// FIFO functions
-int create_fifo();
-void send_notification(int fd, const char *msg);
-int receive_notification(int fd, char *buf, size_t size);
+// Descriptor passing over Unix-domain sockets
+int send_with_fds(int sock, const void *buf, size_t len, const int *fds, int nfds);
+ssize_t recv_with_fds(int sock, void *buf, size_t len, int *fds, int max_fds, int *nfds);
 
 #endif
\ No newline at end of file
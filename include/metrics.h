@@ -0,0 +1,73 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Counters, gauges and latency histograms in a POSIX shared-memory region.
+// Each process (shard, game process, worker, stats writer) attaches a block
+// of its own and updates only that, with relaxed atomic adds on cache lines
+// no other process writes. Shard 0 sums the blocks when scraped and serves
+// them in the Prometheus text format on METRICS_SOCKET. A dead process's
+// block is folded into a shared one, so counters never go backwards.
+#define METRICS_NAME "/ttt_metrics"
+#define METRICS_SOCKET "/tmp/ttt_metrics.sock"
+#define METRICS_BLOCKS 1024
+#define METRICS_TEXT_MAX (60 * 1024)    // Body plus HTTP header fit one outq
+
+// Counters
+#define METRIC_ACCEPTS 0
+#define METRIC_LOGINS 1             // LOGIN or REGISTER that got into the lobby
+#define METRIC_INVITES 2
+#define METRIC_GAMES_STARTED 3
+#define METRIC_GAMES_FINISHED 4
+#define METRIC_TURN_TIMEOUTS 5
+#define METRIC_INVITE_TIMEOUTS 6
+#define METRIC_LOGIN_TIMEOUTS 7
+#define METRIC_COUNTERS 8
+
+// Gauges, summed over the live processes
+#define METRIC_LOBBY 0              // Logged-in players not in a game
+#define METRIC_LIVE_GAMES 1
+#define METRIC_GAUGES 2
+
+// Histograms, in microseconds
+#define METRIC_LOGIN_TIME 0         // Handling a LOGIN or REGISTER line
+#define METRIC_LEADERBOARD_TIME 1   // get_leaderboard and get_leaderboard_page
+#define METRIC_FLOCK_WAIT 2         // Blocked in flock on users.db or stats files
+#define METRIC_MOVE_TIME 3          // Move read to MOVE_MADE sent to both players
+#define METRIC_HISTOGRAMS 4
+
+// HDR-style buckets: four per power of two, so a value is placed within
+// 25%, from 1 us up to 2^28 us (about 4.5 minutes)
+#define METRIC_HIST_BUCKETS 108
+
+// Server: start empty counters. Returns 0, or -1 if they cannot be created.
+int metrics_create(void);
+
+// Processes exec'd by the server: map its counters. Returns 0 or -1.
+int metrics_open(void);
+
+// Server, on shutdown
+void metrics_remove(void);
+
+// Take a block for this process; until then (or if none is free) updates
+// go to the shared block. Call after fork.
+void metrics_attach(void);
+
+// Parent, once a child is reaped: fold its block into the shared one
+void metrics_reap(pid_t pid);
+
+// Hot path. Each does nothing if the counters are not mapped.
+void metrics_count(int counter);
+void metrics_gauge_add(int gauge, int delta);
+void metrics_observe(int histogram, long us);
+
+// Monotonic clock in microseconds, for timing what metrics_observe records
+long long metrics_now_us(void);
+
+// The Prometheus exposition of every process's metrics. Returns its length.
+size_t metrics_render(char *buf, size_t size);
+
+#endif
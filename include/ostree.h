@@ -0,0 +1,47 @@
+#ifndef OSTREE_H
+#define OSTREE_H
+
+#include <stdint.h>
+
+// Order-statistic tree over small integer ids (e.g. record numbers), kept
+// as a treap whose nodes also count their subtree. Insert, remove, rank
+// and select are O(log n) expected. The order comes from the caller's
+// comparison, which must be total (break ties on the id) and must not
+// change for an id while it is in the tree: remove it, update its key,
+// then insert it again.
+typedef int (*ostree_cmp)(int a, int b, void *arg);
+
+struct ostree_node {
+    int left, right;    // Child ids, -1 if none
+    int size;           // Nodes in this subtree; 0 if the id is not in the tree
+    uint32_t prio;
+};
+
+struct ostree {
+    struct ostree_node *nodes;  // Indexed by id, grown on demand
+    int cap;
+    int root;                   // -1 if empty
+    uint32_t seed;
+    ostree_cmp cmp;
+    void *arg;
+};
+
+void ostree_init(struct ostree *t, ostree_cmp cmp, void *arg);
+void ostree_free(struct ostree *t);
+
+// Empty the tree, keeping its storage
+void ostree_clear(struct ostree *t);
+
+// Returns 0, or -1 if the node table could not grow. No-op if present.
+int ostree_insert(struct ostree *t, int id);
+void ostree_remove(struct ostree *t, int id);
+int ostree_contains(const struct ostree *t, int id);
+int ostree_size(const struct ostree *t);
+
+// Position of 'id' in the order (0 = first), or -1 if not in the tree
+int ostree_rank(const struct ostree *t, int id);
+
+// Id at position 'k', or -1 if out of range
+int ostree_select(const struct ostree *t, int k);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef OUTQ_H
+#define OUTQ_H
+
+#include <stddef.h>
+
+// Backlog at which a connection is considered a slow consumer and dropped
+#define OUTQ_LIMIT (64 * 1024)
+
+// First ring allocated for a backlog; a power of two dividing OUTQ_LIMIT
+#define OUTQ_INITIAL 1024
+
+// Shared messages one queue may hold before it counts as a slow consumer
+#define OUTQ_SHARED_MAX 64
+
+// Bytes queued to many connections at once (spectator fan-out): encoded
+// once, referenced by every queue holding them, freed with the last one
+struct outq_shared {
+    int refs;
+    size_t len;
+    char data[];
+};
+
+// Bounded output ring for one non-blocking socket. Writes go straight to
+// the socket while nothing is queued; whatever the socket does not take is
+// kept here and flushed with writev() when the socket becomes writable.
+// The ring is only allocated while data is queued. It starts small and
+// doubles as the backlog grows, so a brief stall costs a connection about
+// as much memory as it has queued, not OUTQ_LIMIT.
+//
+// Shared messages queue behind the ring's bytes. While any are queued, new
+// bytes are wrapped in a shared message of their own so the order holds.
+struct outq {
+    char *buf;      // 'cap' bytes while data is queued, NULL when empty
+    size_t cap;     // Ring size: OUTQ_INITIAL doubled up to OUTQ_LIMIT, 0 if no ring
+    size_t head;    // Offset of the first queued byte
+    size_t len;     // Bytes queued
+    struct outq_shared **shared;    // OUTQ_SHARED_MAX slots while any are queued
+    int shared_head, shared_count;
+    size_t shared_off;  // Bytes of the first shared message already sent
+    size_t shared_len;  // Shared bytes not sent yet
+};
+
+// Send (or queue) 'len' bytes. Returns 0, or -1 if the socket failed or the
+// backlog would exceed OUTQ_LIMIT; the caller should then drop the connection.
+int outq_write(struct outq *q, int fd, const void *data, size_t len);
+
+// Queue bytes without trying the socket; the caller arranges a flush
+int outq_append(struct outq *q, const void *data, size_t len);
+
+// Shared message holding a copy of 'data', with one reference for the caller.
+// Returns NULL if out of memory.
+struct outq_shared *outq_shared_new(const void *data, size_t len);
+void outq_shared_put(struct outq_shared *m);
+
+// Queue a reference to 'm' without trying the socket. Returns 0, or -1
+// if the backlog would exceed OUTQ_LIMIT or OUTQ_SHARED_MAX.
+int outq_append_shared(struct outq *q, struct outq_shared *m);
+
+// Write as much of the backlog as the socket accepts. Returns 0 or -1 on error.
+int outq_flush(struct outq *q, int fd);
+
+// Bytes waiting to be sent
+size_t outq_pending(const struct outq *q);
+
+// Copy the backlog into 'dst' (to hand the socket to another process)
+size_t outq_copy(const struct outq *q, char *dst, size_t cap);
+
+void outq_clear(struct outq *q);
+
+#endif
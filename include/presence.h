@@ -0,0 +1,67 @@
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PRESENCE_NAME_LEN 64
+#define PRESENCE_DEFAULT_CAPACITY 65536
+
+// Shared presence directory used when the server runs several shards.
+// It lives in a MAP_SHARED mapping created before the shards are forked.
+// Writers serialise per hash stripe on robust process-shared mutexes, so a
+// shard that crashes holding one does not stall the others; lookups and
+// walks are lock-free and use a per-slot version counter to detect torn
+// reads. Tombstones left by departures are swept once they pile up.
+struct presence_dir;
+
+struct presence_info {
+    int shard;      // Shard that owns the player's connection
+    int busy;       // 1 while in a game
+};
+
+struct presence_dir *presence_create(size_t capacity);
+
+// Returns 0 if the name was claimed, -1 if it is already present (or full)
+int presence_claim(struct presence_dir *d, const char *name, int shard);
+void presence_release(struct presence_dir *d, const char *name);
+int presence_update(struct presence_dir *d, const char *name, int shard, int busy);
+int presence_lookup(struct presence_dir *d, const char *name, struct presence_info *out);
+
+typedef void (*presence_visit_fn)(const char *name, const struct presence_info *info, void *arg);
+void presence_for_each(struct presence_dir *d, presence_visit_fn fn, void *arg);
+
+// Drop every entry owned by a shard (after it crashed) and repair any lock
+// it died holding; fn sees each entry dropped
+void presence_purge_shard(struct presence_dir *d, int shard, presence_visit_fn fn, void *arg);
+
+// Ordered feed of presence changes, shared by all shards. Each change gets
+// the next version number; lobby clients apply changes as deltas on top of
+// a snapshot taken at a known version. Publishers must update the state a
+// snapshot is built from before publishing the change.
+#define PRESENCE_JOINED 1
+#define PRESENCE_LEFT 2
+#define PRESENCE_BUSY 3
+#define PRESENCE_AVAILABLE 4
+
+#define PRESENCE_FEED_SLOTS 16384
+
+struct presence_feed;
+
+struct presence_event {
+    uint32_t version;
+    int type;           // PRESENCE_*
+    char name[PRESENCE_NAME_LEN];
+};
+
+struct presence_feed *presence_feed_create(size_t slots);
+uint32_t presence_feed_publish(struct presence_feed *f, int type, const char *name);
+
+// Latest version handed out (its event may still be in flight)
+uint32_t presence_feed_version(struct presence_feed *f);
+
+// Copy out one event. Returns 0, 1 if it is not published yet,
+// or -1 if it has already been overwritten (the reader fell behind).
+int presence_feed_read(struct presence_feed *f, uint32_t version, struct presence_event *out);
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Wire formats. Every connection starts in text mode: one message per line,
+// usable from telnet. A client that appends BINARY to its REGISTER/LOGIN
+// line gets a text reply to that line, after which both directions switch
+// to length-prefixed frames.
+#define PROTO_TEXT 0
+#define PROTO_BINARY 1
+
+// Binary frame: type (1 byte), payload length (2 bytes, big-endian), payload
+#define PROTO_HEADER_SIZE 3
+#define PROTO_MAX_PAYLOAD 4096
+#define PROTO_MAX_FRAME (PROTO_HEADER_SIZE + PROTO_MAX_PAYLOAD)
+
+// Largest board the text rendering draws (19x19)
+#define BOARD_TEXT_MAX_CELLS 361
+
+// Server -> client messages (binary payload in comments)
+#define MSG_LOBBY 1                   // Presence snapshot chunk: 4 byte version, 1 byte LOBBY_* flags,
+                                      // then comma-separated available players
+#define MSG_INVITE_FROM 2             // Inviting player, then " <size>" unless 3x3
+#define MSG_INVITE_SENT 3             // Invited player
+#define MSG_INVITE_DECLINED_BY 4      // Declining player
+#define MSG_PLAYER_NOT_AVAILABLE 5
+#define MSG_GAME_START 6              // Your player number (1 = X, 2 = O), rows, columns, k
+#define MSG_BOARD 7                   // Snapshot: rows, columns, then 2 bits per cell (0 empty,
+                                      // 1 X, 2 O), four cells per byte, first cell in the high
+                                      // bits. Its sequence number is the number of marks.
+#define MSG_YOUR_TURN 8
+#define MSG_WAITING 9
+#define MSG_INVALID_MOVE 10           // Reason
+#define MSG_MOVE_MADE 11              // Board delta: 2 byte sequence number (marks on the board
+                                      // after the move), 2 byte cell number (from 1), mark
+                                      // (1 X, 2 O), rows, columns, then the mover
+#define MSG_GAME_OVER 12              // 1 byte winning player (0 = draw), then the winner
+#define MSG_OPPONENT_TIMEOUT 13       // Opponent who ran out of time
+#define MSG_TIMEOUT 14
+#define MSG_OPPONENT_DISCONNECTED 15  // Opponent who left
+#define MSG_RETURN_TO_LOBBY 16
+#define MSG_LEADERBOARD 17            // Rendered leaderboard text
+#define MSG_GOODBYE 18
+#define MSG_ERROR 19                  // Error keyword, e.g. UNKNOWN_COMMAND
+#define MSG_PLAYER_JOINED 20          // Presence delta: 4 byte version, then the player
+#define MSG_PLAYER_LEFT 21            // Presence delta
+#define MSG_PLAYER_BUSY 22            // Presence delta
+#define MSG_PLAYER_AVAILABLE 23       // Presence delta
+#define MSG_INVITE_EXPIRED 24         // Invited player who did not answer in time
+#define MSG_RANK 25                   // 4 byte rank (from 1), 4 byte ranked players, 4 byte wins,
+                                      // losses and draws, then the player
+#define MSG_GAME_RECORDED 26          // 4 byte id of the game just finished, for REPLAY
+#define MSG_REPLAY 27                 // Replay header: 4 byte game id, 4 byte start (Unix time),
+                                      // rows, columns, k, 2 byte move count, then "X-player O-player"
+#define MSG_REPLAY_MOVE 28            // 2 byte move number (from 1), 2 byte cell number (from 1),
+                                      // mark (1 X, 2 O), rows, columns
+#define MSG_REPLAY_END 29             // Winning player (0 = draw), GAME_END_* reason, then the winner
+#define MSG_WATCHING 30               // Spectator snapshot, followed by a BOARD: rows, columns, k,
+                                      // player to move, then "X-player O-player". MOVE_MADE
+                                      // deltas follow as the game goes on.
+#define MSG_WATCH_END 31              // Same as REPLAY_END; empty if the result is unknown or
+                                      // the spectator stopped watching
+#define MSG_QUEUED 32                 // In the QUICKMATCH queue: 4 byte players waiting,
+                                      // skill bucket, number of buckets
+#define MSG_MATCH_FOUND 33            // 4 byte time queued in ms, then the opponent; GAME_START
+                                      // follows
+#define MSG_QUEUE_LEFT 34             // Left the QUICKMATCH queue without a game
+#define MSG_RATING 35                 // 4 byte rating, 4 byte rated games played, then the player
+
+// MSG_LOBBY flags. Large snapshots are split into chunks; a client applies
+// the deltas that follow only once the last chunk has arrived.
+#define LOBBY_CONTINUED 1             // Not the first chunk of the snapshot
+#define LOBBY_MORE 2                  // More chunks follow
+
+// Client -> server commands
+#define CMD_UNKNOWN 0
+#define CMD_INVITE 64                 // Player to invite, optionally " <size>" (e.g. 15x15)
+#define CMD_ACCEPT 65                 // Inviting player
+#define CMD_DECLINE 66                // Inviting player
+#define CMD_LEADERBOARD 67            // Top 10, or "<offset> <limit>" for a page
+#define CMD_QUIT 68
+#define CMD_MOVE 69                   // 1 byte cell number (from 1), or 2 bytes row and column
+                                      // (from 1, row 1 at the top)
+#define CMD_LIST 70                   // Ask for a fresh presence snapshot
+#define CMD_PLAY_BOT 71               // Bot strength: easy, normal (default) or perfect
+#define CMD_SYNC 72                   // Ask for a board snapshot after a sequence gap
+#define CMD_RANK 73                   // Player to look up, or empty for yourself
+#define CMD_REPLAY 74                 // Game id, in decimal
+#define CMD_WATCH 75                  // Player whose game to watch
+#define CMD_UNWATCH 76                // Stop watching
+#define CMD_QUICKMATCH 77             // Join the matchmaking queue (again: report its depth)
+#define CMD_CANCEL 78                 // Leave the matchmaking queue
+#define CMD_RATING 79                 // Player to look up, or empty for yourself
+
+// Render a message or command in the given format.
+// Returns the encoded length, or 0 if it does not fit in 'cap'.
+size_t proto_encode(int proto, int type, const void *payload, size_t len,
+                    char *out, size_t cap);
+
+// Split one frame off the front of 'buf'. Returns the frame length,
+// 0 if the frame is still incomplete, or -1 if the header is invalid.
+int proto_parse_frame(const char *buf, size_t len, int *type,
+                      const char **payload, size_t *plen);
+
+// Map a text command line to a CMD_* type; '*arg' points at its argument
+// (or at an empty string). Moves are not commands and yield CMD_UNKNOWN.
+int proto_parse_command(char *line, char **arg);
+
+const char *proto_command_name(int type);
+
+// Big-endian integers inside payloads
+void proto_put_u32(char *p, uint32_t v);
+uint32_t proto_get_u32(const char *p);
+
+#endif
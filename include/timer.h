@@ -0,0 +1,54 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+// Hierarchical timing wheel: TIMER_LEVELS wheels of TIMER_SLOTS slots each,
+// level n slots spanning TIMER_SLOTS^n ticks. A timer sits in the coarsest
+// level that still resolves its expiry and is cascaded down as the wheel
+// turns, so arming and cancelling are O(1) at any range (up to ~9 days).
+#define TIMER_TICK_MS 50
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+typedef void (*timer_fn)(void *arg);
+
+// Embedded in whatever owns the deadline; no allocation
+struct timer {
+    struct timer *next;
+    struct timer **pprev;   // Link pointing at this timer, NULL if not armed
+    uint64_t expires;       // Tick the timer fires on
+    timer_fn fn;
+    void *arg;
+};
+
+// The wheel advances on a periodic timerfd (CLOCK_MONOTONIC) that the owner
+// watches with epoll; the timerfd only runs while timers are armed.
+struct timer_wheel {
+    int fd;
+    int running;            // timerfd is armed
+    int count;              // Armed timers
+    uint64_t now;           // Current tick
+    struct timer *slots[TIMER_LEVELS][TIMER_SLOTS];
+};
+
+// Returns 0, or -1 if the timerfd could not be created
+int timer_wheel_init(struct timer_wheel *w);
+
+void timer_init(struct timer *t, timer_fn fn, void *arg);
+
+// Fire 'ms' from now (rounded up to whole ticks); re-arms a pending timer
+void timer_arm(struct timer_wheel *w, struct timer *t, unsigned ms);
+
+// No-op unless the timer is pending
+void timer_cancel(struct timer_wheel *w, struct timer *t);
+
+int timer_pending(const struct timer *t);
+
+// Call when the timerfd is readable: advances by every elapsed tick and
+// fires each tick's timers as one batch. Callbacks may arm or cancel any
+// timer, including the one that fired.
+void timer_wheel_run(struct timer_wheel *w);
+
+#endif
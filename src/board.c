@@ -0,0 +1,252 @@
+#include "../include/board.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const struct board_shape BOARD_CLASSIC = { 3, 3, 3 };
+
+// Classic board: win_table[mask] is 1 if the 9-bit mask contains a full
+// line. The table is expanded by the preprocessor, so a win check is a
+// single load.
+#define LINE(m, l) (((m) & (l)) == (l))
+#define WINS(m) (LINE(m, 0x007) | LINE(m, 0x038) | LINE(m, 0x1c0) |  /* rows */ \
+                 LINE(m, 0x049) | LINE(m, 0x092) | LINE(m, 0x124) |  /* columns */ \
+                 LINE(m, 0x111) | LINE(m, 0x054))                    /* diagonals */
+#define W1(n) WINS(n), WINS((n) + 1)
+#define W2(n) W1(n), W1((n) + 2)
+#define W3(n) W2(n), W2((n) + 4)
+#define W4(n) W3(n), W3((n) + 8)
+#define W5(n) W4(n), W4((n) + 16)
+#define W6(n) W5(n), W5((n) + 32)
+#define W7(n) W6(n), W6((n) + 64)
+#define W8(n) W7(n), W7((n) + 128)
+#define W9(n) W8(n), W8((n) + 256)
+
+static const unsigned char win_table[512] = { W9(0) };
+
+// k consecutive set bits anywhere in x, in O(log k) word operations:
+// after each step bit i is set only if bits i..i+len-1 all were
+static inline int has_run(uint64_t x, int k) {
+    int len = 1;
+    while (len * 2 <= k) {
+        x &= x >> len;
+        len *= 2;
+    }
+    if (len < k) x &= x >> (k - len);
+    return x != 0;
+}
+
+// The line through (r, c) in direction (dr, dc) as a bit string, from
+// k - 1 cells before to k - 1 cells after (at most 37 bits)
+static inline uint64_t gather_line(const uint32_t *rows, int nrows, int ncols, int k,
+                                   int r, int c, int dr, int dc) {
+    uint64_t x = 0;
+    for (int i = 1 - k; i < k; i++) {
+        int rr = r + i * dr, cc = c + i * dc;
+        if (rr >= 0 && rr < nrows && cc >= 0 && cc < ncols) {
+            x |= (uint64_t)(rows[rr] >> cc & 1) << (i + k - 1);
+        }
+    }
+    return x;
+}
+
+static inline int lines_through(const uint32_t *rows, int nrows, int ncols, int k, int r, int c) {
+    // A row is already a bit string; keep the window around the cell
+    int lo = c - k + 1 > 0 ? c - k + 1 : 0;
+    uint32_t window = (uint32_t)((1ull << (c + k < ncols ? c + k : ncols)) - (1ull << lo));
+    if (has_run(rows[r] & window, k)) return 1;
+
+    return has_run(gather_line(rows, nrows, ncols, k, r, c, 1, 0), k) ||
+           has_run(gather_line(rows, nrows, ncols, k, r, c, 1, 1), k) ||
+           has_run(gather_line(rows, nrows, ncols, k, r, c, 1, -1), k);
+}
+
+typedef int (*line_check_fn)(const struct board *b, const uint32_t *rows, int r, int c);
+
+static int lines_generic(const struct board *b, const uint32_t *rows, int r, int c) {
+    return lines_through(rows, b->shape.rows, b->shape.cols, b->shape.k, r, c);
+}
+
+static int lines_classic(const struct board *b, const uint32_t *rows, int r, int c) {
+    (void)b;
+    (void)r;
+    (void)c;
+    return win_table[rows[0] | rows[1] << 3 | rows[2] << 6];
+}
+
+// Common shapes get their own copy of the scan with the sizes as constants
+#define SPECIALISE(R, C, K) \
+    static int lines_##R##x##C##k##K(const struct board *b, const uint32_t *rows, int r, int c) { \
+        (void)b; \
+        return lines_through(rows, R, C, K, r, c); \
+    }
+
+SPECIALISE(15, 15, 5)
+SPECIALISE(19, 19, 5)
+
+static const struct {
+    struct board_shape shape;
+    line_check_fn check;
+} line_checks[] = {
+    { { 0, 0, 0 }, lines_generic },   // Any other shape
+    { { 3, 3, 3 }, lines_classic },
+    { { 15, 15, 5 }, lines_15x15k5 },
+    { { 19, 19, 5 }, lines_19x19k5 },
+};
+
+#define LINE_CHECK_COUNT (sizeof(line_checks) / sizeof(line_checks[0]))
+
+static int same_shape(struct board_shape a, struct board_shape b) {
+    return a.rows == b.rows && a.cols == b.cols && a.k == b.k;
+}
+
+static int shape_valid(struct board_shape s) {
+    int longest = s.rows > s.cols ? s.rows : s.cols;
+    return s.rows >= 3 && s.rows <= BOARD_MAX_SIDE && s.cols >= 3 && s.cols <= BOARD_MAX_SIDE &&
+           s.k >= 3 && s.k <= longest;
+}
+
+int board_init(struct board *b, struct board_shape shape) {
+    if (!shape_valid(shape)) return -1;
+
+    memset(b, 0, sizeof(*b));
+    b->shape = shape;
+    for (size_t i = 1; i < LINE_CHECK_COUNT; i++) {
+        if (same_shape(line_checks[i].shape, shape)) b->lines = (uint8_t)i;
+    }
+    return 0;
+}
+
+int board_parse_shape(const char *text, struct board_shape *out) {
+    int rows, cols, k = 0, used = 0, more = 0;
+
+    if (text[0] == '\0') {
+        *out = BOARD_CLASSIC;
+        return 0;
+    }
+    if (sscanf(text, "%dx%d%n", &rows, &cols, &used) != 2) return -1;
+    if (text[used] == 'k' && sscanf(text + used, "k%d%n", &k, &more) == 1) {
+        used += more;
+    }
+    if (text[used] != '\0' || rows < 3 || cols < 3 ||
+        rows > BOARD_MAX_SIDE || cols > BOARD_MAX_SIDE) {
+        return -1;
+    }
+    if (k == 0) {
+        k = rows < cols ? rows : cols;
+        if (k > 5) k = 5;
+    }
+
+    struct board_shape s = { (uint8_t)rows, (uint8_t)cols, (uint8_t)k };
+    if (!shape_valid(s)) return -1;
+    *out = s;
+    return 0;
+}
+
+void board_format_shape(struct board_shape shape, char *buf, size_t size) {
+    int k = shape.rows < shape.cols ? shape.rows : shape.cols;
+    if (k > 5) k = 5;
+
+    if (shape.k == k) {
+        snprintf(buf, size, "%dx%d", shape.rows, shape.cols);
+    } else {
+        snprintf(buf, size, "%dx%dk%d", shape.rows, shape.cols, shape.k);
+    }
+}
+
+int board_is_classic(struct board_shape shape) {
+    return same_shape(shape, BOARD_CLASSIC);
+}
+
+int board_cells(const struct board *b) {
+    return b->shape.rows * b->shape.cols;
+}
+
+int board_cell(const struct board *b, int cell) {
+    int r = cell / b->shape.cols, c = cell % b->shape.cols;
+    if (b->bits[0][r] >> c & 1) return 1;
+    if (b->bits[1][r] >> c & 1) return 2;
+    return 0;
+}
+
+int board_is_free(const struct board *b, int cell) {
+    if (cell < 0 || cell >= board_cells(b)) return 0;
+    int r = cell / b->shape.cols, c = cell % b->shape.cols;
+    return !((b->bits[0][r] | b->bits[1][r]) >> c & 1);
+}
+
+void board_place(struct board *b, int player, int cell) {
+    b->bits[player - 1][cell / b->shape.cols] |= 1u << (cell % b->shape.cols);
+    b->count++;
+}
+
+int board_wins_at(const struct board *b, int player, int cell) {
+    return line_checks[b->lines].check(b, b->bits[player - 1],
+                                       cell / b->shape.cols, cell % b->shape.cols);
+}
+
+int board_count(const struct board *b) {
+    return b->count;
+}
+
+int board_full(const struct board *b) {
+    return b->count == board_cells(b);
+}
+
+uint16_t board_small_mask(const struct board *b, int player) {
+    uint16_t mask = 0;
+    for (int r = 0; r < b->shape.rows; r++) {
+        mask |= (uint16_t)(b->bits[player - 1][r] << (r * b->shape.cols));
+    }
+    return mask;
+}
+
+int board_parse_move(const struct board *b, const char *text) {
+    char *end;
+
+    while (*text == ' ') text++;
+    if (isdigit((unsigned char)*text) ||
+        ((*text == '-' || *text == '+') && isdigit((unsigned char)text[1]))) {
+        long n = strtol(text, &end, 10);
+        if (*end != '\0') return -1;
+        return (n >= 1 && n <= board_cells(b)) ? (int)n - 1 : -2;
+    }
+    if (!isalpha((unsigned char)*text) || !isdigit((unsigned char)text[1])) return -1;
+
+    int c = tolower((unsigned char)*text) - 'a';
+    long r = strtol(text + 1, &end, 10) - 1;
+    if (*end != '\0') return -1;
+    if (c >= b->shape.cols || r < 0 || r >= b->shape.rows) return -2;
+    return (int)r * b->shape.cols + c;
+}
+
+size_t board_encode(const struct board *b, char *out) {
+    int cells = board_cells(b);
+    size_t len = 2 + (cells + 3) / 4;
+
+    memset(out, 0, len);
+    out[0] = (char)b->shape.rows;
+    out[1] = (char)b->shape.cols;
+    for (int i = 0; i < cells; i++) {
+        out[2 + i / 4] |= (char)(board_cell(b, i) << (6 - 2 * (i % 4)));
+    }
+    return len;
+}
+
+int board_decode(struct board *b, const char *in, size_t len) {
+    int cells = board_cells(b);
+
+    if (len != 2 + (size_t)(cells + 3) / 4 || (uint8_t)in[0] != b->shape.rows ||
+        (uint8_t)in[1] != b->shape.cols) {
+        return -1;
+    }
+
+    memset(b->bits, 0, sizeof(b->bits));
+    b->count = 0;
+    for (int i = 0; i < cells; i++) {
+        int owner = (unsigned char)in[2 + i / 4] >> (6 - 2 * (i % 4)) & 3;
+        if (owner == 1 || owner == 2) board_place(b, owner, i);
+    }
+    return 0;
+}
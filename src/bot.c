@@ -0,0 +1,129 @@
+#include "../include/bot.h"
+#include <string.h>
+
+#define POSITIONS 19683   // 3^9
+
+// Position index: each cell is a base-3 digit (0 empty, 1 X, 2 O).
+// ternary[mask] is the mask's bits as base-3 digits, so the index of a
+// board is ternary[x] + 2 * ternary[o].
+static uint16_t ternary[512];
+
+// For the side to move: mask of the cells that keep the best result
+// reachable under perfect play. Zero for finished or unreachable positions.
+static uint16_t best_moves[POSITIONS];
+static signed char values[POSITIONS];   // 1 win, 0 draw, -1 loss for the side to move
+static int solved = 0;
+
+static int position_index(const struct board *b) {
+    return ternary[board_small_mask(b, 1)] + 2 * ternary[board_small_mask(b, 2)];
+}
+
+static int side_to_move(const struct board *b) {
+    return board_count(b) % 2 == 0 ? 1 : 2;
+}
+
+// Negamax over the game tree, memoised per unfinished position
+static int solve(const struct board *b) {
+    int idx = position_index(b);
+    if (values[idx] != 2) return values[idx];
+
+    int player = side_to_move(b);
+    int best = -2;
+    uint16_t moves = 0;
+
+    for (int cell = 0; cell < 9; cell++) {
+        if (!board_is_free(b, cell)) continue;
+
+        struct board next = *b;
+        board_place(&next, player, cell);
+        int v;
+        if (board_wins_at(&next, player, cell)) {
+            v = 1;
+        } else if (board_full(&next)) {
+            v = 0;
+        } else {
+            v = -solve(&next);
+        }
+        if (v > best) {
+            best = v;
+            moves = 0;
+        }
+        if (v == best) moves |= (uint16_t)(1u << cell);
+    }
+
+    values[idx] = (signed char)best;
+    best_moves[idx] = moves;
+    return best;
+}
+
+void bot_init(void) {
+    if (solved) return;
+
+    for (int mask = 0; mask < 512; mask++) {
+        int t = 0, digit = 1;
+        for (int cell = 0; cell < 9; cell++, digit *= 3) {
+            if (mask & (1 << cell)) t += digit;
+        }
+        ternary[mask] = (uint16_t)t;
+    }
+    memset(values, 2, sizeof(values));
+
+    struct board empty;
+    board_init(&empty, BOARD_CLASSIC);
+    solve(&empty);
+    solved = 1;
+}
+
+int bot_parse_level(const char *name) {
+    if (name[0] == '\0' || strcmp(name, "normal") == 0) return BOT_NORMAL;
+    if (strcmp(name, "easy") == 0) return BOT_EASY;
+    if (strcmp(name, "perfect") == 0) return BOT_PERFECT;
+    return -1;
+}
+
+const char *bot_level_name(int level) {
+    return level == BOT_EASY ? "easy" : level == BOT_PERFECT ? "perfect" : "normal";
+}
+
+static unsigned next_random(unsigned *seed) {
+    // xorshift32
+    unsigned x = *seed ? *seed : 2463534242u;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+// Uniformly random set bit of a non-empty cell mask
+static int pick_cell(uint16_t mask, unsigned *seed) {
+    int n = next_random(seed) % __builtin_popcount(mask);
+    while (n-- > 0) mask &= mask - 1;
+    return __builtin_ctz(mask);
+}
+
+// A cell that completes a line for 'player', or -1
+static int winning_cell(const struct board *b, int player, uint16_t free_cells) {
+    for (int cell = 0; cell < 9; cell++) {
+        if (!(free_cells & (1u << cell))) continue;
+        struct board next = *b;
+        board_place(&next, player, cell);
+        if (board_wins_at(&next, player, cell)) return cell;
+    }
+    return -1;
+}
+
+int bot_move(const struct board *b, int player, int level, unsigned *seed) {
+    uint16_t free_cells = 0x1ff & ~(board_small_mask(b, 1) | board_small_mask(b, 2));
+
+    if (level == BOT_PERFECT) {
+        bot_init();
+        uint16_t moves = best_moves[position_index(b)];
+        if (moves) return pick_cell(moves, seed);
+    } else if (level == BOT_NORMAL) {
+        int cell = winning_cell(b, player, free_cells);
+        if (cell == -1) cell = winning_cell(b, player == 1 ? 2 : 1, free_cells);
+        if (cell != -1) return cell;
+    }
+    return pick_cell(free_cells, seed);
+}
@@ -6,6 +6,8 @@
 #include <sys/select.h>
 #include <fcntl.h>
 #include "../include/ipc.h"
+#include "../include/protocol.h"
+#include "../include/board.h"
 
 #define PORT 5555
 #define BUF_SIZE 1024
@@ -17,19 +19,380 @@ typedef enum {
 
 ClientState current_state = STATE_LOBBY;
 
+// Bytes received from the server that do not yet form a complete frame
+char inbuf[PROTO_MAX_FRAME * 2];
+size_t inlen = 0;
+int server_fd = -1;
+
+// Local copy of the lobby: a snapshot plus the presence deltas since
+char (*lobby_names)[64] = NULL;
+size_t lobby_count = 0, lobby_cap = 0;
+uint32_t lobby_version = 0;  // Version of the last change applied
+int lobby_ready = 0;         // A complete snapshot is in place
+
+// Local copy of the current (or watched) game's board: a snapshot plus the
+// moves since
+struct board game_board;
+int board_ready = 0;         // A snapshot is in place
+
+// Board of a game being replayed, drawn once its last move has arrived
+struct board replay_board;
+
 void print_help() {
     printf("\n=== Available Commands ===\n");
     printf("In Lobby:\n");
-    printf("  invite <username>   - Send game invitation to a player\n");
+    printf("  invite <username> [size] - Invite a player (size e.g. 15x15, 7x6k4)\n");
     printf("  accept <username>   - Accept game invitation from a player\n");
     printf("  decline <username>  - Decline game invitation from a player\n");
-    printf("  leaderboard         - View top players\n");
+    printf("  bot [level]         - Play the server bot (easy, normal, perfect)\n");
+    printf("  quickmatch          - Play the next free player of similar skill\n");
+    printf("  cancel              - Stop waiting for a quick match\n");
+    printf("  list                - Show available players\n");
+    printf("  leaderboard [offset limit] - View top players, or a page of the ranking\n");
+    printf("  rank [username]     - Show a player's rank (default: you)\n");
+    printf("  rating [username]   - Show a player's rating (default: you)\n");
+    printf("  replay <game id>    - Show the moves of a finished game\n");
+    printf("  watch <username>    - Watch a player's game as it is played\n");
+    printf("  unwatch             - Stop watching\n");
     printf("  quit                - Exit the game\n");
     printf("\nIn Game:\n");
     printf("  1-9                 - Make a move (when it's your turn)\n");
+    printf("  H8                  - Column and row, on boards larger than 3x3\n");
     printf("=========================\n\n");
 }
 
+int send_command(int sock, int type, const void *arg, size_t len);
+
+static const char *move_hint() {
+    return board_is_classic(game_board.shape) ? "1-9" : "e.g. H8";
+}
+
+static int find_lobby_name(const char *name) {
+    for (size_t i = 0; i < lobby_count; i++) {
+        if (strcmp(lobby_names[i], name) == 0) return (int)i;
+    }
+    return -1;
+}
+
+static void add_lobby_name(const char *name, size_t len) {
+    char buf[64];
+    if (len >= sizeof(buf)) len = sizeof(buf) - 1;
+    memcpy(buf, name, len);
+    buf[len] = '\0';
+    if (buf[0] == '\0' || find_lobby_name(buf) != -1) return;
+
+    if (lobby_count == lobby_cap) {
+        size_t new_cap = lobby_cap ? lobby_cap * 2 : 16;
+        char (*nl)[64] = realloc(lobby_names, new_cap * sizeof(*nl));
+        if (!nl) return;
+        lobby_names = nl;
+        lobby_cap = new_cap;
+    }
+    memcpy(lobby_names[lobby_count++], buf, len + 1);
+}
+
+static void remove_lobby_name(const char *name) {
+    int i = find_lobby_name(name);
+    if (i != -1) {
+        memcpy(lobby_names[i], lobby_names[--lobby_count], sizeof(lobby_names[i]));
+    }
+}
+
+void print_lobby() {
+    printf("\n--- Online Players ---\n");
+    if (lobby_count == 0) {
+        printf("No other players online\n");
+    }
+    for (size_t i = 0; i < lobby_count; i++) {
+        printf("%s%s", lobby_names[i], i + 1 < lobby_count ? ", " : "\n");
+    }
+    printf("----------------------\n");
+}
+
+// One chunk of a presence snapshot: comma-separated names
+void apply_lobby_snapshot(const char *payload, size_t len) {
+    if (len < 5) return;
+    int flags = (unsigned char)payload[4];
+
+    if (!(flags & LOBBY_CONTINUED)) {
+        lobby_count = 0;
+        lobby_ready = 0;
+    }
+    const char *p = payload + 5, *end = payload + len;
+    while (p < end) {
+        const char *comma = memchr(p, ',', end - p);
+        const char *stop = comma ? comma : end;
+        add_lobby_name(p, stop - p);
+        p = stop + 1;
+    }
+    if (!(flags & LOBBY_MORE)) {
+        lobby_version = proto_get_u32(payload);
+        lobby_ready = 1;
+        if (current_state == STATE_LOBBY) print_lobby();
+    }
+}
+
+// One presence change on top of the snapshot
+void apply_lobby_delta(int type, const char *payload, size_t len) {
+    if (len < 4 || !lobby_ready) return;
+    uint32_t version = proto_get_u32(payload);
+    if (version <= lobby_version) return;  // Already part of the snapshot
+    if (version != lobby_version + 1) {
+        // Missed a change; start over from a fresh snapshot
+        lobby_ready = 0;
+        send_command(server_fd, CMD_LIST, NULL, 0);
+        return;
+    }
+    lobby_version = version;
+
+    char name[64];
+    size_t n = len - 4 < sizeof(name) - 1 ? len - 4 : sizeof(name) - 1;
+    memcpy(name, payload + 4, n);
+    name[n] = '\0';
+
+    const char *what;
+    if (type == MSG_PLAYER_JOINED || type == MSG_PLAYER_AVAILABLE) {
+        add_lobby_name(name, n);
+        what = type == MSG_PLAYER_JOINED ? "joined" : "is available";
+    } else {
+        remove_lobby_name(name);
+        what = type == MSG_PLAYER_LEFT ? "left" : "started a game";
+    }
+    if (current_state == STATE_LOBBY) {
+        printf("[LOBBY] %s %s\n", name, what);
+    }
+}
+
+static void print_board(const struct board *b) {
+    char encoded[BOARD_ENCODED_MAX], text[PROTO_MAX_FRAME];
+    size_t len = board_encode(b, encoded);
+    if (proto_encode(PROTO_TEXT, MSG_BOARD, encoded, len, text, sizeof(text)) > 0) {
+        printf("\n%s", text);
+    }
+}
+
+void apply_board_snapshot(const char *payload, size_t len) {
+    board_ready = board_decode(&game_board, payload, len) == 0;
+    if (board_ready) print_board(&game_board);
+}
+
+// One move on top of the snapshot; its sequence number is the mark count
+void apply_board_delta(const char *payload, size_t len) {
+    if (len < 7 || !board_ready) return;
+    int seq = (unsigned char)payload[0] << 8 | (unsigned char)payload[1];
+    int cell = ((unsigned char)payload[2] << 8 | (unsigned char)payload[3]) - 1;
+    int mark = payload[4];
+
+    if (seq <= board_count(&game_board)) return;  // Already part of the snapshot
+    if (seq != board_count(&game_board) + 1 || (mark != 1 && mark != 2) ||
+        !board_is_free(&game_board, cell)) {
+        // Out of step; start over from a fresh snapshot
+        board_ready = 0;
+        send_command(server_fd, CMD_SYNC, NULL, 0);
+        return;
+    }
+    board_place(&game_board, mark, cell);
+    print_board(&game_board);
+}
+
+// Handle one message from the server.
+// Returns -1 when the session is over.
+int handle_server_message(int type, const char *payload, size_t len) {
+    // Human-readable form of the message, as the text protocol would send it
+    char buf[PROTO_MAX_FRAME];
+    if (proto_encode(PROTO_TEXT, type, payload, len, buf, sizeof(buf)) == 0) {
+        buf[0] = '\0';
+    }
+
+    switch (type) {
+    case MSG_GAME_START:
+        current_state = STATE_IN_GAME;
+        if (len < 4 || board_init(&game_board, (struct board_shape){
+                (uint8_t)payload[1], (uint8_t)payload[2], (uint8_t)payload[3] }) == -1) {
+            board_init(&game_board, BOARD_CLASSIC);
+        }
+        board_ready = 0;
+        printf("\n==========================================\n");
+        printf("         GAME IS STARTING!                \n");
+        printf("==========================================\n");
+        break;
+    case MSG_RETURN_TO_LOBBY:
+        current_state = STATE_LOBBY;
+        printf("\n==========================================\n");
+        printf("      Returning to lobby...               \n");
+        printf("==========================================\n");
+        print_help();
+        break;
+    case MSG_GAME_OVER:
+        printf("\n==========================================\n");
+        printf("%s", buf);
+        printf("==========================================\n");
+        break;
+    case MSG_YOUR_TURN:
+        printf("\n>>> YOUR TURN! Enter move (%s): ", move_hint());
+        fflush(stdout);
+        break;
+    case MSG_INVALID_MOVE:
+        printf("\n[ERROR] %s", buf);
+        printf(">>> Try again. Enter move (%s): ", move_hint());
+        fflush(stdout);
+        break;
+    case MSG_BOARD:
+        apply_board_snapshot(payload, len);
+        break;
+    case MSG_MOVE_MADE:
+        printf("%s", buf);
+        apply_board_delta(payload, len);
+        break;
+    case MSG_LOBBY:
+        apply_lobby_snapshot(payload, len);
+        break;
+    case MSG_PLAYER_JOINED:
+    case MSG_PLAYER_LEFT:
+    case MSG_PLAYER_BUSY:
+    case MSG_PLAYER_AVAILABLE:
+        apply_lobby_delta(type, payload, len);
+        break;
+    case MSG_INVITE_FROM:
+        printf("\n[NOTIFICATION] %s", buf);
+        printf("Type 'accept <username>' or 'decline <username>'\n");
+        break;
+    case MSG_INVITE_SENT:
+        printf("[INFO] %s", buf);
+        break;
+    case MSG_INVITE_DECLINED_BY:
+    case MSG_INVITE_EXPIRED:
+        printf("\n[NOTIFICATION] %s", buf);
+        break;
+    case MSG_PLAYER_NOT_AVAILABLE:
+        printf("[ERROR] Player is not available or doesn't exist\n");
+        break;
+    case MSG_OPPONENT_TIMEOUT:
+    case MSG_TIMEOUT:
+    case MSG_OPPONENT_DISCONNECTED:
+        printf("\n[GAME RESULT] %s", buf);
+        break;
+    case MSG_LEADERBOARD:
+        printf("\n%s", buf);
+        break;
+    case MSG_RANK:
+    case MSG_RATING:
+        printf("[INFO] %s", buf);
+        break;
+    case MSG_GAME_RECORDED:
+        if (len >= 4) {
+            printf("[INFO] Game saved as #%u - type 'replay %u' to see it again\n",
+                   proto_get_u32(payload), proto_get_u32(payload));
+        }
+        break;
+    case MSG_REPLAY:
+        if (len < 13 || board_init(&replay_board, (struct board_shape){
+                (uint8_t)payload[8], (uint8_t)payload[9], (uint8_t)payload[10] }) == -1) {
+            board_init(&replay_board, BOARD_CLASSIC);
+        }
+        printf("\n%s", buf);
+        break;
+    case MSG_REPLAY_MOVE:
+        if (len >= 5) {
+            int cell = ((unsigned char)payload[2] << 8 | (unsigned char)payload[3]) - 1;
+            if (board_is_free(&replay_board, cell) && (payload[4] == 1 || payload[4] == 2)) {
+                board_place(&replay_board, payload[4], cell);
+            }
+        }
+        printf("  %s", buf);
+        break;
+    case MSG_REPLAY_END:
+        print_board(&replay_board);
+        printf("%s", buf);
+        break;
+    case MSG_WATCHING:
+        // The BOARD that follows is drawn; moves come as in a game
+        if (len < 4 || board_init(&game_board, (struct board_shape){
+                (uint8_t)payload[0], (uint8_t)payload[1], (uint8_t)payload[2] }) == -1) {
+            board_init(&game_board, BOARD_CLASSIC);
+        }
+        board_ready = 0;
+        printf("\n[WATCH] %s", buf);
+        break;
+    case MSG_WATCH_END:
+        printf("\n[WATCH] %s", buf);
+        break;
+    case MSG_QUEUED:
+    case MSG_QUEUE_LEFT:
+        printf("[INFO] %s", buf);
+        break;
+    case MSG_MATCH_FOUND:
+        printf("\n[NOTIFICATION] %s", buf);
+        break;
+    case MSG_GOODBYE:
+        printf("Disconnected. Goodbye!\n");
+        return -1;
+    default:
+        // Print any other messages
+        printf("%s", buf);
+        break;
+    }
+    fflush(stdout);
+    return 0;
+}
+
+// Handle every complete frame in the receive buffer.
+// Returns -1 when the session is over or the stream is corrupt.
+int process_server_frames() {
+    size_t off = 0;
+    int type, used, result = 0;
+    const char *payload;
+    size_t len;
+
+    while (result == 0 &&
+           (used = proto_parse_frame(inbuf + off, inlen - off, &type, &payload, &len)) > 0) {
+        result = handle_server_message(type, payload, len);
+        off += used;
+    }
+    if (result == 0 && used == -1) {
+        printf("\n[CONNECTION LOST] Invalid data from server\n");
+        result = -1;
+    }
+
+    memmove(inbuf, inbuf + off, inlen - off);
+    inlen -= off;
+    return result;
+}
+
+// Encode a command as a frame and send it
+int send_command(int sock, int type, const void *arg, size_t len) {
+    char frame[PROTO_MAX_FRAME];
+    size_t n = proto_encode(PROTO_BINARY, type, arg, len, frame, sizeof(frame));
+    if (n == 0) return 0;
+    return send(sock, frame, n, 0) == -1 ? -1 : 0;
+}
+
+// The login reply is a text line even for binary sessions.
+// Pull the next complete line out of the receive buffer into 'line'.
+// Returns 0 if no full line has arrived yet.
+int next_server_line(char *line, size_t size) {
+    char *nl = memchr(inbuf, '\n', inlen);
+    if (!nl) {
+        if (inlen < sizeof(inbuf) - 1) return 0;
+        nl = inbuf + inlen - 1;  // Overlong line - deliver it as is
+    }
+
+    size_t len = nl + 1 - inbuf;
+    size_t copy = len < size - 1 ? len : size - 1;
+    memcpy(line, inbuf, copy);
+    line[copy] = '\0';
+    memmove(inbuf, inbuf + len, inlen - len);
+    inlen -= len;
+    return 1;
+}
+
+// Append whatever the socket has to the receive buffer
+int fill_server_buffer(int sock) {
+    int bytes = recv(sock, inbuf + inlen, sizeof(inbuf) - 1 - inlen, 0);
+    if (bytes > 0) inlen += bytes;
+    return bytes;
+}
+
 int main(int argc, char *argv[]) {
     int sock;
     struct sockaddr_in server;
@@ -62,6 +425,7 @@ int main(int argc, char *argv[]) {
         perror("connect failed");
         exit(1);
     }
+    server_fd = sock;
     
     printf("=== Tic-Tac-Toe Online Game ===\n");
     printf("Register or Login (R/L): ");
@@ -78,10 +442,11 @@ int main(int argc, char *argv[]) {
     int c;
     while ((c = getchar()) != '\n' && c != EOF);
     
+    // Ask for binary framing once logged in
     if (choice == 'R' || choice == 'r') {
-        snprintf(buf, sizeof(buf), "REGISTER %s %s\n", username, password);
+        snprintf(buf, sizeof(buf), "REGISTER %s %s BINARY\n", username, password);
     } else {
-        snprintf(buf, sizeof(buf), "LOGIN %s %s\n", username, password);
+        snprintf(buf, sizeof(buf), "LOGIN %s %s BINARY\n", username, password);
     }
     
     if (send(sock, buf, strlen(buf), 0) == -1) {
@@ -90,13 +455,14 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
     
-    int bytes = recv(sock, buf, BUF_SIZE - 1, 0);
-    if (bytes <= 0) {
-        perror("recv login response failed");
-        close(sock);
-        exit(1);
+    // Anything after the reply line (the first frames) stays buffered
+    while (!next_server_line(buf, sizeof(buf))) {
+        if (fill_server_buffer(sock) <= 0) {
+            perror("recv login response failed");
+            close(sock);
+            exit(1);
+        }
     }
-    buf[bytes] = '\0';
     printf("%s", buf);
     
     if (strstr(buf, "OK") == NULL) {
@@ -107,6 +473,10 @@ int main(int argc, char *argv[]) {
     
     printf("\nSuccessfully connected!\n");
     print_help();
+    if (process_server_frames() == -1) {
+        close(sock);
+        exit(1);
+    }
     
     // Main game loop
     while (1) {
@@ -135,34 +505,78 @@ int main(int argc, char *argv[]) {
             }
             
             // Process command based on current state
+            int type;
+            const char *arg = NULL;
+            size_t arglen = 0;
+            char move[2];
+            
             if (current_state == STATE_LOBBY) {
                 if (strncmp(input, "invite ", 7) == 0) {
-                    char target[64];
-                    strncpy(target, input + 7, sizeof(target) - 1);
-                    target[sizeof(target) - 1] = '\0';
-                    snprintf(buf, sizeof(buf), "INVITE %s\n", target);
+                    type = CMD_INVITE;
+                    arg = input + 7;
                 } 
                 else if (strncmp(input, "accept ", 7) == 0) {
-                    char target[64];
-                    strncpy(target, input + 7, sizeof(target) - 1);
-                    target[sizeof(target) - 1] = '\0';
-                    snprintf(buf, sizeof(buf), "ACCEPT %s\n", target);
+                    type = CMD_ACCEPT;
+                    arg = input + 7;
                 } 
                 else if (strncmp(input, "decline ", 8) == 0) {
-                    char target[64];
-                    strncpy(target, input + 8, sizeof(target) - 1);
-                    target[sizeof(target) - 1] = '\0';
-                    snprintf(buf, sizeof(buf), "DECLINE %s\n", target);
+                    type = CMD_DECLINE;
+                    arg = input + 8;
                 } 
+                else if (strcmp(input, "bot") == 0) {
+                    type = CMD_PLAY_BOT;
+                }
+                else if (strncmp(input, "bot ", 4) == 0) {
+                    type = CMD_PLAY_BOT;
+                    arg = input + 4;
+                }
                 else if (strcmp(input, "leaderboard") == 0) {
-                    strcpy(buf, "LEADERBOARD\n");
+                    type = CMD_LEADERBOARD;
                 } 
+                else if (strncmp(input, "leaderboard ", 12) == 0) {
+                    type = CMD_LEADERBOARD;
+                    arg = input + 12;
+                }
+                else if (strcmp(input, "rank") == 0) {
+                    type = CMD_RANK;
+                }
+                else if (strncmp(input, "rank ", 5) == 0) {
+                    type = CMD_RANK;
+                    arg = input + 5;
+                }
+                else if (strcmp(input, "rating") == 0) {
+                    type = CMD_RATING;
+                }
+                else if (strncmp(input, "rating ", 7) == 0) {
+                    type = CMD_RATING;
+                    arg = input + 7;
+                }
+                else if (strncmp(input, "replay ", 7) == 0) {
+                    type = CMD_REPLAY;
+                    arg = input + 7;
+                }
+                else if (strncmp(input, "watch ", 6) == 0) {
+                    type = CMD_WATCH;
+                    arg = input + 6;
+                }
+                else if (strcmp(input, "unwatch") == 0) {
+                    type = CMD_UNWATCH;
+                }
+                else if (strcmp(input, "quickmatch") == 0) {
+                    type = CMD_QUICKMATCH;
+                }
+                else if (strcmp(input, "cancel") == 0) {
+                    type = CMD_CANCEL;
+                }
                 else if (strcmp(input, "quit") == 0) {
-                    strcpy(buf, "QUIT\n");
-                    send(sock, buf, strlen(buf), 0);
+                    send_command(sock, CMD_QUIT, NULL, 0);
                     printf("Goodbye!\n");
                     break;
                 }
+                else if (strcmp(input, "list") == 0) {
+                    print_lobby();
+                    continue;
+                }
                 else if (strcmp(input, "help") == 0) {
                     print_help();
                     continue;
@@ -171,24 +585,41 @@ int main(int argc, char *argv[]) {
                     printf("Unknown command. Type 'help' for available commands.\n");
                     continue;
                 }
+                if (arg) {
+                    arglen = strlen(arg) < 63 ? strlen(arg) : 63;
+                }
             } 
             else {  // STATE_IN_GAME
                 // Trim whitespace from input using a pointer
                 char *trimmed = input;
                 while (*trimmed == ' ' || *trimmed == '\t') trimmed++;
                 
-                // Validate input is a single digit 1-9
-                if (strlen(trimmed) >= 1 && trimmed[0] >= '1' && trimmed[0] <= '9') {
-                    // Send just the digit
-                    snprintf(buf, sizeof(buf), "%c\n", trimmed[0]);
-                } else {
-                    printf("Invalid input. Enter a number from 1-9 when it's your turn.\n");
+                int cell = board_parse_move(&game_board, trimmed);
+                if (cell == -1) {
+                    printf("Invalid input. Enter a move (%s) when it's your turn.\n",
+                           move_hint());
                     continue;
                 }
+
+                // Classic games send the cell number, larger boards the
+                // row and column; the server judges anything off the board
+                type = CMD_MOVE;
+                arg = move;
+                if (cell == -2) {
+                    move[0] = 0;
+                    arglen = 1;
+                } else if (board_is_classic(game_board.shape)) {
+                    move[0] = (char)(cell + 1);
+                    arglen = 1;
+                } else {
+                    move[0] = (char)(cell / game_board.shape.cols + 1);
+                    move[1] = (char)(cell % game_board.shape.cols + 1);
+                    arglen = 2;
+                }
             }
             
             // Send the prepared command
-            if (send(sock, buf, strlen(buf), 0) == -1) {
+            if (send_command(sock, type, arg, arglen) == -1) {
                 perror("send failed");
                 break;
             }
@@ -196,98 +627,13 @@ int main(int argc, char *argv[]) {
         
         // Handle server messages
         if (FD_ISSET(sock, &rfds)) {
-            int bytes = recv(sock, buf, BUF_SIZE - 1, 0);
-            if (bytes <= 0) {
+            if (fill_server_buffer(sock) <= 0) {
                 printf("\n[CONNECTION LOST] Server disconnected\n");
                 break;
             }
-            buf[bytes] = '\0';
             
-            // Parse server messages and update state
-            if (strstr(buf, "GAME_START:") != NULL) {
-                current_state = STATE_IN_GAME;
-                printf("\n==========================================\n");
-                printf("         GAME IS STARTING!                \n");
-                printf("==========================================\n");
-            }
-            else if (strstr(buf, "RETURN_TO_LOBBY") != NULL) {
-                current_state = STATE_LOBBY;
-                printf("\n==========================================\n");
-                printf("      Returning to lobby...               \n");
-                printf("==========================================\n");
-                print_help();
-                continue;  // Don't print the message itself
-            }
-            else if (strstr(buf, "GAME_OVER:") != NULL) {
-                printf("\n==========================================\n");
-                printf("%s", buf);
-                printf("==========================================\n");
-            }
-            else if (strstr(buf, "YOUR_TURN") != NULL) {
-                printf("\n>>> YOUR TURN! Enter move (1-9): ");
-                fflush(stdout);
-                continue;  // Don't print the message itself
-            }
-            else if (strstr(buf, "WAITING:") != NULL) {
-                printf("%s", buf);
-                continue;
-            }
-            else if (strstr(buf, "INVALID_MOVE:") != NULL) {
-                printf("\n[ERROR] %s", buf);
-                printf(">>> Try again. Enter move (1-9): ");
-                fflush(stdout);
-            }
-            else if (strstr(buf, "MOVE_MADE:") != NULL) {
-                printf("%s", buf);
-            }
-            else if (strstr(buf, "BOARD:") != NULL) {
-                printf("\n%s", buf);
-            }
-            else if (strstr(buf, "LOBBY:") != NULL) {
-                if (current_state == STATE_LOBBY) {
-                    printf("\n--- Online Players ---\n");
-                    char *players = buf + 6;  // Skip "LOBBY:"
-                    if (strstr(players, "No players") != NULL) {
-                        printf("No other players online\n");
-                    } else {
-                        printf("%s", players);
-                    }
-                    printf("----------------------\n");
-                }
-            }
-            else if (strstr(buf, "INVITE_FROM") != NULL) {
-                printf("\n[NOTIFICATION] %s", buf);
-                printf("Type 'accept <username>' or 'decline <username>'\n");
-            }
-            else if (strstr(buf, "INVITE_SENT") != NULL) {
-                printf("[INFO] %s", buf);
-            }
-            else if (strstr(buf, "INVITE_DECLINED_BY") != NULL) {
-                printf("\n[NOTIFICATION] %s", buf);
-            }
-            else if (strstr(buf, "PLAYER_NOT_AVAILABLE") != NULL) {
-                printf("[ERROR] Player is not available or doesn't exist\n");
-            }
-            else if (strstr(buf, "OPPONENT_TIMEOUT") != NULL) {
-                printf("\n[GAME RESULT] %s", buf);
-            }
-            else if (strstr(buf, "TIMEOUT:") != NULL) {
-                printf("\n[GAME RESULT] %s", buf);
-            }
-            else if (strstr(buf, "OPPONENT_DISCONNECTED") != NULL) {
-                printf("\n[GAME RESULT] %s", buf);
-            }
-            else if (strstr(buf, "Leaderboard") != NULL) {
-                printf("\n%s", buf);
-            }
-            else if (strstr(buf, "GOODBYE") != NULL) {
-                printf("Disconnected. Goodbye!\n");
-                break;
-            }
-            else {
-                // Print any other messages
-                printf("%s", buf);
-            }
+            // Frames carry their own length, so coalesced messages split cleanly
+            if (process_server_frames() == -1) break;
         }
     }
     
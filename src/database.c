@@ -1,248 +1,1071 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 #include "../include/database.h"
+#include "../include/ostree.h"
+#include "../include/gamelog.h"
+#include "../include/metrics.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <unistd.h>
 
 #define USER_DB "data/users.db"
-#define STAT_DB "data/stats.db"
+#define STAT_DB "data/stats.db"      // Text audit log of results, if STATS_LOG_ENV is set
+#define STATS_STORE "data/stats.bin"
+#define STATS_JOURNAL "data/stats.journal"
 
-int user_exists(const char *user) {
-    FILE *f = fopen(USER_DB, "r");
-    if (!f) return 0;
-    
-    int fd = fileno(f);
-    flock(fd, LOCK_SH);  // Shared lock for reading
-    
-    char line[128];
-    int found = 0;
-    while (fgets(line, sizeof(line), f)) {
-        line[strcspn(line, "\n")] = 0;
-        char line_copy[128];
-        strncpy(line_copy, line, sizeof(line_copy) - 1);
-        line_copy[sizeof(line_copy) - 1] = '\0';
-        
-        char *u = strtok(line_copy, ":");
-        if (u && strcmp(u, user) == 0) {
-            found = 1;
-            break;
+// In-memory index of users.db, kept in each process that serves logins.
+// Open addressing (linear probing) maps a username to its record in a
+// string arena; a Bloom filter in front turns most unknown names away
+// without probing. The file is indexed once and then only the bytes
+// appended since (by this process or another shard) are read.
+#define USER_TABLE_MIN 1024       // Slots; always a power of two, at most half full
+#define BLOOM_BITS_PER_SLOT 8     // >= 16 bits per user at full load
+#define BLOOM_PROBES 4
+
+struct user_slot {
+    uint64_t hash;      // 0 = empty
+    uint32_t record;    // Offset of "user\0pass\0" in user_arena
+};
+
+static struct user_slot *user_table = NULL;
+static size_t user_cap = 0, user_count = 0;
+static uint64_t *bloom = NULL;            // user_cap * BLOOM_BITS_PER_SLOT bits
+static char *user_arena = NULL;
+static size_t arena_len = 0, arena_cap = 0;
+static int users_fd = -1;
+static off_t users_indexed = 0;           // Bytes of users.db in the index
+
+// flock that records how long the caller waited for the lock
+static int timed_flock(int fd, int op) {
+    long long start = metrics_now_us();
+    int rc = flock(fd, op);
+    metrics_observe(METRIC_FLOCK_WAIT, metrics_now_us() - start);
+    return rc;
+}
+
+static uint64_t hash_user(const char *s) {
+    // FNV-1a, 64-bit: the Bloom filter takes its probes from both halves
+    uint64_t h = 14695981039346656037ULL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+static void bloom_add(uint64_t h) {
+    size_t bits = user_cap * BLOOM_BITS_PER_SLOT;
+    uint64_t step = (h >> 32) | 1;
+    for (int i = 0; i < BLOOM_PROBES; i++, h += step) {
+        size_t bit = h & (bits - 1);
+        bloom[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+static int bloom_maybe(uint64_t h) {
+    if (!bloom) return 0;
+    size_t bits = user_cap * BLOOM_BITS_PER_SLOT;
+    uint64_t step = (h >> 32) | 1;
+    for (int i = 0; i < BLOOM_PROBES; i++, h += step) {
+        size_t bit = h & (bits - 1);
+        if (!(bloom[bit / 64] >> (bit % 64) & 1)) return 0;
+    }
+    return 1;
+}
+
+static const char *record_user(uint32_t record) {
+    return user_arena + record;
+}
+
+static const char *record_pass(uint32_t record) {
+    return user_arena + record + strlen(user_arena + record) + 1;
+}
+
+static struct user_slot *find_slot(uint64_t h, const char *user) {
+    size_t i = h & (user_cap - 1);
+    while (user_table[i].hash) {
+        if (user_table[i].hash == h && strcmp(record_user(user_table[i].record), user) == 0) {
+            return &user_table[i];
         }
+        i = (i + 1) & (user_cap - 1);
     }
-    
-    flock(fd, LOCK_UN);
-    fclose(f);
-    return found;
+    return &user_table[i];  // Empty slot where it would go
 }
 
-int validate_login(const char *user, const char *pass) {
-    FILE *f = fopen(USER_DB, "r");
-    if (!f) {
-        perror("fopen users.db failed");
-        return 0;
-    }
-    
-    int fd = fileno(f);
-    flock(fd, LOCK_SH);  // Shared lock for reading
-    
-    char line[128];
-    int valid = 0;
-    while (fgets(line, sizeof(line), f)) {
-        line[strcspn(line, "\n")] = 0;
-        char line_copy[128];
-        strncpy(line_copy, line, sizeof(line_copy) - 1);
-        line_copy[sizeof(line_copy) - 1] = '\0';
-        
-        char *u = strtok(line_copy, ":");
-        char *p = strtok(NULL, ":");
-        if (u && p && strcmp(u, user) == 0 && strcmp(p, pass) == 0) {
-            valid = 1;
-            break;
+// Double the table and rebuild the filter from the entries
+static int grow_table() {
+    size_t new_cap = user_cap ? user_cap * 2 : USER_TABLE_MIN;
+    struct user_slot *nt = calloc(new_cap, sizeof(*nt));
+    uint64_t *nb = calloc(new_cap * BLOOM_BITS_PER_SLOT / 64, sizeof(*nb));
+    if (!nt || !nb) {
+        perror("calloc user index failed");
+        free(nt);
+        free(nb);
+        return -1;
+    }
+
+    struct user_slot *old = user_table;
+    size_t old_cap = user_cap;
+    free(bloom);
+    user_table = nt;
+    bloom = nb;
+    user_cap = new_cap;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (!old[i].hash) continue;
+        *find_slot(old[i].hash, record_user(old[i].record)) = old[i];
+        bloom_add(old[i].hash);
+    }
+    free(old);
+    return 0;
+}
+
+static void index_user(const char *user, const char *pass) {
+    if ((user_count + 1) * 2 > user_cap && grow_table() == -1) return;
+
+    uint64_t h = hash_user(user);
+    struct user_slot *slot = find_slot(h, user);
+    if (slot->hash) return;  // First record wins, as with the old file scan
+
+    size_t ulen = strlen(user) + 1, plen = strlen(pass) + 1;
+    if (arena_len + ulen + plen > arena_cap) {
+        size_t new_cap = arena_cap ? arena_cap * 2 : 64 * 1024;
+        while (new_cap < arena_len + ulen + plen) new_cap *= 2;
+        char *na = realloc(user_arena, new_cap);
+        if (!na) {
+            perror("realloc user arena failed");
+            return;
         }
+        user_arena = na;
+        arena_cap = new_cap;
     }
-    
-    flock(fd, LOCK_UN);
-    fclose(f);
-    return valid;
+    memcpy(user_arena + arena_len, user, ulen);
+    memcpy(user_arena + arena_len + ulen, pass, plen);
+
+    slot->hash = h;
+    slot->record = (uint32_t)arena_len;
+    arena_len += ulen + plen;
+    user_count++;
+    bloom_add(h);
+}
+
+static int open_users() {
+    if (users_fd != -1) return 0;
+    if (!user_table && grow_table() == -1) return -1;
+
+    users_fd = open(USER_DB, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (users_fd == -1) {
+        perror("open users.db failed");
+        return -1;
+    }
+    return 0;
+}
+
+// Index whatever was appended to users.db since the last call; the caller
+// holds a lock on users_fd. Returns the number of bytes read, or -1.
+static ssize_t index_appended() {
+    struct stat st;
+    if (fstat(users_fd, &st) == -1) return -1;
+    if (st.st_size <= users_indexed) return 0;
+
+    size_t len = st.st_size - users_indexed;
+    char *buf = malloc(len);
+    if (!buf) {
+        perror("malloc users.db read failed");
+        return -1;
+    }
+    ssize_t got = pread(users_fd, buf, len, users_indexed);
+    if (got <= 0) {
+        free(buf);
+        return -1;
+    }
+
+    // Only whole lines; a record still being written is picked up next time
+    char *p = buf, *end = buf + got, *nl;
+    while ((nl = memchr(p, '\n', end - p))) {
+        *nl = '\0';
+        char *colon = strchr(p, ':');
+        if (colon) {
+            *colon = '\0';
+            char *pass = colon + 1;
+            pass[strcspn(pass, ":")] = '\0';
+            if (*p) index_user(p, pass);
+        }
+        p = nl + 1;
+    }
+    ssize_t used = p - buf;
+    users_indexed += used;
+    free(buf);
+    return used;
 }
 
-void register_user(const char *user, const char *pass) {
-    if (user_exists(user)) {
+// Index entry for 'user', or NULL. Only a name missing from the index
+// costs an fstat, to pick up users another shard registered meanwhile.
+static struct user_slot *lookup_user(const char *user) {
+    uint64_t h = hash_user(user);
+
+    if (bloom_maybe(h)) {
+        struct user_slot *slot = find_slot(h, user);
+        if (slot->hash) return slot;
+    }
+
+    if (open_users() == -1) return NULL;
+    timed_flock(users_fd, LOCK_SH);
+    ssize_t added = index_appended();
+    flock(users_fd, LOCK_UN);
+    if (added <= 0 || !bloom_maybe(h)) return NULL;
+
+    struct user_slot *slot = find_slot(h, user);
+    return slot->hash ? slot : NULL;
+}
+
+int user_exists(const char *user) {
+    return lookup_user(user) != NULL;
+}
+
+int validate_login(const char *user, const char *pass) {
+    struct user_slot *slot = lookup_user(user);
+    return slot && strcmp(record_pass(slot->record), pass) == 0;
+}
+
+int register_user(const char *user, const char *pass) {
+    if (lookup_user(user)) {
         fprintf(stderr, "User '%s' already exists\n", user);
-        return;
+        return -1;
     }
-    
-    FILE *f = fopen(USER_DB, "a");
-    if (!f) {
-        perror("fopen users.db for append failed");
-        return;
+    if (open_users() == -1) return -1;
+
+    // Catch up under the exclusive lock so two shards cannot both add a name
+    timed_flock(users_fd, LOCK_EX);
+    index_appended();
+    uint64_t h = hash_user(user);
+    if (bloom_maybe(h) && find_slot(h, user)->hash) {
+        flock(users_fd, LOCK_UN);
+        fprintf(stderr, "User '%s' already exists\n", user);
+        return -1;
     }
-    
-    int fd = fileno(f);
-    flock(fd, LOCK_EX);  // Exclusive lock for writing
-    
-    fprintf(f, "%s:%s\n", user, pass);
-    
-    flock(fd, LOCK_UN);
-    fclose(f);
-    
+
+    char line[160];
+    int len = snprintf(line, sizeof(line), "%s:%s\n", user, pass);
+    if (write(users_fd, line, len) != len) {
+        perror("write users.db failed");
+        flock(users_fd, LOCK_UN);
+        return -1;
+    }
+    index_user(user, pass);
+    users_indexed += len;
+    flock(users_fd, LOCK_UN);
+
     printf("[DATABASE] User '%s' registered successfully\n", user);
+    return 0;
 }
 
-void update_stats(const char *user, const char *result) {
-    FILE *f = fopen(STAT_DB, "a");
-    if (!f) {
-        perror("fopen stats.db for append failed");
+// Per-user totals in data/stats.bin, one fixed-size record per user. Every
+// process that records or reads results maps the file shared; counters are
+// bumped in place with atomic adds, so no lock is taken per result. Only
+// adding a user takes the file lock. The whole record range is reserved
+// up front so the mapping never moves; the file itself grows in steps.
+// Each result also goes into a ring of changed record numbers, from which
+// the server keeps its leaderboard order up to date.
+//
+// Only the stats writer process changes the counters. Game hosts put each
+// finished game into a submission queue in the same file and go on; the
+// writer takes whatever has queued up, appends it to data/stats.journal in
+// one write, then applies it. A game is one journal line, so after a crash
+// either both players' results are replayed or neither is.
+#define STATS_MAGIC 0x53545454u      // "TTTS"
+#define STATS_MAX_RECORDS (1 << 20)
+#define STATS_GROW 1024              // Records added to the file at a time
+#define STATS_RING 4096              // Changes kept for readers; a power of two
+#define STATS_QUEUE 4096             // Games waiting for the writer; a power of two
+#define STATS_BATCH 256              // Games committed per journal write, at most
+#define STATS_IDLE_MS 100            // Writer checks for shutdown this often when idle
+#define STATS_STALL_MS 1000          // Skip a queued game its host never finished filling in
+#define STATS_JOURNAL_MAX (1 << 20)  // Checkpoint and truncate the journal past this size
+
+struct stats_record {
+    char user[64];
+    uint32_t wins, losses, draws;
+    uint32_t seq;           // Last journal entry applied to this record
+    int32_t rating;
+    int32_t change;         // Rating change game 'seq' made, for journal replay
+};
+
+struct stats_header {
+    uint32_t magic;
+    uint32_t record_size;
+    uint32_t count;         // Records in use; a record is filled in before it counts
+    uint32_t capacity;      // Records the file has room for
+    uint32_t head;          // Changes claimed so far (the ring's version counter)
+    uint32_t ring_size;
+    uint32_t queue_size;
+    uint32_t queue_entry;   // sizeof(struct stats_game)
+    uint32_t queue_head;    // Games submitted so far
+    uint32_t queue_tail;    // Games taken by the writer
+    uint32_t queue_signal;  // Futex the writer sleeps on; bumped per submission
+    uint32_t applied;       // Last journal entry applied in full
+    char reserved[16];
+};
+
+// Ring entry; version is 0 while a writer fills it in
+struct stats_change {
+    uint32_t version;
+    uint32_t record;
+};
+
+// Queue entry; ticket is the submission number + 1 once it is filled in
+struct stats_game {
+    uint32_t ticket;
+    struct game_record game;
+};
+
+struct stats_file {
+    struct stats_header hdr;
+    struct stats_change ring[STATS_RING];
+    struct stats_game queue[STATS_QUEUE];
+    struct stats_record records[];
+};
+
+static struct stats_file *stats = NULL;
+static int stats_fd = -1;
+static int32_t *stats_index = NULL;      // Open addressing: record number, -1 if empty
+static size_t stats_index_cap = 0;
+static uint32_t stats_indexed = 0;       // Records in stats_index
+static int stats_audit = 0;              // Writer appends results to STAT_DB too
+
+static int32_t *stats_slot(const char *user) {
+    size_t i = hash_user(user) & (stats_index_cap - 1);
+    while (stats_index[i] != -1 && strcmp(stats->records[stats_index[i]].user, user) != 0) {
+        i = (i + 1) & (stats_index_cap - 1);
+    }
+    return &stats_index[i];
+}
+
+// Index the records other processes (or this one) have added since last time
+static void stats_sync() {
+    uint32_t count = __atomic_load_n(&stats->hdr.count, __ATOMIC_ACQUIRE);
+
+    if (!stats_index || (size_t)count * 2 > stats_index_cap) {
+        size_t cap = stats_index_cap ? stats_index_cap : USER_TABLE_MIN;
+        while ((size_t)count * 2 > cap) cap *= 2;
+        int32_t *ni = malloc(cap * sizeof(*ni));
+        if (!ni) {
+            perror("malloc stats index failed");
+            return;
+        }
+        memset(ni, 0xff, cap * sizeof(*ni));
+        free(stats_index);
+        stats_index = ni;
+        stats_index_cap = cap;
+        stats_indexed = 0;
+    }
+    for (; stats_indexed < count; stats_indexed++) {
+        *stats_slot(stats->records[stats_indexed].user) = (int32_t)stats_indexed;
+    }
+}
+
+// Append a record for 'user'; the caller holds LOCK_EX and has synced
+static struct stats_record *stats_add(const char *user) {
+    struct stats_header *h = &stats->hdr;
+
+    if (h->count == STATS_MAX_RECORDS) {
+        fprintf(stderr, "[DATABASE] Stats store full, not recording '%s'\n", user);
+        return NULL;
+    }
+    if (h->count == h->capacity) {
+        uint32_t cap = h->capacity + STATS_GROW;
+        if (ftruncate(stats_fd, sizeof(struct stats_file) +
+                                (off_t)cap * sizeof(struct stats_record)) == -1) {
+            perror("ftruncate stats.bin failed");
+            return NULL;
+        }
+        h->capacity = cap;
+    }
+
+    struct stats_record *r = &stats->records[h->count];
+    memset(r, 0, sizeof(*r));
+    strncpy(r->user, user, sizeof(r->user) - 1);
+    r->rating = RATING_INITIAL;
+    __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELEASE);
+    stats_sync();
+    return r;
+}
+
+// Tell leaderboard readers a record changed. Lock-free, so a game process
+// that dies here cannot block anyone; readers resync if an entry never fills.
+static void stats_publish(uint32_t record) {
+    uint32_t v = __atomic_add_fetch(&stats->hdr.head, 1, __ATOMIC_ACQ_REL);
+    struct stats_change *ch = &stats->ring[v & (STATS_RING - 1)];
+
+    __atomic_store_n(&ch->version, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&ch->record, record, __ATOMIC_RELAXED);
+    __atomic_store_n(&ch->version, v, __ATOMIC_RELEASE);
+}
+
+static void stats_count(struct stats_record *r, const char *result) {
+    if (strcmp(result, "WIN") == 0) {
+        __atomic_fetch_add(&r->wins, 1, __ATOMIC_RELAXED);
+    } else if (strcmp(result, "LOSS") == 0) {
+        __atomic_fetch_add(&r->losses, 1, __ATOMIC_RELAXED);
+    } else if (strcmp(result, "DRAW") == 0) {
+        __atomic_fetch_add(&r->draws, 1, __ATOMIC_RELAXED);
+    } else {
         return;
     }
-    
-    int fd = fileno(f);
-    flock(fd, LOCK_EX);  // Exclusive lock for writing
-    
-    fprintf(f, "%s %s\n", user, result);
-    
-    flock(fd, LOCK_UN);
-    fclose(f);
-    
-    printf("[DATABASE] Updated stats for '%s': %s\n", user, result);
+    stats_publish((uint32_t)(r - stats->records));
 }
 
-void get_leaderboard(char *buf, size_t size) {
+// Rebuild totals from the text log, when the store is new and the log exists
+static void stats_import_log() {
     FILE *f = fopen(STAT_DB, "r");
-    if (!f) {
-        strncpy(buf, "No statistics available yet.\n", size);
-        buf[size - 1] = '\0';
-        return;
+    if (!f) return;
+
+    timed_flock(fileno(f), LOCK_SH);
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        char *u = strtok(line, " \n");
+        char *r = strtok(NULL, " \n");
+        if (!u || !r || strlen(u) >= sizeof(stats->records[0].user)) continue;
+
+        stats_sync();
+        int32_t *slot = stats_slot(u);
+        struct stats_record *rec = *slot != -1 ? &stats->records[*slot] : stats_add(u);
+        if (rec) stats_count(rec, r);
     }
-    
-    int fd = fileno(f);
-    flock(fd, LOCK_SH);  // Shared lock for reading
-    
-    // Dynamic structure to track all users
-    struct LeaderEntry {
-        char user[64];
-        int wins;
-        int losses;
-        int draws;
-    };
-    
-    struct LeaderEntry *leaders = NULL;
-    int count = 0;
-    int capacity = 10;
-    leaders = malloc(capacity * sizeof(struct LeaderEntry));
-    
-    if (!leaders) {
+    flock(fileno(f), LOCK_UN);
+    fclose(f);
+    printf("[DATABASE] Imported %u users from %s\n", stats->hdr.count, STAT_DB);
+}
+
+static int stats_open() {
+    if (stats) return 0;
+
+    size_t map_size = sizeof(struct stats_file) +
+                      (size_t)STATS_MAX_RECORDS * sizeof(struct stats_record);
+    int fd = open(STATS_STORE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("open stats.bin failed");
+        return -1;
+    }
+    struct stats_file *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap stats.bin failed");
+        close(fd);
+        return -1;
+    }
+
+    timed_flock(fd, LOCK_EX);
+    struct stat st;
+    int fresh = fstat(fd, &st) == 0 && st.st_size < (off_t)sizeof(struct stats_file);
+    if (fresh && st.st_size == 0 && ftruncate(fd, sizeof(struct stats_file)) == 0) {
+        map->hdr.magic = STATS_MAGIC;
+        map->hdr.record_size = sizeof(struct stats_record);
+        map->hdr.ring_size = STATS_RING;
+        map->hdr.queue_size = STATS_QUEUE;
+        map->hdr.queue_entry = sizeof(struct stats_game);
+    }
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(struct stats_file) ||
+        map->hdr.magic != STATS_MAGIC || map->hdr.record_size != sizeof(struct stats_record) ||
+        map->hdr.ring_size != STATS_RING || map->hdr.queue_size != STATS_QUEUE ||
+        map->hdr.queue_entry != sizeof(struct stats_game)) {
+        fprintf(stderr, "[DATABASE] %s is not a stats store, ignoring it\n", STATS_STORE);
         flock(fd, LOCK_UN);
-        fclose(f);
-        strncpy(buf, "Memory allocation error\n", size);
-        buf[size - 1] = '\0';
+        munmap(map, map_size);
+        close(fd);
+        return -1;
+    }
+
+    stats = map;
+    stats_fd = fd;
+    stats_sync();
+    if (fresh) stats_import_log();
+    flock(fd, LOCK_UN);
+    return 0;
+}
+
+static struct stats_record *stats_find(const char *user) {
+    if (stats_open() == -1) return NULL;
+
+    stats_sync();
+    int32_t *slot = stats_slot(user);
+    return *slot != -1 ? &stats->records[*slot] : NULL;
+}
+
+static void futex_wake(uint32_t *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+// Sleep while *addr == val, for at most 'ms'
+static void futex_wait(uint32_t *addr, uint32_t val, long ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static long elapsed_us(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+uint32_t record_game(const struct game_record *game) {
+    if (stats_open() == -1) return 0;
+    struct stats_header *h = &stats->hdr;
+
+    // Claim a queue entry; lock-free, so a host that dies here blocks nobody
+    uint32_t t = __atomic_load_n(&h->queue_head, __ATOMIC_RELAXED);
+    do {
+        if (t - __atomic_load_n(&h->queue_tail, __ATOMIC_ACQUIRE) >= STATS_QUEUE) {
+            fprintf(stderr, "[DATABASE] Stats queue full, dropping %s vs %s\n",
+                    game->player[0], game->player[1]);
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&h->queue_head, &t, t + 1, 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    struct stats_game *g = &stats->queue[t & (STATS_QUEUE - 1)];
+    memcpy(&g->game, game, sizeof(*game));
+    __atomic_store_n(&g->ticket, t + 1, __ATOMIC_RELEASE);
+
+    __atomic_fetch_add(&h->queue_signal, 1, __ATOMIC_RELEASE);
+    futex_wake(&h->queue_signal);
+    return t + 1;
+}
+
+// ---- Stats writer ----
+
+// Journal entries and game ids are the queue tickets of the games
+static int journal_fd = -1;
+static uint32_t journal_seq = 0;       // Last game in the journal
+static uint32_t gamelog_last = 0;      // Last game in the game log
+
+static struct stats_record *stats_find_or_add(const char *user) {
+    struct stats_record *r = stats_find(user);
+    if (!r) {
+        // First game for this user: add the record under the file lock
+        timed_flock(stats_fd, LOCK_EX);
+        r = stats_find(user);
+        if (!r) r = stats_add(user);
+        flock(stats_fd, LOCK_UN);
+    }
+    return r;
+}
+
+// Elo: the winner (either player, for a draw) gains what the loser loses
+static int rating_change(int winner, int loser, int draw) {
+    double expected = 1.0 / (1.0 + pow(10.0, (loser - winner) / 400.0));
+    return (int)lround(RATING_K * ((draw ? 0.5 : 1.0) - expected));
+}
+
+static void apply_result(uint32_t seq, struct stats_record *r, const char *result, int change) {
+    // Replaying the journal after a crash: this half may have made it already
+    if (!r || r->seq >= seq) return;
+    // Before the count, whose ring entry tells readers to look again
+    __atomic_store_n(&r->rating, r->rating + change, __ATOMIC_RELAXED);
+    r->change = change;
+    stats_count(r, result);
+    r->seq = seq;
+}
+
+static void apply_game(uint32_t seq, int draw, const char *a, const char *b) {
+    struct stats_record *ra = stats_find_or_add(a), *rb = stats_find_or_add(b);
+    int change = 0;
+
+    // A half applied before a crash fixes the change for the other half
+    if (ra && ra->seq >= seq) {
+        change = ra->change;
+    } else if (rb && rb->seq >= seq) {
+        change = -rb->change;
+    } else if (ra && rb) {
+        change = rating_change(ra->rating, rb->rating, draw);
+    }
+    apply_result(seq, ra, draw ? "DRAW" : "WIN", change);
+    apply_result(seq, rb, draw ? "DRAW" : "LOSS", -change);
+    stats->hdr.applied = seq;
+}
+
+// Flush the store and start the journal again; everything in it is applied
+static void stats_checkpoint() {
+    size_t len = sizeof(struct stats_file) + (size_t)stats->hdr.capacity * sizeof(struct stats_record);
+    if (msync(stats, len, MS_SYNC) == -1) {
+        perror("msync stats.bin failed");
         return;
     }
-    
-    char line[256];
+    if (ftruncate(journal_fd, 0) == -1) perror("ftruncate stats.journal failed");
+}
+
+// Apply what the journal holds beyond the store: the writer died after
+// committing a batch but before (or while) applying it
+static void stats_replay() {
+    FILE *f = fopen(STATS_JOURNAL, "r");
+    if (!f) return;
+
+    char line[256], kind[8], a[64], b[64];
+    uint32_t seq;
+    int replayed = 0;
+    journal_seq = stats->hdr.applied;
     while (fgets(line, sizeof(line), f)) {
-        line[strcspn(line, "\n")] = '\0';
-        char line_copy[256];
-        strncpy(line_copy, line, sizeof(line_copy) - 1);
-        line_copy[sizeof(line_copy) - 1] = '\0';
-        
-        char *u = strtok(line_copy, " ");
-        char *r = strtok(NULL, " ");
-        
-        if (!u || !r) continue;
-        
-        // Find or create user entry
-        int found = 0;
-        for (int i = 0; i < count; i++) {
-            if (strcmp(leaders[i].user, u) == 0) {
-                if (strcmp(r, "WIN") == 0) {
-                    leaders[i].wins++;
-                } else if (strcmp(r, "LOSS") == 0) {
-                    leaders[i].losses++;
-                } else if (strcmp(r, "DRAW") == 0) {
-                    leaders[i].draws++;
-                }
-                found = 1;
-                break;
-            }
+        // A torn last line was never committed
+        if (!strchr(line, '\n')) break;
+        if (sscanf(line, "%u %7s %63s %63s", &seq, kind, a, b) != 4) continue;
+        if (seq > journal_seq) journal_seq = seq;
+        if (seq <= stats->hdr.applied) continue;
+        apply_game(seq, strcmp(kind, "DRAW") == 0, a, b);
+        replayed++;
+    }
+    fclose(f);
+    if (replayed) {
+        printf("[STATS] Replayed %d game%s from %s\n", replayed, replayed == 1 ? "" : "s", STATS_JOURNAL);
+    }
+}
+
+// A rated game as winner and loser (either way round for a draw)
+static const char *game_player(const struct game_record *g, int loser) {
+    int first = g->winner == 2 ? 1 : 0;
+    return g->player[loser ? 1 - first : first];
+}
+
+static int game_rated(const struct stats_game *g) {
+    return !g->game.bot;
+}
+
+// Append one line per result to the text audit log, in one write
+static void stats_log_batch(const struct stats_game *batch, int n, uint32_t after) {
+    char buf[STATS_BATCH * 2 * 80];
+    size_t len = 0;
+
+    for (int i = 0; i < n; i++) {
+        const struct stats_game *g = &batch[i];
+        if (!game_rated(g) || g->ticket <= after) continue;
+        int draw = g->game.winner == 0;
+        len += snprintf(buf + len, sizeof(buf) - len, "%s %s\n%s %s\n",
+                        game_player(&g->game, 0), draw ? "DRAW" : "WIN",
+                        game_player(&g->game, 1), draw ? "DRAW" : "LOSS");
+    }
+    if (len == 0) return;
+
+    int fd = open(STAT_DB, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("open stats.db for append failed");
+        return;
+    }
+    timed_flock(fd, LOCK_EX);
+    if (write(fd, buf, len) != (ssize_t)len) perror("write stats.db failed");
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+// Add the batch's games to the game log, those not in it from before a crash
+static void log_games(const struct stats_game *batch, int n, int sync) {
+    static struct gamelog_entry entries[STATS_BATCH];
+    static const uint8_t *packed[STATS_BATCH];
+    int count = 0;
+
+    for (int i = 0; i < n; i++) {
+        const struct game_record *g = &batch[i].game;
+        if (batch[i].ticket <= gamelog_last) continue;
+
+        struct gamelog_entry *e = &entries[count];
+        memset(e, 0, sizeof(*e));
+        e->id = batch[i].ticket;
+        for (int p = 0; p < 2; p++) {
+            struct stats_record *r = g->bot == p + 1 ? NULL : stats_find_or_add(g->player[p]);
+            e->player[p] = r ? (uint32_t)(r - stats->records) : GAMELOG_BOT;
         }
-        
-        if (!found) {
-            // Expand array if needed
-            if (count >= capacity) {
-                capacity *= 2;
-                struct LeaderEntry *new_leaders = realloc(leaders, capacity * sizeof(struct LeaderEntry));
-                if (!new_leaders) {
-                    free(leaders);
-                    flock(fd, LOCK_UN);
-                    fclose(f);
-                    strncpy(buf, "Memory allocation error\n", size);
-                    buf[size - 1] = '\0';
-                    return;
-                }
-                leaders = new_leaders;
-            }
-            
-            // Add new user
-            strncpy(leaders[count].user, u, sizeof(leaders[count].user) - 1);
-            leaders[count].user[sizeof(leaders[count].user) - 1] = '\0';
-            leaders[count].wins = (strcmp(r, "WIN") == 0) ? 1 : 0;
-            leaders[count].losses = (strcmp(r, "LOSS") == 0) ? 1 : 0;
-            leaders[count].draws = (strcmp(r, "DRAW") == 0) ? 1 : 0;
-            count++;
+        e->started = g->started;
+        e->rows = g->shape.rows;
+        e->cols = g->shape.cols;
+        e->k = g->shape.k;
+        e->winner = g->winner;
+        e->end = g->end;
+        e->bits = (uint8_t)gamelog_move_bits(g->shape);
+        e->moves = g->moves;
+        packed[count++] = g->packed;
+    }
+    if (count > 0 && gamelog_append(entries, packed, count, sync) == 0) {
+        gamelog_last = entries[count - 1].id;
+    }
+}
+
+static void commit_batch(const struct stats_game *batch, int n, int sync) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The game log goes first. A crash before the journal write leaves the
+    // batch in the queue, and the games already logged are skipped next time.
+    log_games(batch, n, sync);
+
+    char buf[STATS_BATCH * 160];
+    size_t len = 0;
+    uint32_t before = journal_seq;
+    for (int i = 0; i < n; i++) {
+        const struct stats_game *g = &batch[i];
+        if (!game_rated(g) || g->ticket <= before) continue;
+        len += snprintf(buf + len, sizeof(buf) - len, "%u %s %s %s\n", g->ticket,
+                        g->game.winner ? "WIN" : "DRAW",
+                        game_player(&g->game, 0), game_player(&g->game, 1));
+        journal_seq = g->ticket;
+    }
+    if (len > 0 && write(journal_fd, buf, len) != (ssize_t)len) {
+        // Still apply: the counters are what players see
+        perror("write stats.journal failed");
+    } else if (len > 0 && sync && fdatasync(journal_fd) == -1) {
+        perror("fdatasync stats.journal failed");
+    }
+    long commit_us = elapsed_us(&start);
+
+    for (int i = 0; i < n; i++) {
+        const struct stats_game *g = &batch[i];
+        if (game_rated(g)) {
+            apply_game(g->ticket, g->game.winner == 0,
+                       game_player(&g->game, 0), game_player(&g->game, 1));
         }
     }
-    
-    flock(fd, LOCK_UN);
-    fclose(f);
-    
-    // Sort by wins (descending), then by win rate
-    for (int i = 0; i < count - 1; i++) {
-        for (int j = 0; j < count - i - 1; j++) {
-            int total_j = leaders[j].wins + leaders[j].losses + leaders[j].draws;
-            int total_j1 = leaders[j+1].wins + leaders[j+1].losses + leaders[j+1].draws;
-            
-            double rate_j = (total_j > 0) ? (double)leaders[j].wins / total_j : 0;
-            double rate_j1 = (total_j1 > 0) ? (double)leaders[j+1].wins / total_j1 : 0;
-            
-            // Primary: sort by wins, Secondary: sort by win rate
-            if (leaders[j].wins < leaders[j+1].wins || 
-                (leaders[j].wins == leaders[j+1].wins && rate_j < rate_j1)) {
-                struct LeaderEntry temp = leaders[j];
-                leaders[j] = leaders[j+1];
-                leaders[j+1] = temp;
+    // Log after counting: a store created from the log must not count this twice
+    if (stats_audit) stats_log_batch(batch, n, before);
+
+    printf("[STATS] Committed %d game%s (%ld us write%s, %ld us total)\n", n, n == 1 ? "" : "s",
+           commit_us, sync ? "+fdatasync" : "", elapsed_us(&start));
+    fflush(stdout);
+
+    struct stat st;
+    if (fstat(journal_fd, &st) == 0 && st.st_size > STATS_JOURNAL_MAX) stats_checkpoint();
+}
+
+// Copy out the filled-in games at the front of the queue. They stay queued
+// until release_batch, so a writer that dies mid-batch leaves them for the
+// next one.
+static int take_batch(struct stats_game *batch) {
+    struct stats_header *h = &stats->hdr;
+    uint32_t tail = h->queue_tail;
+    uint32_t head = __atomic_load_n(&h->queue_head, __ATOMIC_ACQUIRE);
+    int n = 0;
+
+    while (tail != head && n < STATS_BATCH) {
+        struct stats_game *g = &stats->queue[tail & (STATS_QUEUE - 1)];
+        if (__atomic_load_n(&g->ticket, __ATOMIC_ACQUIRE) != tail + 1) break;
+        batch[n++] = *g;
+        tail++;
+    }
+    return n;
+}
+
+static void release_batch(int n) {
+    __atomic_store_n(&stats->hdr.queue_tail, stats->hdr.queue_tail + n, __ATOMIC_RELEASE);
+}
+
+// The entry at the tail was claimed but is still not filled in
+static int queue_stalled() {
+    struct stats_header *h = &stats->hdr;
+    uint32_t tail = h->queue_tail;
+    return tail != __atomic_load_n(&h->queue_head, __ATOMIC_ACQUIRE) &&
+           __atomic_load_n(&stats->queue[tail & (STATS_QUEUE - 1)].ticket, __ATOMIC_ACQUIRE) != tail + 1;
+}
+
+void stats_writer_run(int sync) {
+    if (stats_open() == -1) exit(1);
+    journal_fd = open(STATS_JOURNAL, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (journal_fd == -1) {
+        perror("open stats.journal failed");
+        exit(1);
+    }
+    stats_audit = getenv(STATS_LOG_ENV) != NULL;
+
+    long logged = gamelog_open();
+    if (logged == -1) exit(1);
+    gamelog_last = (uint32_t)logged;
+
+    // A new stats.bin starts its tickets over; game ids must not repeat
+    struct stats_header *h = &stats->hdr;
+    uint32_t head = __atomic_load_n(&h->queue_head, __ATOMIC_ACQUIRE);
+    if (gamelog_last > head && head == h->queue_tail &&
+        __atomic_compare_exchange_n(&h->queue_head, &head, gamelog_last, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&h->queue_tail, gamelog_last, __ATOMIC_RELEASE);
+    }
+
+    // A torn line must not be left for later appends to run into
+    stats_replay();
+    stats_checkpoint();
+
+    // The parent blocks these for its signalfd; take them synchronously too
+    sigset_t stop;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGTERM);
+    sigaddset(&stop, SIGINT);
+    sigprocmask(SIG_BLOCK, &stop, NULL);
+
+    printf("[STATS] Writer running (PID %d, %s)\n", getpid(),
+           sync ? "fdatasync per batch" : "no fsync");
+    fflush(stdout);
+
+    static struct stats_game batch[STATS_BATCH];
+    struct timespec stall_start;
+    uint32_t stalled = 0;           // Tail + 1 of the entry being waited for, 0 if none
+    int stopping = 0;
+
+    while (1) {
+        uint32_t seen = __atomic_load_n(&stats->hdr.queue_signal, __ATOMIC_ACQUIRE);
+        int n = take_batch(batch);
+        if (n > 0) {
+            commit_batch(batch, n, sync);
+            release_batch(n);
+            continue;
+        }
+
+        if (queue_stalled()) {
+            uint32_t tail = stats->hdr.queue_tail;
+            if (stalled != tail + 1) {
+                stalled = tail + 1;
+                clock_gettime(CLOCK_MONOTONIC, &stall_start);
+            } else if (elapsed_us(&stall_start) >= STATS_STALL_MS * 1000L) {
+                fprintf(stderr, "[STATS] Game %u was never filled in, skipping it\n", tail + 1);
+                __atomic_store_n(&stats->hdr.queue_tail, tail + 1, __ATOMIC_RELEASE);
+                stalled = 0;
+                continue;
             }
+        } else if (stopping) {
+            break;
+        }
+
+        struct timespec zero = { 0, 0 };
+        if (sigtimedwait(&stop, NULL, &zero) > 0) {
+            // Drain what hosts already submitted, then go
+            stopping = 1;
+            continue;
+        }
+        futex_wait(&stats->hdr.queue_signal, seen, stopping ? 10 : STATS_IDLE_MS);
+    }
+
+    stats_checkpoint();
+    printf("[STATS] Writer stopped after game %u\n", gamelog_last);
+    exit(0);
+}
+
+int get_user_stats(const char *user, struct user_stats *out) {
+    struct stats_record *r = stats_find(user);
+    out->rating = RATING_INITIAL;
+    if (!r) return -1;
+
+    out->rating = __atomic_load_n(&r->rating, __ATOMIC_RELAXED);
+    out->wins = __atomic_load_n(&r->wins, __ATOMIC_RELAXED);
+    out->losses = __atomic_load_n(&r->losses, __ATOMIC_RELAXED);
+    out->draws = __atomic_load_n(&r->draws, __ATOMIC_RELAXED);
+    // Players who only met the bot have a record for the game log, not results
+    return out->wins + out->losses + out->draws > 0 ? 0 : -1;
+}
+
+const char *stats_user_name(uint32_t id) {
+    if (stats_open() == -1 || id >= __atomic_load_n(&stats->hdr.count, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return stats->records[id].user;
+}
+
+// Leaderboard order, kept by the processes that answer LEADERBOARD and
+// RANK: players by rating, then wins, then win rate, then age of their
+// record. The rating and counters each player was filed under are kept so
+// the player can be found and moved when a change to their record comes
+// through the ring.
+struct rank_key {
+    int32_t rating;
+    uint32_t wins, losses, draws;
+};
+
+static struct ostree ranking;
+static struct rank_key *rank_keys = NULL;   // Indexed by record number
+static size_t rank_keys_cap = 0;
+static int ranking_ready = 0;
+static uint32_t ranking_seen = 0;           // Last change applied
+static char top_text[2048];                 // Rendered top 10 ...
+static uint32_t top_version = 0;            // ... as of this change
+static int top_valid = 0;
+
+static int rank_cmp(int a, int b, void *arg) {
+    (void)arg;
+    const struct rank_key *ka = &rank_keys[a], *kb = &rank_keys[b];
+    if (ka->rating != kb->rating) return ka->rating > kb->rating ? -1 : 1;
+    if (ka->wins != kb->wins) return ka->wins > kb->wins ? -1 : 1;
+
+    // Higher win rate first, compared exactly: wa / ta against wb / tb
+    uint64_t ta = (uint64_t)ka->wins + ka->losses + ka->draws;
+    uint64_t tb = (uint64_t)kb->wins + kb->losses + kb->draws;
+    uint64_t ra = ka->wins * tb, rb = kb->wins * ta;
+    if (ra != rb) return ra > rb ? -1 : 1;
+    return a < b ? -1 : a > b;
+}
+
+// Refile a record under its current counters
+static void rank_update(uint32_t record) {
+    if (record >= rank_keys_cap) {
+        size_t cap = rank_keys_cap ? rank_keys_cap : STATS_GROW;
+        while (cap <= record) cap *= 2;
+        struct rank_key *nk = realloc(rank_keys, cap * sizeof(*nk));
+        if (!nk) {
+            perror("realloc rank keys failed");
+            return;
+        }
+        rank_keys = nk;
+        rank_keys_cap = cap;
+    }
+
+    struct stats_record *r = &stats->records[record];
+    struct rank_key *k = &rank_keys[record];
+    ostree_remove(&ranking, record);
+    k->rating = __atomic_load_n(&r->rating, __ATOMIC_RELAXED);
+    k->wins = __atomic_load_n(&r->wins, __ATOMIC_RELAXED);
+    k->losses = __atomic_load_n(&r->losses, __ATOMIC_RELAXED);
+    k->draws = __atomic_load_n(&r->draws, __ATOMIC_RELAXED);
+    if (k->wins + k->losses + k->draws > 0) {
+        ostree_insert(&ranking, record);
+    }
+}
+
+static void ranking_rebuild() {
+    ostree_clear(&ranking);
+    ranking_seen = __atomic_load_n(&stats->hdr.head, __ATOMIC_ACQUIRE);
+    uint32_t count = __atomic_load_n(&stats->hdr.count, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < count; i++) {
+        rank_update(i);
+    }
+}
+
+// Apply the changes published since the last call: O(log n) per result
+static void ranking_sync() {
+    if (!ranking_ready) {
+        ostree_init(&ranking, rank_cmp, NULL);
+        ranking_rebuild();
+        ranking_ready = 1;
+        return;
+    }
+
+    uint32_t head = __atomic_load_n(&stats->hdr.head, __ATOMIC_ACQUIRE);
+    while (ranking_seen != head) {
+        uint32_t v = ranking_seen + 1;
+        struct stats_change *ch = &stats->ring[v & (STATS_RING - 1)];
+
+        uint32_t got = __atomic_load_n(&ch->version, __ATOMIC_ACQUIRE);
+        if (got != v) {
+            // Still being written: pick it up next time. Overwritten, or
+            // left unfinished by a writer that died: start over.
+            if ((int32_t)(got - v) > 0 || head - v >= STATS_RING / 2) ranking_rebuild();
+            return;
+        }
+        uint32_t record = __atomic_load_n(&ch->record, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ch->version, __ATOMIC_RELAXED) != v) {
+            ranking_rebuild();
+            return;
+        }
+        if (record < __atomic_load_n(&stats->hdr.count, __ATOMIC_ACQUIRE)) {
+            rank_update(record);
         }
+        ranking_seen = v;
     }
-    
-    // Build output string
+}
+
+// Leaderboard lines for positions offset .. offset + limit - 1
+static void render_ranking(const char *title, int offset, int limit, char *buf, size_t size) {
+    int ranked = ostree_size(&ranking);
+
     buf[0] = '\0';
     strncat(buf, "==========================================\n", size - strlen(buf) - 1);
-    strncat(buf, "           LEADERBOARD (Top 10)          \n", size - strlen(buf) - 1);
+    strncat(buf, title, size - strlen(buf) - 1);
     strncat(buf, "==========================================\n", size - strlen(buf) - 1);
-    
-    if (count == 0) {
+
+    if (ranked == 0) {
         strncat(buf, "No games played yet.\n", size - strlen(buf) - 1);
-    } else {
-        int display_count = (count < 10) ? count : 10;
-        for (int i = 0; i < display_count; i++) {
-            char entry[256];
-            int total = leaders[i].wins + leaders[i].losses + leaders[i].draws;
-            double win_rate = (total > 0) ? (double)leaders[i].wins / total * 100 : 0;
-            
-            snprintf(entry, sizeof(entry), 
-                     "%2d. %-20s | W:%3d L:%3d D:%3d | Rate: %.1f%%\n",
-                     i + 1, 
-                     leaders[i].user,
-                     leaders[i].wins,
-                     leaders[i].losses,
-                     leaders[i].draws,
-                     win_rate);
-            strncat(buf, entry, size - strlen(buf) - 1);
-        }
+    } else if (offset >= ranked) {
+        strncat(buf, "No players at this position.\n", size - strlen(buf) - 1);
+    }
+    for (int i = offset; i < ranked && i < offset + limit; i++) {
+        int record = ostree_select(&ranking, i);
+        const struct rank_key *k = &rank_keys[record];
+        char entry[256];
+        int total = k->wins + k->losses + k->draws;
+        double win_rate = (total > 0) ? (double)k->wins / total * 100 : 0;
+
+        snprintf(entry, sizeof(entry),
+                 "%2d. %-20s | %4d | W:%3u L:%3u D:%3u | Rate: %.1f%%\n",
+                 i + 1,
+                 stats->records[record].user,
+                 k->rating,
+                 k->wins,
+                 k->losses,
+                 k->draws,
+                 win_rate);
+        strncat(buf, entry, size - strlen(buf) - 1);
     }
     strncat(buf, "==========================================\n", size - strlen(buf) - 1);
-    
-    free(leaders);
-}
\ No newline at end of file
+}
+
+static void leaderboard_top(char *buf, size_t size) {
+    if (stats_open() == -1) {
+        strncpy(buf, "No statistics available yet.\n", size);
+        buf[size - 1] = '\0';
+        return;
+    }
+    ranking_sync();
+
+    // Rendered again only once a result has come in
+    if (!top_valid || top_version != ranking_seen) {
+        render_ranking("           LEADERBOARD (Top 10)          \n", 0, 10,
+                       top_text, sizeof(top_text));
+        top_version = ranking_seen;
+        top_valid = 1;
+    }
+    strncpy(buf, top_text, size);
+    buf[size - 1] = '\0';
+}
+
+static void leaderboard_page(int offset, int limit, char *buf, size_t size) {
+    if (stats_open() == -1) {
+        strncpy(buf, "No statistics available yet.\n", size);
+        buf[size - 1] = '\0';
+        return;
+    }
+    ranking_sync();
+
+    char title[64];
+    int ranked = ostree_size(&ranking);
+    int last = offset + limit < ranked ? offset + limit : ranked;
+    if (offset < ranked) {
+        snprintf(title, sizeof(title), "        LEADERBOARD (%d-%d of %d)\n", offset + 1, last, ranked);
+    } else {
+        snprintf(title, sizeof(title), "        LEADERBOARD (%d ranked)\n", ranked);
+    }
+    render_ranking(title, offset, limit, buf, size);
+}
+
+void get_leaderboard(char *buf, size_t size) {
+    long long start = metrics_now_us();
+    leaderboard_top(buf, size);
+    metrics_observe(METRIC_LEADERBOARD_TIME, metrics_now_us() - start);
+}
+
+void get_leaderboard_page(int offset, int limit, char *buf, size_t size) {
+    long long start = metrics_now_us();
+    leaderboard_page(offset, limit, buf, size);
+    metrics_observe(METRIC_LEADERBOARD_TIME, metrics_now_us() - start);
+}
+
+int get_rank(const char *user, int *rank, int *ranked) {
+    struct stats_record *r = stats_find(user);
+    if (!r) return -1;
+    ranking_sync();
+
+    int pos = ostree_rank(&ranking, (int)(r - stats->records));
+    if (pos == -1) return -1;
+    *rank = pos + 1;
+    *ranked = ostree_size(&ranking);
+    return 0;
+}
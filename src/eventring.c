@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+#include "../include/eventring.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define RING_MASK (EVENTRING_SLOTS - 1)
+
+// A slot's sequence is 2 * (ticket + 1) once the record for 'ticket' is
+// complete, and odd while a publisher is writing it
+struct ring_slot {
+    uint64_t seq;
+    struct game_event ev;
+};
+
+struct event_ring {
+    uint64_t head;          // Next ticket
+    char pad[56];           // Keep publishers' head off the counters' line
+    uint64_t dropped;
+    uint64_t overflow;
+    struct ring_slot slots[EVENTRING_SLOTS];
+};
+
+static struct event_ring *ring;
+
+static int map_ring(int oflag) {
+    int fd = shm_open(EVENTRING_NAME, oflag, 0644);
+    if (fd == -1) return -1;
+    if ((oflag & O_CREAT) && ftruncate(fd, sizeof(*ring)) == -1) {
+        perror("ftruncate event ring failed");
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap event ring failed");
+        return -1;
+    }
+    ring = map;
+    return 0;
+}
+
+int eventring_create() {
+    shm_unlink(EVENTRING_NAME);
+    if (map_ring(O_RDWR | O_CREAT | O_EXCL) == -1) {
+        perror("shm_open event ring failed");
+        return -1;
+    }
+    // Zero-filled: no slot holds a complete record yet
+    printf("[IPC] Event ring created at /dev/shm%s (%d slots)\n", EVENTRING_NAME, EVENTRING_SLOTS);
+    return 0;
+}
+
+int eventring_open() {
+    return map_ring(O_RDWR);
+}
+
+void eventring_remove() {
+    shm_unlink(EVENTRING_NAME);
+}
+
+void eventring_publish(int type, const char *p1, const char *p2, int winner) {
+    if (!ring) return;
+
+    uint64_t t = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    struct ring_slot *s = &ring->slots[t & RING_MASK];
+
+    // The slot holds a record from an earlier lap, unless its publisher is
+    // still writing (odd) or was overtaken by a later one
+    uint64_t seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+    if ((seq & 1) || seq >= 2 * (t + 1) ||
+        !__atomic_compare_exchange_n(&s->seq, &seq, 2 * t + 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    struct game_event *ev = &s->ev;
+    ev->type = (uint16_t)type;
+    ev->winner = (uint8_t)winner;
+    ev->reserved = 0;
+    ev->time = (uint32_t)time(NULL);
+    strncpy(ev->player[0], p1, sizeof(ev->player[0]) - 1);
+    ev->player[0][sizeof(ev->player[0]) - 1] = '\0';
+    strncpy(ev->player[1], p2, sizeof(ev->player[1]) - 1);
+    ev->player[1][sizeof(ev->player[1]) - 1] = '\0';
+    __atomic_store_n(&s->seq, 2 * (t + 1), __ATOMIC_RELEASE);
+}
+
+int eventring_read(uint64_t *next, struct game_event *out) {
+    if (!ring) return 0;
+
+    while (1) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (*next >= head) return 0;
+
+        // Lapped: the oldest records left are the last EVENTRING_SLOTS
+        if (head - *next > EVENTRING_SLOTS) {
+            __atomic_fetch_add(&ring->overflow, head - EVENTRING_SLOTS - *next, __ATOMIC_RELAXED);
+            *next = head - EVENTRING_SLOTS;
+        }
+
+        struct ring_slot *s = &ring->slots[*next & RING_MASK];
+        uint64_t want = 2 * (*next + 1);
+        uint64_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq < want) return -1;
+        if (seq == want) {
+            memcpy(out, &s->ev, sizeof(*out));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == want) {
+                (*next)++;
+                return 1;
+            }
+        }
+        // Overwritten by a later lap before or while we read it
+        __atomic_fetch_add(&ring->overflow, 1, __ATOMIC_RELAXED);
+        (*next)++;
+    }
+}
+
+void eventring_skip(uint64_t *next) {
+    if (!ring) return;
+    __atomic_fetch_add(&ring->overflow, 1, __ATOMIC_RELAXED);
+    (*next)++;
+}
+
+uint64_t eventring_head() {
+    return ring ? __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) : 0;
+}
+
+void eventring_get_counters(struct eventring_counters *out) {
+    memset(out, 0, sizeof(*out));
+    if (!ring) return;
+    out->published = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    out->dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    out->overflow = __atomic_load_n(&ring->overflow, __ATOMIC_RELAXED);
+}
+
+void eventring_format(const struct game_event *ev, char *buf, size_t size) {
+    const char *winner = ev->winner == 1 || ev->winner == 2 ? ev->player[ev->winner - 1] : "";
+    const char *loser = ev->winner == 1 ? ev->player[1] : ev->player[0];
+
+    switch (ev->type) {
+    case EVENT_GAME_STARTED:
+        snprintf(buf, size, "Game started: %s vs %s", ev->player[0], ev->player[1]);
+        break;
+    case EVENT_GAME_WON:
+        snprintf(buf, size, "Game ended: %s defeats %s", winner, loser);
+        break;
+    case EVENT_GAME_DRAWN:
+        snprintf(buf, size, "Game ended: %s vs %s - Draw", ev->player[0], ev->player[1]);
+        break;
+    case EVENT_GAME_TIMEOUT:
+        snprintf(buf, size, "Game timeout: %s wins by default", winner);
+        break;
+    case EVENT_GAME_DISCONNECT:
+        snprintf(buf, size, "Player disconnect: %s wins by default", winner);
+        break;
+    default:
+        snprintf(buf, size, "Unknown event %u", ev->type);
+        break;
+    }
+}
@@ -0,0 +1,411 @@
+#include "../include/game.h"
+#include "../include/database.h"
+#include "../include/ipc.h"
+#include "../include/protocol.h"
+#include "../include/bot.h"
+#include "../include/gametable.h"
+#include "../include/eventring.h"
+#include "../include/metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OUT_SIZE 2048  // Output collected per player before an early flush
+
+// Output of the call in progress, per player. Every entry point hands what
+// it produced to g->send() once per player before it returns, so everything
+// one move causes (MOVE_MADE, BOARD, YOUR_TURN or GAME_OVER) leaves in one
+// write. Calls never block or nest, so one buffer serves every game.
+static char out_buf[2][OUT_SIZE];
+static size_t out_len[2];
+static long long move_read_us;  // Read time of a move the call played, 0 if none
+
+static void flush_player(struct game *g, int player) {
+    if (out_len[player - 1] == 0) return;
+    g->send(g, player, out_buf[player - 1], out_len[player - 1]);
+    out_len[player - 1] = 0;
+}
+
+// Send the call's output; a player's move is timed until this point
+static void flush_output(struct game *g) {
+    flush_player(g, 1);
+    flush_player(g, 2);
+    if (move_read_us) {
+        metrics_observe(METRIC_MOVE_TIME, metrics_now_us() - move_read_us);
+        move_read_us = 0;
+    }
+}
+
+static const char *player_name(struct game *g, int player) {
+    return g->user[player - 1];
+}
+
+static void send_player(struct game *g, int player, int type, const void *payload, size_t len) {
+    if (player == g->bot_player) return;  // The bot has no connection
+
+    char buf[PROTO_MAX_FRAME];
+    size_t n = proto_encode(g->proto[player - 1], type, payload, len, buf, sizeof(buf));
+    if (n == 0) return;
+
+    if (n > OUT_SIZE - out_len[player - 1]) flush_player(g, player);
+    if (n > OUT_SIZE) {
+        g->send(g, player, buf, n);
+        return;
+    }
+    memcpy(out_buf[player - 1] + out_len[player - 1], buf, n);
+    out_len[player - 1] += n;
+}
+
+static void send_to_both(struct game *g, int type, const void *payload, size_t len) {
+    send_player(g, 1, type, payload, len);
+    send_player(g, 2, type, payload, len);
+}
+
+// Payload of a player number (or position) byte followed by a name
+static size_t number_and_name(char *buf, int num, const char *name) {
+    size_t len = strlen(name);
+    buf[0] = (char)num;
+    memcpy(buf + 1, name, len);
+    return len + 1;
+}
+
+// Full board snapshot, sent at game start and when a client asks to resync
+static void send_board(struct game *g, int player) {
+    char encoded[BOARD_ENCODED_MAX];
+    size_t len = board_encode(&g->board, encoded);
+    send_player(g, player, MSG_BOARD, encoded, len);
+}
+
+static void send_turn(struct game *g) {
+    send_player(g, g->turn, MSG_YOUR_TURN, NULL, 0);
+}
+
+// The clock starts once per turn; rejected moves do not restart it
+static void start_turn(struct game *g) {
+    send_turn(g);
+    if (g->timers) timer_arm(g->timers, &g->turn_timer, TURN_TIMEOUT_SEC * 1000);
+}
+
+// The players have been told; stop the clock and tell the spectators
+static void stop_game(struct game *g, int winner, int end) {
+    if (g->timers) timer_cancel(g->timers, &g->turn_timer);
+    g->state = GAME_FINISHED;
+    gametable_finish(g->table_slot, &g->board, winner, end);
+    if (g->watch) g->watch(g, WATCH_END, winner, end);
+}
+
+// Hand the finished game to the stats writer and tell 'player' (or both,
+// if 0) which id to replay it by
+static void submit_game(struct game *g, int winner, int end, int player) {
+    gamelog_finish(&g->record, winner, end);
+    uint32_t id = record_game(&g->record);
+    if (id == 0) return;
+
+    char payload[4];
+    proto_put_u32(payload, id);
+    if (player) {
+        send_player(g, player, MSG_GAME_RECORDED, payload, sizeof(payload));
+    } else {
+        send_to_both(g, MSG_GAME_RECORDED, payload, sizeof(payload));
+    }
+}
+
+static int end_game(struct game *g, const char *result, int winner) {
+    char msg[160];
+
+    if (strcmp(result, "WIN") == 0) {
+        size_t len = number_and_name(msg, winner, player_name(g, winner));
+        send_to_both(g, MSG_GAME_OVER, msg, len);
+        submit_game(g, winner, GAME_END_NORMAL, 0);
+        eventring_publish(EVENT_GAME_WON, g->user[0], g->user[1], winner);
+    } else {
+        char draw = 0;
+        send_to_both(g, MSG_GAME_OVER, &draw, 1);
+        submit_game(g, 0, GAME_END_NORMAL, 0);
+        eventring_publish(EVENT_GAME_DRAWN, g->user[0], g->user[1], 0);
+    }
+
+    printf("[GAME] Game ended between %s and %s\n", g->user[0], g->user[1]);
+    stop_game(g, winner, GAME_END_NORMAL);
+    return GAME_FINISHED;
+}
+
+// The other player wins by default (timeout or disconnect). 'tell' is
+// who hears the game's id: 0 for both, or just the winner.
+static void forfeit(struct game *g, int loser, int end, int tell) {
+    int winner = (loser == 1) ? 2 : 1;
+
+    submit_game(g, winner, end, tell);
+    eventring_publish(end == GAME_END_TIMEOUT ? EVENT_GAME_TIMEOUT : EVENT_GAME_DISCONNECT,
+                      g->user[0], g->user[1], winner);
+    stop_game(g, winner, end);
+}
+
+void game_init(struct game *g, const char *p1_user, const char *p2_user,
+               game_send_fn send, void *host) {
+    board_init(&g->board, BOARD_CLASSIC);
+    strncpy(g->user[0], p1_user, sizeof(g->user[0]) - 1);
+    g->user[0][sizeof(g->user[0]) - 1] = '\0';
+    strncpy(g->user[1], p2_user, sizeof(g->user[1]) - 1);
+    g->user[1][sizeof(g->user[1]) - 1] = '\0';
+    g->turn = 1;
+    g->state = GAME_RUNNING;
+    timer_init(&g->turn_timer, NULL, NULL);
+    g->timers = NULL;
+    g->proto[0] = PROTO_TEXT;
+    g->proto[1] = PROTO_TEXT;
+    g->bot_player = 0;
+    g->bot_level = BOT_NORMAL;
+    g->bot_seed = 0;
+    g->table_slot = -1;
+    g->send = send;
+    g->watch = NULL;
+    g->host = host;
+}
+
+int game_set_shape(struct game *g, struct board_shape shape) {
+    return board_init(&g->board, shape);
+}
+
+void game_set_timers(struct game *g, struct timer_wheel *timers, timer_fn expired, void *arg) {
+    g->timers = timers;
+    timer_init(&g->turn_timer, expired, arg);
+}
+
+void game_set_watch(struct game *g, game_watch_fn watch) {
+    g->watch = watch;
+}
+
+void game_set_bot(struct game *g, int player, int level, unsigned seed) {
+    g->bot_player = player;
+    g->bot_level = level;
+    g->bot_seed = seed;
+}
+
+static int play_move(struct game *g, int player, int move, long long read_us);
+
+// The bot answers straight away from its table; it never waits
+static int bot_turn(struct game *g) {
+    int cell = bot_move(&g->board, g->bot_player, g->bot_level, &g->bot_seed);
+    return play_move(g, g->bot_player, cell + 1, 0);
+}
+
+void game_start(struct game *g) {
+    printf("[GAME] Starting game: %s (P1) vs %s (P2)\n", g->user[0], g->user[1]);
+    eventring_publish(EVENT_GAME_STARTED, g->user[0], g->user[1], 0);
+
+    // Inform players of their roles and the board
+    struct board_shape shape = g->board.shape;
+    char start[4] = { 1, (char)shape.rows, (char)shape.cols, (char)shape.k };
+    send_player(g, 1, MSG_GAME_START, start, sizeof(start));
+    start[0] = 2;
+    send_player(g, 2, MSG_GAME_START, start, sizeof(start));
+
+    send_board(g, 1);
+    send_board(g, 2);
+    gamelog_begin(&g->record, g->user[0], g->user[1], shape, g->bot_player);
+    gametable_update(g->table_slot, &g->board, g->turn);
+    if (g->turn == g->bot_player) {
+        bot_turn(g);
+    } else {
+        start_turn(g);
+    }
+    flush_output(g);
+}
+
+static void reject_move(struct game *g, int player, const char *reason) {
+    send_player(g, player, MSG_INVALID_MOVE, reason, strlen(reason));
+    send_turn(g);
+}
+
+// Text input: a bare cell number, or a coordinate such as H8
+static int input_line(struct game *g, int player, const char *line, long long read_us) {
+    if (g->state != GAME_RUNNING) return g->state;
+
+    if (strcmp(line, "SYNC") == 0) {
+        send_board(g, player);
+        return GAME_RUNNING;
+    }
+
+    int cell = board_parse_move(&g->board, line);
+
+    if (player == g->turn && cell == -1) {
+        printf("[GAME] Player %d (%s) move: '%s'\n", player, player_name(g, player), line);
+        reject_move(g, player, board_is_classic(g->board.shape) ? "Must be a number 1-9" :
+                               "Must be a cell number or a coordinate like H8");
+        return GAME_RUNNING;
+    }
+    return play_move(g, player, cell < 0 ? 0 : cell + 1, read_us);
+}
+
+// Binary input: a CMD_MOVE frame with a cell number or a row and column
+static int input_frame(struct game *g, int player, int type, const char *payload, size_t len,
+                       long long read_us) {
+    int move = 0;
+
+    if (type == CMD_SYNC) {
+        if (g->state == GAME_RUNNING) send_board(g, player);
+        return g->state;
+    } else if (type == CMD_MOVE && len == 1) {
+        move = (unsigned char)payload[0];
+    } else if (type == CMD_MOVE && len == 2) {
+        int row = (unsigned char)payload[0], col = (unsigned char)payload[1];
+        if (row >= 1 && row <= g->board.shape.rows && col >= 1 && col <= g->board.shape.cols) {
+            move = (row - 1) * g->board.shape.cols + col;
+        }
+    }
+    return play_move(g, player, move, read_us);
+}
+
+// 'move' is a cell number from 1; anything else is rejected as off the board
+static int play_move(struct game *g, int player, int move, long long read_us) {
+    if (g->state != GAME_RUNNING) return g->state;
+
+    if (player != g->turn) {
+        send_player(g, player, MSG_WAITING, NULL, 0);
+        return GAME_RUNNING;
+    }
+
+    printf("[GAME] Player %d (%s) move: %d\n", player, player_name(g, player), move);
+
+    if (move < 1 || move > board_cells(&g->board)) {
+        reject_move(g, player, board_is_classic(g->board.shape) ? "Number must be between 1-9" :
+                               "Position is off the board");
+        return GAME_RUNNING;
+    }
+
+    int pos = move - 1;
+    if (!board_is_free(&g->board, pos)) {
+        reject_move(g, player, "Position already taken");
+        return GAME_RUNNING;
+    }
+
+    board_place(&g->board, player, pos);
+    gamelog_move(&g->record, pos);
+
+    // Announce the move to both players as a delta on their board copy.
+    // Text clients keep no copy, so they get the whole board redrawn.
+    char move_msg[GAME_MOVE_MAX];
+    size_t len = game_encode_move(move_msg, &g->board, player, move, player_name(g, player));
+    send_to_both(g, MSG_MOVE_MADE, move_msg, len);
+    for (int p = 1; p <= 2; p++) {
+        if (g->proto[p - 1] == PROTO_TEXT) send_board(g, p);
+    }
+    if (g->watch) g->watch(g, WATCH_MOVE, player, move);
+    if (player != g->bot_player) move_read_us = read_us;
+
+    if (board_wins_at(&g->board, player, pos)) {
+        return end_game(g, "WIN", player);
+    }
+    if (board_full(&g->board)) {
+        return end_game(g, "DRAW", 0);
+    }
+
+    // Switch turns
+    g->turn = (g->turn == 1) ? 2 : 1;
+    gametable_update(g->table_slot, &g->board, g->turn);
+    if (g->turn == g->bot_player) {
+        return bot_turn(g);
+    }
+    start_turn(g);
+    return GAME_RUNNING;
+}
+
+int game_handle_input(struct game *g, int player, const char *line, long long read_us) {
+    int state = input_line(g, player, line, read_us);
+    flush_output(g);
+    return state;
+}
+
+int game_handle_frame(struct game *g, int player, int type, const char *payload, size_t len,
+                      long long read_us) {
+    int state = input_frame(g, player, type, payload, len, read_us);
+    flush_output(g);
+    return state;
+}
+
+int game_handle_move(struct game *g, int player, int move, long long read_us) {
+    int state = play_move(g, player, move, read_us);
+    flush_output(g);
+    return state;
+}
+
+// Lines or frames per the player's wire format; input that can never
+// complete (a bad frame header, or a full buffer without an end) is dropped
+int game_handle_data(struct game *g, int player, char *buf, size_t *len, size_t cap,
+                     long long read_us) {
+    size_t used = 0;
+    int state = g->state;
+
+    while (state == GAME_RUNNING && used < *len) {
+        if (g->proto[player - 1] == PROTO_BINARY) {
+            int type;
+            const char *payload;
+            size_t plen;
+            int n = proto_parse_frame(buf + used, *len - used, &type, &payload, &plen);
+            if (n == 0) break;
+            if (n == -1) {
+                used = *len;
+                break;
+            }
+            used += n;
+            state = game_handle_frame(g, player, type, payload, plen, read_us);
+        } else {
+            char *nl = memchr(buf + used, '\n', *len - used);
+            if (!nl) break;
+            char *line = buf + used;
+            *nl = '\0';
+            line[strcspn(line, "\r")] = '\0';
+            used = nl + 1 - buf;
+            if (line[0] != '\0') state = game_handle_input(g, player, line, read_us);
+        }
+    }
+
+    *len -= used;
+    memmove(buf, buf + used, *len);
+    if (*len == cap) *len = 0;
+    return state;
+}
+
+size_t game_encode_move(char *out, const struct board *b, int player, int cell, const char *name) {
+    size_t len = strlen(name);
+    int seq = board_count(b);
+    out[0] = (char)(seq >> 8);
+    out[1] = (char)seq;
+    out[2] = (char)(cell >> 8);
+    out[3] = (char)cell;
+    out[4] = (char)player;
+    out[5] = (char)b->shape.rows;
+    out[6] = (char)b->shape.cols;
+    memcpy(out + 7, name, len);
+    return len + 7;
+}
+
+int game_handle_timeout(struct game *g) {
+    if (g->state != GAME_RUNNING) return g->state;
+
+    int loser = g->turn;
+    int winner = (loser == 1) ? 2 : 1;
+    const char *name = player_name(g, loser);
+
+    metrics_count(METRIC_TURN_TIMEOUTS);
+    send_player(g, winner, MSG_OPPONENT_TIMEOUT, name, strlen(name));
+    send_player(g, loser, MSG_TIMEOUT, NULL, 0);
+
+    forfeit(g, loser, GAME_END_TIMEOUT, 0);
+    flush_output(g);
+    return GAME_FINISHED;
+}
+
+int game_handle_disconnect(struct game *g, int player) {
+    if (g->state != GAME_RUNNING) return g->state;
+
+    int winner = (player == 1) ? 2 : 1;
+    const char *name = player_name(g, player);
+
+    send_player(g, winner, MSG_OPPONENT_DISCONNECTED, name, strlen(name));
+
+    forfeit(g, player, GAME_END_DISCONNECT, winner);
+    flush_output(g);
+    return GAME_FINISHED;
+}
@@ -1,373 +1,184 @@
+#define _GNU_SOURCE
 #include "../include/ipc.h"
 #include "../include/database.h"
+#include "../include/game.h"
+#include "../include/game_worker.h"
+#include "../include/protocol.h"
+#include "../include/board.h"
+#include "../include/gametable.h"
+#include "../include/eventring.h"
+#include "../include/metrics.h"
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
-#include <sys/msg.h>
-#include <fcntl.h>
-#include <sys/stat.h>
-#include <signal.h>
 #include <errno.h>
+#include <poll.h>
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
-#define BUF_SIZE 1024
-#define TURN_TIMEOUT_SEC 30
+#define INPUT_SIZE 256
 
-char board[9] = {' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '};
-int p1_fd, p2_fd;
-char p1_user[64], p2_user[64];
-int turn = 1;
-int msg_queue_id;
-int semid;  // Semaphore ID for board access control
+// Fork mode: this process hosts one match on the shared state machine
+// (src/game.c), polling both players and the turn clock
+struct game game;
+int player_fd[2];
+char inbuf[2][INPUT_SIZE];  // Partial line or frame from each player
+size_t inlen[2];
+struct timer_wheel timers;  // Just the turn deadline
+int events_fd = -1;  // Server's game event socket, for spectators
+int match_id = -1;   // Our match in the server's table
 
-void print_board(char *buf);
+// Everything one step produced for the player, in one blocking write
+void send_to_player(struct game *g, int player, const char *msg, size_t len) {
+    int fd = player_fd[player - 1];
+    (void)g;
 
-void send_to_both(const char *msg) {
-    send(p1_fd, msg, strlen(msg), 0);
-    send(p2_fd, msg, strlen(msg), 0);
-}
-
-void send_board() {
-    char buf[BUF_SIZE] = "BOARD:\n";
-    char board_str[256];
-    
-    // Lock semaphore before reading board state
-    if (semid != -1) {
-        sem_lock(semid);
-    }
-    
-    print_board(board_str);
-    
-    if (semid != -1) {
-        sem_unlock(semid);
+    while (len > 0) {
+        ssize_t sent = send(fd, msg, len, MSG_NOSIGNAL);
+        if (sent == -1 && errno == EINTR) continue;
+        if (sent <= 0) {
+            // Stalled past SO_SNDTIMEO (or gone): drop the player, whose
+            // next read then reports a disconnect and forfeits the game
+            perror("send failed");
+            shutdown(fd, SHUT_RDWR);
+            return;
+        }
+        msg += sent;
+        len -= sent;
     }
-    
-    strncat(buf, board_str, sizeof(buf) - strlen(buf) - 1);
-    send_to_both(buf);
 }
 
-void send_turn(int player_fd) {
-    char msg[64] = "YOUR_TURN\n";
-    if (send(player_fd, msg, strlen(msg), 0) == -1) {
-        perror("send turn failed");
-    }
-}
+// Report a move (player, cell from 1) or the result (winner, GAME_END_*)
+// to the server, which passes it on to the match's spectators. Never waits:
+// the board goes along, so the next event makes up for a dropped one.
+void tell_spectators(struct game *g, int event, int a, int b) {
+    if (events_fd == -1) return;
 
-void print_board(char *buf) {
-    sprintf(buf, " %c | %c | %c \n---+---+---\n %c | %c | %c \n---+---+---\n %c | %c | %c \n\n",
-            board[0], board[1], board[2], 
-            board[3], board[4], board[5], 
-            board[6], board[7], board[8]);
+    struct watch_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = WORKER_WATCH;
+    ev.game_id = match_id;
+    ev.event = event;
+    ev.player = a;
+    if (event == WATCH_MOVE) ev.cell = b;
+    else ev.end = b;
+    board_encode(&g->board, ev.board);
+    send(events_fd, &ev, sizeof(ev), MSG_DONTWAIT | MSG_NOSIGNAL);
 }
 
-int check_win(char c) {
-    int w[8][3] = {
-        {0,1,2}, {3,4,5}, {6,7,8},  // rows
-        {0,3,6}, {1,4,7}, {2,5,8},  // columns
-        {0,4,8}, {2,4,6}             // diagonals
-    };
-    for (int i = 0; i < 8; i++) {
-        if (board[w[i][0]] == c && board[w[i][1]] == c && board[w[i][2]] == c) {
-            return 1;
-        }
-    }
-    return 0;
+void turn_expired(void *arg) {
+    (void)arg;
+    game_handle_timeout(&game);
 }
 
-int board_full() {
-    for (int i = 0; i < 9; i++) {
-        if (board[i] == ' ') return 0;
+// poll said the player's socket is readable, so this does not block
+void read_player(int idx) {
+    ssize_t bytes = recv(player_fd[idx], inbuf[idx] + inlen[idx], INPUT_SIZE - inlen[idx], 0);
+    long long read_us = metrics_now_us();
+    if (bytes == -1 && errno == EINTR) return;
+    if (bytes <= 0) {
+        game_handle_disconnect(&game, idx + 1);
+        return;
     }
-    return 1;
+    inlen[idx] += bytes;
+    game_handle_data(&game, idx + 1, inbuf[idx], &inlen[idx], INPUT_SIZE, read_us);
 }
 
-void send_game_notification(const char *msg) {
-    struct game_msg notification;
-    notification.mtype = 1;
-    strncpy(notification.username, msg, sizeof(notification.username) - 1);
-    notification.username[sizeof(notification.username) - 1] = '\0';
-    msgsnd(msg_queue_id, &notification, sizeof(notification) - sizeof(long), IPC_NOWAIT);
-    
-    // Also write to FIFO if available
-    int fifo_fd = open(FIFO_PATH, O_WRONLY | O_NONBLOCK);
-    if (fifo_fd != -1) {
-        write(fifo_fd, msg, strlen(msg));
-        close(fifo_fd);
-    }
-}
+int main(int argc, char *argv[]) {
+    // Whatever this process turns out to be, it counts into the server's metrics
+    if (metrics_open() == 0) metrics_attach();
 
-void end_game(const char *result, int winner) {
-    char msg[128];
-    
-    if (strcmp(result, "WIN") == 0) {
-        snprintf(msg, sizeof(msg), "GAME_OVER: PLAYER_%d_WINS (%s wins!)\n", 
-                 winner, (winner == 1) ? p1_user : p2_user);
-        send_to_both(msg);
-        
-        update_stats((winner == 1) ? p1_user : p2_user, "WIN");
-        update_stats((winner == 1) ? p2_user : p1_user, "LOSS");
-        
-        snprintf(msg, sizeof(msg), "Game ended: %s defeats %s", 
-                 (winner == 1) ? p1_user : p2_user,
-                 (winner == 1) ? p2_user : p1_user);
-        send_game_notification(msg);
-    } else {
-        send_to_both("GAME_OVER: DRAW\n");
-        update_stats(p1_user, "DRAW");
-        update_stats(p2_user, "DRAW");
-        
-        snprintf(msg, sizeof(msg), "Game ended: %s vs %s - Draw", p1_user, p2_user);
-        send_game_notification(msg);
+    // Pooled mode: one long-lived process hosting many matches
+    if (argc == 4 && strcmp(argv[1], "--worker") == 0) {
+        return worker_main(atoi(argv[2]), atoi(argv[3]));
     }
-    
-    printf("[GAME] Game ended between %s and %s\n", p1_user, p2_user);
-    
-    // Cleanup semaphore before exit
-    if (semid != -1) {
-        if (semctl(semid, 0, IPC_RMID) == -1) {
-            perror("semctl IPC_RMID failed");
-        } else {
-            printf("[GAME] Semaphore (ID: %d) removed\n", semid);
-        }
+    // The server's stats writer: the one process that changes stats.bin
+    if (argc == 3 && strcmp(argv[1], "--stats-writer") == 0) {
+        stats_writer_run(strcmp(argv[2], "fsync") == 0);
     }
     
-    // Exit game process - server will detect via SIGCHLD and return players to lobby
-    exit(0);
-}
-
-int main(int argc, char *argv[]) {
-    if (argc != 6) {
-        fprintf(stderr, "Usage: %s p1_fd p2_fd p1_user p2_user sem_key\n", argv[0]);
+    if (argc != 6 && argc != 8 && argc != 9 && argc != 11) {
+        fprintf(stderr, "Usage: %s p1_fd p2_fd p1_user p2_user table_slot "
+                "[p1_proto p2_proto [size [events_fd match_id]]]\n",
+                argv[0]);
+        fprintf(stderr, "       %s --worker ctl_fd index\n", argv[0]);
+        fprintf(stderr, "       %s --stats-writer fsync|nosync\n", argv[0]);
         exit(1);
     }
     
-    p1_fd = atoi(argv[1]);
-    p2_fd = atoi(argv[2]);
+    player_fd[0] = atoi(argv[1]);
+    player_fd[1] = atoi(argv[2]);
     
-    strncpy(p1_user, argv[3], sizeof(p1_user) - 1);
-    p1_user[sizeof(p1_user) - 1] = '\0';
-    strncpy(p2_user, argv[4], sizeof(p2_user) - 1);
-    p2_user[sizeof(p2_user) - 1] = '\0';
+    struct board_shape shape = BOARD_CLASSIC;
+    if (argc >= 9 && board_parse_shape(argv[8], &shape) == -1) {
+        fprintf(stderr, "Bad board size '%s'\n", argv[8]);
+        exit(1);
+    }
     
-    // Get unique semaphore key for this game
-    int sem_key = atoi(argv[5]);
+    game_init(&game, argv[3], argv[4], send_to_player, NULL);
+    game_set_shape(&game, shape);
+    if (argc >= 8) {
+        game.proto[0] = atoi(argv[6]) == PROTO_BINARY ? PROTO_BINARY : PROTO_TEXT;
+        game.proto[1] = atoi(argv[7]) == PROTO_BINARY ? PROTO_BINARY : PROTO_TEXT;
+    }
+    if (argc == 11) {
+        events_fd = atoi(argv[9]);
+        match_id = atoi(argv[10]);
+        game_set_watch(&game, tell_spectators);
+    }
+    if (timer_wheel_init(&timers) == -1) exit(1);
+    game_set_timers(&game, &timers, turn_expired, NULL);
     
     // Disable Nagle's algorithm for immediate message delivery
     int flag = 1;
-    setsockopt(p1_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
-    setsockopt(p2_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
-    
-    // Create unique semaphore for this game's board access control
-    semid = semget(sem_key, 1, IPC_CREAT | IPC_EXCL | 0666);
-    if (semid == -1) {
-        perror("semget failed");
-        semid = -1;  // Disable semaphore usage
-    } else {
-        // Initialize semaphore value to 1 (binary semaphore)
-        union semun {
-            int val;
-        } sem_union;
-        sem_union.val = 1;
-        
-        if (semctl(semid, 0, SETVAL, sem_union) == -1) {
-            perror("semctl SETVAL failed");
-            semid = -1;
-        } else {
-            printf("[GAME] Semaphore created (ID: %d, Key: %d) for board synchronization\n", 
-                   semid, sem_key);
-        }
+    setsockopt(player_fd[0], IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    setsockopt(player_fd[1], IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    
+    // A player that stops reading must not stall the game forever
+    struct timeval send_timeout = { GAME_SEND_TIMEOUT_SEC, 0 };
+    setsockopt(player_fd[0], SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+    setsockopt(player_fd[1], SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+    
+    // Publish the position for the server and monitoring tools to read,
+    // at the slot the server listed this game in (-1 if unlisted)
+    game.table_slot = atoi(argv[5]);
+    if (game.table_slot != -1 && gametable_open() == -1) {
+        perror("shm_open game table failed - game goes unlisted");
+        game.table_slot = -1;
     }
+    gametable_host(game.table_slot);
     
-    // Get message queue for notifications
-    msg_queue_id = msgget(MSG_KEY, 0666);
-    if (msg_queue_id == -1) {
-        perror("msgget failed - notifications disabled");
+    // Game events go to the server's ring
+    if (eventring_open() == -1) {
+        perror("shm_open event ring failed - events disabled");
     }
     
-    printf("[GAME] Starting game: %s (P1) vs %s (P2)\n", p1_user, p2_user);
-    
-    // Send game start notifications
-    char start_msg[256];
-    snprintf(start_msg, sizeof(start_msg), 
-             "Game started: %s vs %s", p1_user, p2_user);
-    send_game_notification(start_msg);
-    
-    // Inform players of their roles
-    send(p1_fd, "GAME_START: YOU_ARE_PLAYER_1 (X)\n", 33, 0);
-    send(p2_fd, "GAME_START: YOU_ARE_PLAYER_2 (O)\n", 33, 0);
-    
-    sleep(1);  // Brief pause for readability
-    
-    send_board();
-    send_turn(p1_fd);
-    
-    while (1) {
-        int current_fd = (turn == 1) ? p1_fd : p2_fd;
-        int other_fd = (turn == 1) ? p2_fd : p1_fd;
-        
-        fd_set rfds;
-        FD_ZERO(&rfds);
-        FD_SET(current_fd, &rfds);
-        
-        struct timeval timeout;
-        timeout.tv_sec = TURN_TIMEOUT_SEC;
-        timeout.tv_usec = 0;
-        
-        int ret = select(current_fd + 1, &rfds, NULL, NULL, &timeout);
-        
-        if (ret == -1) {
-            perror("select failed");
+    game_start(&game);
+    
+    // poll, not select: player sockets can be numbered past FD_SETSIZE
+    while (game.state == GAME_RUNNING) {
+        struct pollfd pfds[3] = {
+            { player_fd[0], POLLIN, 0 },
+            { player_fd[1], POLLIN, 0 },
+            { timers.fd, POLLIN, 0 },
+        };
+        if (poll(pfds, 3, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("poll failed");
             break;
-        } else if (ret == 0) {
-            // Timeout occurred
-            char win_msg[128];
-            char lose_msg[128];
-            
-            snprintf(win_msg, sizeof(win_msg), 
-                     "OPPONENT_TIMEOUT: %s failed to move in time. YOU_WIN!\n",
-                     (turn == 1) ? p1_user : p2_user);
-            snprintf(lose_msg, sizeof(lose_msg), 
-                     "TIMEOUT: You failed to move in time. YOU_LOSE!\n");
-            
-            send(other_fd, win_msg, strlen(win_msg), 0);
-            send(current_fd, lose_msg, strlen(lose_msg), 0);
-            
-            update_stats((turn == 1) ? p2_user : p1_user, "WIN");
-            update_stats((turn == 1) ? p1_user : p2_user, "LOSS");
-            
-            snprintf(win_msg, sizeof(win_msg), 
-                     "Game timeout: %s wins by default", 
-                     (turn == 1) ? p2_user : p1_user);
-            send_game_notification(win_msg);
-            
-            // Cleanup semaphore
-            if (semid != -1) {
-                semctl(semid, 0, IPC_RMID);
-            }
-            
-            exit(0);
         }
         
-        // Receive move from current player
-        char buf[64];
-        int bytes = recv(current_fd, buf, sizeof(buf) - 1, 0);
-        
-        if (bytes <= 0) {
-            // Player disconnected
-            char msg[128];
-            snprintf(msg, sizeof(msg), 
-                     "OPPONENT_DISCONNECTED: %s left the game. YOU_WIN!\n",
-                     (turn == 1) ? p1_user : p2_user);
-            send(other_fd, msg, strlen(msg), 0);
-            
-            update_stats((turn == 1) ? p2_user : p1_user, "WIN");
-            update_stats((turn == 1) ? p1_user : p2_user, "LOSS");
-            
-            snprintf(msg, sizeof(msg), 
-                     "Player disconnect: %s wins by default",
-                     (turn == 1) ? p2_user : p1_user);
-            send_game_notification(msg);
-            
-            // Cleanup semaphore
-            if (semid != -1) {
-                semctl(semid, 0, IPC_RMID);
-            }
-            
-            exit(0);
+        if (pfds[2].revents & POLLIN) {
+            timer_wheel_run(&timers);
         }
-        
-        buf[bytes] = '\0';
-        buf[strcspn(buf, "\r\n")] = '\0';  // Remove newline
-        
-        printf("[GAME] Player %d (%s) move: '%s'\n", 
-               turn, (turn == 1) ? p1_user : p2_user, buf);
-        
-        // Parse move
-        char *endptr;
-        long move = strtol(buf, &endptr, 10);
-        
-        if (endptr == buf || (*endptr != '\0')) {
-            send(current_fd, "INVALID_MOVE: Must be a number 1-9\n", 36, 0);
-            send_turn(current_fd);
-            continue;
+        for (int i = 0; i < 2 && game.state == GAME_RUNNING; i++) {
+            if (pfds[i].revents) read_player(i);
         }
-        
-        int pos = (int)move - 1;
-        
-        if (pos < 0 || pos > 8) {
-            send(current_fd, "INVALID_MOVE: Number must be between 1-9\n", 42, 0);
-            send_turn(current_fd);
-            continue;
-        }
-        
-        if (board[pos] != ' ') {
-            send(current_fd, "INVALID_MOVE: Position already taken\n", 38, 0);
-            send_turn(current_fd);
-            continue;
-        }
-        
-        // Valid move - update board with semaphore protection
-        // Lock semaphore to ensure exclusive access to board
-        if (semid != -1) {
-            sem_lock(semid);
-        }
-        
-        board[pos] = (turn == 1) ? 'X' : 'O';
-        
-        // Unlock semaphore
-        if (semid != -1) {
-            sem_unlock(semid);
-        }
-        
-        // Announce the move to both players
-        char move_msg[128];
-        snprintf(move_msg, sizeof(move_msg), 
-                 "\nMOVE_MADE: %s played position %d\n",
-                 (turn == 1) ? p1_user : p2_user, (int)move);
-        send_to_both(move_msg);
-        
-        // Small delay to ensure move message is received
-        usleep(50000);  // 50ms
-        
-        // Send updated board to BOTH players immediately
-        send_board();
-        
-        // Small delay to ensure board is received
-        usleep(50000);  // 50ms
-        
-        // Check for win with semaphore protection
-        if (semid != -1) {
-            sem_lock(semid);
-        }
-        
-        int has_won = check_win(board[pos]);
-        int is_full = board_full();
-        
-        if (semid != -1) {
-            sem_unlock(semid);
-        }
-        
-        if (has_won) {
-            end_game("WIN", turn);
-            // end_game exits, so this won't be reached
-        }
-        
-        // Check for draw
-        if (is_full) {
-            end_game("DRAW", 0);
-            // end_game exits, so this won't be reached
-        }
-        
-        // Switch turns
-        turn = (turn == 1) ? 2 : 1;
-        
-        // Send turn notification to next player
-        send_turn((turn == 1) ? p1_fd : p2_fd);
     }
     
+    // Exit game process - server will detect via SIGCHLD and return players to lobby
     return 0;
 }
\ No newline at end of file
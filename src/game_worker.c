@@ -0,0 +1,307 @@
+#include "../include/game_worker.h"
+#include "../include/game.h"
+#include "../include/ipc.h"
+#include "../include/protocol.h"
+#include "../include/outq.h"
+#include "../include/timer.h"
+#include "../include/gametable.h"
+#include "../include/eventring.h"
+#include "../include/metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define LINE_SIZE 256
+#define MAX_EVENTS 256
+#define INITIAL_FD_CAP 64
+
+// A match hosted by this worker
+struct hosted_game {
+    struct game g;  // Must stay first: the send callback casts back from it
+    int id;         // Server-assigned match id
+    int fd[2];
+    char inbuf[2][LINE_SIZE];
+    size_t inlen[2];
+    struct outq out[2];  // Output each player's socket has not accepted yet
+    struct hosted_game *prev, *next;
+};
+
+static int ctl_fd = -1;
+static int epoll_fd = -1;
+static int worker_index;
+
+// Player socket -> hosted game, indexed by fd
+static struct hosted_game **by_fd = NULL;
+static int by_fd_cap = 0;
+
+static struct hosted_game *hosted_list = NULL;
+static int hosted_count = 0;
+
+// Turn deadlines of every hosted match
+static struct timer_wheel timers;
+
+static void drop_player(struct hosted_game *h, int idx) {
+    printf("[WORKER %d] Dropping player '%s' (%zu bytes queued)\n",
+           worker_index, h->g.user[idx], h->out[idx].len);
+    outq_clear(&h->out[idx]);
+    shutdown(h->fd[idx], SHUT_RDWR);  // Seen as EOF: the game forfeits
+}
+
+static void hosted_send(struct game *g, int player, const char *msg, size_t len) {
+    struct hosted_game *h = (struct hosted_game *)g;
+    if (outq_write(&h->out[player - 1], h->fd[player - 1], msg, len) == -1) {
+        drop_player(h, player - 1);
+    }
+}
+
+// The server fans moves and results out to the match's spectators
+static void hosted_watch(struct game *g, int event, int a, int b) {
+    struct hosted_game *h = (struct hosted_game *)g;
+    struct watch_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = WORKER_WATCH;
+    ev.game_id = h->id;
+    ev.event = event;
+    ev.player = a;
+    if (event == WATCH_MOVE) ev.cell = b;
+    else ev.end = b;
+    board_encode(&g->board, ev.board);
+    if (send_with_fds(ctl_fd, &ev, sizeof(ev), NULL, 0) == -1) {
+        fprintf(stderr, "[WORKER %d] Could not report match %d to spectators\n",
+                worker_index, h->id);
+    }
+}
+
+static int reserve_fd(int fd) {
+    if (fd < by_fd_cap) return 0;
+
+    int new_cap = by_fd_cap ? by_fd_cap : INITIAL_FD_CAP;
+    while (new_cap <= fd) new_cap *= 2;
+
+    struct hosted_game **nb = realloc(by_fd, new_cap * sizeof(*nb));
+    if (!nb) {
+        perror("realloc worker fd table failed");
+        return -1;
+    }
+    memset(nb + by_fd_cap, 0, (new_cap - by_fd_cap) * sizeof(*nb));
+    by_fd = nb;
+    by_fd_cap = new_cap;
+    return 0;
+}
+
+static void finish_game(struct hosted_game *h) {
+    static char buf[WORKER_MSG_MAX];
+    struct worker_msg msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = WORKER_GAME_DONE;
+    msg.game_id = h->id;
+
+    // Release the sockets before telling the server, which re-arms them and
+    // sends whatever output is still queued here
+    size_t len = sizeof(msg);
+    for (int p = 0; p < 2; p++) {
+        by_fd[h->fd[p]] = NULL;
+        close(h->fd[p]);
+        msg.pending[p] = outq_copy(&h->out[p], buf + len, OUTQ_LIMIT);
+        len += msg.pending[p];
+        outq_clear(&h->out[p]);
+    }
+    memcpy(buf, &msg, sizeof(msg));
+    timer_cancel(&timers, &h->g.turn_timer);
+
+    if (send_with_fds(ctl_fd, buf, len, NULL, 0) == -1) {
+        fprintf(stderr, "[WORKER %d] Could not report match %d done\n", worker_index, h->id);
+    }
+
+    if (h->prev) h->prev->next = h->next;
+    else hosted_list = h->next;
+    if (h->next) h->next->prev = h->prev;
+    hosted_count--;
+    free(h);
+}
+
+static void turn_expired(void *arg) {
+    struct hosted_game *h = arg;
+    if (game_handle_timeout(&h->g) == GAME_FINISHED) {
+        finish_game(h);
+    }
+}
+
+static void start_game(struct worker_msg *msg, const char *pending, int *fds) {
+    struct hosted_game *h = calloc(1, sizeof(*h));
+    if (!h || reserve_fd(fds[0] > fds[1] ? fds[0] : fds[1]) == -1) {
+        fprintf(stderr, "[WORKER %d] Out of memory for match %d\n", worker_index, msg->game_id);
+        free(h);
+        close(fds[0]);
+        close(fds[1]);
+        struct worker_msg done = { WORKER_GAME_DONE, msg->game_id, {"", ""}, {0, 0}, {0, 0}, {0, 0, 0}, -1 };
+        send_with_fds(ctl_fd, &done, sizeof(done), NULL, 0);
+        return;
+    }
+
+    msg->users[0][sizeof(msg->users[0]) - 1] = '\0';
+    msg->users[1][sizeof(msg->users[1]) - 1] = '\0';
+
+    h->id = msg->game_id;
+    for (int p = 0; p < 2; p++) {
+        int flag = 1;
+        h->fd[p] = fds[p];
+        setsockopt(fds[p], IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+        // Lobby output the server had not delivered yet goes first; the
+        // EPOLLOUT event from registering the socket flushes it
+        outq_append(&h->out[p], pending, msg->pending[p]);
+        pending += msg->pending[p];
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fds[p];
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[p], &ev) == -1) {
+            perror("epoll_ctl add player failed");
+        }
+        by_fd[fds[p]] = h;
+    }
+
+    h->next = hosted_list;
+    if (hosted_list) hosted_list->prev = h;
+    hosted_list = h;
+    hosted_count++;
+
+    printf("[WORKER %d] Hosting match %d (%d live)\n", worker_index, h->id, hosted_count);
+    game_init(&h->g, msg->users[0], msg->users[1], hosted_send, NULL);
+    game_set_timers(&h->g, &timers, turn_expired, h);
+    game_set_watch(&h->g, hosted_watch);
+    h->g.proto[0] = msg->proto[0] == PROTO_BINARY ? PROTO_BINARY : PROTO_TEXT;
+    h->g.proto[1] = msg->proto[1] == PROTO_BINARY ? PROTO_BINARY : PROTO_TEXT;
+    if (game_set_shape(&h->g, msg->shape) == -1) {
+        game_set_shape(&h->g, BOARD_CLASSIC);
+    }
+    h->g.table_slot = msg->table_slot;
+    gametable_host(msg->table_slot);
+    game_start(&h->g);
+}
+
+static void handle_control() {
+    static char buf[WORKER_MSG_MAX];
+    struct worker_msg msg;
+    int fds[2], nfds;
+
+    while (1) {
+        ssize_t bytes = recv_with_fds(ctl_fd, buf, sizeof(buf), fds, 2, &nfds);
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (bytes <= 0) {
+            printf("[WORKER %d] Server closed control channel, exiting\n", worker_index);
+            exit(0);
+        }
+
+        if ((size_t)bytes >= sizeof(msg)) {
+            memcpy(&msg, buf, sizeof(msg));
+        }
+        if ((size_t)bytes >= sizeof(msg) && msg.type == WORKER_START_GAME && nfds == 2 &&
+            msg.pending[0] >= 0 && msg.pending[0] <= OUTQ_LIMIT &&
+            msg.pending[1] >= 0 && msg.pending[1] <= OUTQ_LIMIT &&
+            sizeof(msg) + msg.pending[0] + msg.pending[1] == (size_t)bytes) {
+            start_game(&msg, buf + sizeof(msg), fds);
+        } else {
+            for (int i = 0; i < nfds; i++) close(fds[i]);
+        }
+    }
+}
+
+static void handle_player(struct hosted_game *h, int fd) {
+    int idx = (fd == h->fd[0]) ? 0 : 1;
+
+    while (1) {
+        ssize_t bytes = recv(fd, h->inbuf[idx] + h->inlen[idx], LINE_SIZE - h->inlen[idx], 0);
+        long long read_us = metrics_now_us();
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (bytes <= 0) {
+            game_handle_disconnect(&h->g, idx + 1);
+            finish_game(h);
+            return;
+        }
+        h->inlen[idx] += bytes;
+
+        if (game_handle_data(&h->g, idx + 1, h->inbuf[idx], &h->inlen[idx],
+                             LINE_SIZE, read_us) == GAME_FINISHED) {
+            finish_game(h);
+            return;
+        }
+    }
+}
+
+int worker_main(int fd, int index) {
+    struct epoll_event ev, events[MAX_EVENTS];
+
+    ctl_fd = fd;
+    worker_index = index;
+    signal(SIGPIPE, SIG_IGN);
+    fcntl(ctl_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(ctl_fd, F_SETFL, fcntl(ctl_fd, F_GETFL, 0) | O_NONBLOCK);
+
+    if (eventring_open() == -1) {
+        perror("shm_open event ring failed - events disabled");
+    }
+    if (gametable_open() == -1) {
+        perror("shm_open game table failed - games go unlisted");
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("epoll_create1 failed");
+        return 1;
+    }
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = ctl_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ctl_fd, &ev) == -1) {
+        perror("epoll_ctl add control failed");
+        return 1;
+    }
+    if (timer_wheel_init(&timers) == -1) return 1;
+    ev.events = EPOLLIN;
+    ev.data.fd = timers.fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timers.fd, &ev) == -1) {
+        perror("epoll_ctl add timerfd failed");
+        return 1;
+    }
+
+    printf("[WORKER %d] Ready (PID %d)\n", worker_index, getpid());
+
+    while (1) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            return 1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int efd = events[i].data.fd;
+            if (efd == ctl_fd) {
+                handle_control();
+            } else if (efd == timers.fd) {
+                timer_wheel_run(&timers);
+            } else if (efd < by_fd_cap && by_fd[efd]) {
+                struct hosted_game *h = by_fd[efd];
+                int idx = (efd == h->fd[0]) ? 0 : 1;
+                if ((events[i].events & EPOLLOUT) && h->out[idx].len > 0 &&
+                    outq_flush(&h->out[idx], efd) == -1) {
+                    drop_player(h, idx);
+                }
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    handle_player(h, efd);
+                }
+            }
+        }
+    }
+}
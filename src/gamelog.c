@@ -0,0 +1,211 @@
+#define _GNU_SOURCE
+#include "../include/gamelog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define GAMELOG_INDEX GAMELOG_DIR "/index"
+
+// Index entry of game N, at (N - 1) * sizeof(struct gamelog_slot).
+// Segments are numbered from 1, so an entry never written reads as 0.
+struct gamelog_slot {
+    uint32_t segment;
+    uint32_t offset;
+};
+
+static int index_fd = -1;
+static int segment_fd = -1;          // Writer: the segment being appended to
+static uint32_t segment_no = 0;
+static off_t segment_size = 0;
+
+int gamelog_move_bits(struct board_shape shape) {
+    int cells = shape.rows * shape.cols, bits = 1;
+    while ((1 << bits) < cells) bits++;
+    return bits;
+}
+
+void gamelog_begin(struct game_record *r, const char *p1, const char *p2,
+                   struct board_shape shape, int bot) {
+    memset(r, 0, sizeof(*r));
+    strncpy(r->player[0], p1, sizeof(r->player[0]) - 1);
+    strncpy(r->player[1], p2, sizeof(r->player[1]) - 1);
+    r->started = (uint32_t)time(NULL);
+    r->shape = shape;
+    r->bot = (uint8_t)bot;
+}
+
+// Moves go in high bits first, straight after the previous one
+void gamelog_move(struct game_record *r, int cell) {
+    if (r->moves >= BOARD_MAX_CELLS) return;
+
+    int bits = gamelog_move_bits(r->shape);
+    size_t pos = (size_t)r->moves * bits;
+    for (int b = bits - 1; b >= 0; b--, pos++) {
+        if ((cell >> b) & 1) r->packed[pos / 8] |= 0x80 >> (pos % 8);
+    }
+    r->moves++;
+}
+
+void gamelog_finish(struct game_record *r, int winner, int end) {
+    r->winner = (uint8_t)winner;
+    r->end = (uint8_t)end;
+}
+
+int gamelog_move_at(const uint8_t *packed, int bits, int i) {
+    size_t pos = (size_t)i * bits;
+    int cell = 0;
+    for (int b = 0; b < bits; b++, pos++) {
+        cell = (cell << 1) | ((packed[pos / 8] >> (7 - pos % 8)) & 1);
+    }
+    return cell;
+}
+
+static size_t packed_len(const struct gamelog_entry *e) {
+    return ((size_t)e->moves * e->bits + 7) / 8;
+}
+
+static void segment_path(uint32_t no, char *buf, size_t size) {
+    snprintf(buf, size, GAMELOG_DIR "/%06u.seg", no);
+}
+
+static int open_segment(uint32_t no) {
+    char path[64];
+    segment_path(no, path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("open game log segment failed");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat game log segment failed");
+        close(fd);
+        return -1;
+    }
+    if (segment_fd != -1) close(segment_fd);
+    segment_fd = fd;
+    segment_no = no;
+    segment_size = st.st_size;
+    return 0;
+}
+
+long gamelog_open() {
+    mkdir(GAMELOG_DIR, 0755);
+    index_fd = open(GAMELOG_INDEX, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (index_fd == -1) {
+        perror("open game log index failed");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(index_fd, &st) == -1) {
+        perror("fstat game log index failed");
+        return -1;
+    }
+
+    // Drop an entry torn by a crash; its record was never indexed
+    long last = st.st_size / sizeof(struct gamelog_slot);
+    if (st.st_size % sizeof(struct gamelog_slot) &&
+        ftruncate(index_fd, last * sizeof(struct gamelog_slot)) == -1) {
+        perror("ftruncate game log index failed");
+    }
+
+    // Carry on in the segment the last game went to
+    struct gamelog_slot slot = { 1, 0 };
+    if (last > 0 && pread(index_fd, &slot, sizeof(slot),
+                          (last - 1) * sizeof(slot)) != sizeof(slot)) {
+        perror("read game log index failed");
+        return -1;
+    }
+    if (open_segment(slot.segment ? slot.segment : 1) == -1) return -1;
+    return last;
+}
+
+int gamelog_append(const struct gamelog_entry *entries, const uint8_t *const *packed,
+                   int n, int sync) {
+    if (n == 0) return 0;
+
+    size_t total = 0;
+    for (int i = 0; i < n; i++) total += sizeof(entries[i]) + packed_len(&entries[i]);
+
+    uint32_t first = entries[0].id, span = entries[n - 1].id - first + 1;
+    char *buf = malloc(total);
+    struct gamelog_slot *slots = calloc(span, sizeof(*slots));
+    if (!buf || !slots) {
+        perror("malloc game log batch failed");
+        free(buf);
+        free(slots);
+        return -1;
+    }
+
+    if (segment_size > 0 && segment_size + (off_t)total > GAMELOG_SEGMENT_MAX &&
+        open_segment(segment_no + 1) == -1) {
+        free(buf);
+        free(slots);
+        return -1;
+    }
+
+    size_t used = 0;
+    for (int i = 0; i < n; i++) {
+        struct gamelog_slot *s = &slots[entries[i].id - first];
+        s->segment = segment_no;
+        s->offset = (uint32_t)(segment_size + used);
+        memcpy(buf + used, &entries[i], sizeof(entries[i]));
+        used += sizeof(entries[i]);
+        memcpy(buf + used, packed[i], packed_len(&entries[i]));
+        used += packed_len(&entries[i]);
+    }
+
+    // Records before the index: an entry only ever points at a whole record
+    int rc = -1;
+    if (write(segment_fd, buf, total) != (ssize_t)total) {
+        perror("write game log segment failed");
+        segment_size = lseek(segment_fd, 0, SEEK_END);
+    } else {
+        segment_size += total;
+        if (pwrite(index_fd, slots, span * sizeof(*slots),
+                   (off_t)(first - 1) * sizeof(*slots)) != (ssize_t)(span * sizeof(*slots))) {
+            perror("write game log index failed");
+        } else {
+            rc = 0;
+            if (sync && (fdatasync(segment_fd) == -1 || fdatasync(index_fd) == -1)) {
+                perror("fdatasync game log failed");
+            }
+        }
+    }
+    free(buf);
+    free(slots);
+    return rc;
+}
+
+int gamelog_read(uint32_t id, struct gamelog_entry *entry, uint8_t *packed) {
+    if (id == 0) return -1;
+    if (index_fd == -1) {
+        index_fd = open(GAMELOG_INDEX, O_RDONLY | O_CLOEXEC);
+        if (index_fd == -1) return -1;
+    }
+
+    struct gamelog_slot slot;
+    if (pread(index_fd, &slot, sizeof(slot), (off_t)(id - 1) * sizeof(slot)) != sizeof(slot) ||
+        slot.segment == 0) {
+        return -1;
+    }
+
+    // Just this record; the rest of the segment is never read
+    char path[64];
+    segment_path(slot.segment, path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    int rc = -1;
+    if (pread(fd, entry, sizeof(*entry), slot.offset) == sizeof(*entry) && entry->id == id &&
+        entry->moves <= BOARD_MAX_CELLS && entry->bits <= 9) {
+        ssize_t len = (ssize_t)packed_len(entry);
+        if (pread(fd, packed, len, slot.offset + sizeof(*entry)) == len) rc = 0;
+    }
+    close(fd);
+    return rc;
+}
@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+#include "../include/gametable.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#define SLOT_FREE 0
+#define SLOT_CLAIMED 1      // Owned by the server, not listed yet
+#define SLOT_LIVE 2
+
+#define READ_TRIES 1000     // A writer killed mid-update leaves its slot odd
+
+struct table_slot {
+    uint32_t version;       // Odd while the slot is being rewritten
+    uint32_t state;         // SLOT_*
+    pid_t owner;            // Server process that claimed the slot
+    struct live_game game;
+};
+
+struct game_table {
+    uint32_t hint;          // Where the next claim starts looking
+    uint32_t used;          // Slots below this have ever been claimed
+    struct table_slot slots[GAMETABLE_SLOTS];
+};
+
+static struct game_table *table;
+static pid_t host_pid;
+
+static int map_table(int oflag) {
+    int fd = shm_open(GAMETABLE_NAME, oflag, 0644);
+    if (fd == -1) return -1;
+    if ((oflag & O_CREAT) && ftruncate(fd, sizeof(*table)) == -1) {
+        perror("ftruncate game table failed");
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, sizeof(*table), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap game table failed");
+        return -1;
+    }
+    table = map;
+    host_pid = getpid();
+    return 0;
+}
+
+int gametable_create() {
+    // A table left by a server that crashed still lists its games
+    shm_unlink(GAMETABLE_NAME);
+    if (map_table(O_RDWR | O_CREAT | O_EXCL) == -1) {
+        perror("shm_open game table failed");
+        return -1;
+    }
+    // New shared memory is zero-filled: every slot starts SLOT_FREE
+    return 0;
+}
+
+int gametable_open() {
+    return map_table(O_RDWR);
+}
+
+void gametable_remove() {
+    shm_unlink(GAMETABLE_NAME);
+}
+
+static void begin_write(struct table_slot *s) {
+    __atomic_add_fetch(&s->version, 1, __ATOMIC_ACQ_REL);
+}
+
+static void end_write(struct table_slot *s) {
+    __atomic_add_fetch(&s->version, 1, __ATOMIC_RELEASE);
+}
+
+int gametable_claim(const char *p1, const char *p2, struct board_shape shape) {
+    if (!table) return -1;
+
+    uint32_t start = __atomic_fetch_add(&table->hint, 1, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < GAMETABLE_SLOTS; i++) {
+        uint32_t n = (start + i) % GAMETABLE_SLOTS;
+        struct table_slot *s = &table->slots[n];
+        uint32_t state = SLOT_FREE;
+        if (!__atomic_compare_exchange_n(&s->state, &state, SLOT_CLAIMED, 0,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            continue;
+        }
+
+        begin_write(s);
+        s->owner = getpid();
+        struct live_game *g = &s->game;
+        memset(g, 0, sizeof(*g));
+        strncpy(g->player[0], p1, sizeof(g->player[0]) - 1);
+        strncpy(g->player[1], p2, sizeof(g->player[1]) - 1);
+        g->host = s->owner;
+        g->started = (uint32_t)time(NULL);
+        g->turn = 1;
+        board_init(&g->board, shape);
+        __atomic_store_n(&s->state, SLOT_LIVE, __ATOMIC_RELAXED);
+        end_write(s);
+
+        uint32_t used = __atomic_load_n(&table->used, __ATOMIC_RELAXED);
+        while (used <= n && !__atomic_compare_exchange_n(&table->used, &used, n + 1, 0,
+                                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+        return (int)n;
+    }
+    return -1;
+}
+
+void gametable_release(int slot) {
+    if (!table || slot < 0 || slot >= GAMETABLE_SLOTS) return;
+
+    struct table_slot *s = &table->slots[slot];
+    begin_write(s);
+    __atomic_store_n(&s->state, SLOT_FREE, __ATOMIC_RELEASE);
+    end_write(s);
+}
+
+// A zombie counts as gone: an orphaned game process waits for init to reap it
+static int alive(pid_t pid) {
+    if (kill(pid, 0) == -1 && errno == ESRCH) return 0;
+
+    char path[32], stat[256];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return 1;
+    ssize_t n = read(fd, stat, sizeof(stat) - 1);
+    close(fd);
+    if (n <= 0) return 1;
+    stat[n] = '\0';
+
+    // "pid (comm) state ...", and comm may itself hold ')'
+    char *end = strrchr(stat, ')');
+    return !end || end[1] != ' ' || end[2] != 'Z';
+}
+
+// Free the slots of 'owner', or of every dead owner if 0, except those whose
+// game process is still running; those are counted in 'orphans'
+static int purge_slots(pid_t owner, int *orphans) {
+    if (!table) return 0;
+
+    int freed = 0, used = gametable_used();
+    *orphans = 0;
+    for (int n = 0; n < used; n++) {
+        struct table_slot *s = &table->slots[n];
+        if (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) == SLOT_FREE) continue;
+        if (owner ? s->owner != owner : alive(s->owner)) continue;
+
+        // A game process outlives its server and still writes its slot
+        pid_t host = s->game.host;
+        if (host != s->owner && alive(host)) {
+            (*orphans)++;
+            continue;
+        }
+        // Whatever it was writing is abandoned; make the count even again
+        __atomic_store_n(&s->version, (s->version | 1) + 1, __ATOMIC_RELAXED);
+        gametable_release(n);
+        freed++;
+    }
+    return freed;
+}
+
+int gametable_purge(pid_t owner, int *orphans) {
+    return purge_slots(owner, orphans);
+}
+
+int gametable_purge_orphans(int *orphans) {
+    return purge_slots(0, orphans);
+}
+
+void gametable_host(int slot) {
+    if (!table || slot < 0 || slot >= GAMETABLE_SLOTS) return;
+
+    struct table_slot *s = &table->slots[slot];
+    begin_write(s);
+    s->game.host = host_pid;
+    end_write(s);
+}
+
+void gametable_update(int slot, const struct board *b, int turn) {
+    if (!table || slot < 0 || slot >= GAMETABLE_SLOTS) return;
+
+    struct table_slot *s = &table->slots[slot];
+    begin_write(s);
+    s->game.turn = turn;
+    s->game.board = *b;
+    end_write(s);
+}
+
+void gametable_finish(int slot, const struct board *b, int winner, int end) {
+    if (!table || slot < 0 || slot >= GAMETABLE_SLOTS) return;
+
+    struct table_slot *s = &table->slots[slot];
+    begin_write(s);
+    s->game.turn = 0;
+    s->game.winner = winner;
+    s->game.end = end;
+    s->game.board = *b;
+    end_write(s);
+}
+
+int gametable_read(int slot, struct live_game *out) {
+    if (!table || slot < 0 || slot >= GAMETABLE_SLOTS) return -1;
+
+    struct table_slot *s = &table->slots[slot];
+    for (int tries = 0; tries < READ_TRIES; tries++) {
+        uint32_t v1 = __atomic_load_n(&s->version, __ATOMIC_ACQUIRE);
+        if (v1 & 1) continue;     // The writer is a few stores from done
+        uint32_t state = __atomic_load_n(&s->state, __ATOMIC_RELAXED);
+        memcpy(out, &s->game, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->version, __ATOMIC_RELAXED) == v1) {
+            out->player[0][sizeof(out->player[0]) - 1] = '\0';
+            out->player[1][sizeof(out->player[1]) - 1] = '\0';
+            return state == SLOT_LIVE ? 0 : -1;
+        }
+    }
+    return -1;
+}
+
+int gametable_used() {
+    return table ? (int)__atomic_load_n(&table->used, __ATOMIC_ACQUIRE) : 0;
+}
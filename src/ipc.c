@@ -3,102 +3,74 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
-union semun {
-    int val;
-    struct semid_ds *buf;
-    unsigned short *array;
-};
+#define MAX_PASSED_FDS 4
 
-int create_semaphore() {
-    int semid = semget(SEM_KEY, 1, IPC_CREAT | 0666);
-    if (semid == -1) {
-        perror("semget failed");
-        return -1;
-    }
+int send_with_fds(int sock, const void *buf, size_t len, const int *fds, int nfds) {
+    struct iovec iov;
+    struct msghdr msg;
+    char control[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)];
     
-    union semun u;
-    u.val = 1;
-    if (semctl(semid, 0, SETVAL, u) == -1) {
-        perror("semctl SETVAL failed");
-        return -1;
-    }
+    if (nfds < 0 || nfds > MAX_PASSED_FDS) return -1;
     
-    printf("[IPC] Semaphore created (ID: %d)\n", semid);
-    return semid;
-}
-
-void sem_lock(int semid) {
-    if (semid == -1) return;
+    iov.iov_base = (void *)buf;
+    iov.iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
     
-    struct sembuf sb = {0, -1, 0};
-    if (semop(semid, &sb, 1) == -1) {
-        perror("semop lock failed");
+    if (nfds > 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
     }
-}
-
-void sem_unlock(int semid) {
-    if (semid == -1) return;
-    
-    struct sembuf sb = {0, 1, 0};
-    if (semop(semid, &sb, 1) == -1) {
-        perror("semop unlock failed");
-    }
-}
-
-int create_msg_queue() {
-    int qid = msgget(MSG_KEY, IPC_CREAT | 0666);
-    if (qid == -1) {
-        perror("msgget failed");
-        return -1;
-    }
-    
-    printf("[IPC] Message queue created (ID: %d)\n", qid);
-    return qid;
-}
-
-int create_fifo() {
-    // Remove existing FIFO if it exists
-    unlink(FIFO_PATH);
     
-    if (mkfifo(FIFO_PATH, 0666) == -1) {
-        if (errno != EEXIST) {
-            perror("mkfifo failed");
-            return -1;
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("sendmsg failed");
         }
+        return -1;
     }
-    
-    printf("[IPC] FIFO created at %s\n", FIFO_PATH);
     return 0;
 }
 
-void send_notification(int fd, const char *msg) {
-    if (fd == -1) {
-        fprintf(stderr, "Invalid FIFO fd\n");
-        return;
-    }
+ssize_t recv_with_fds(int sock, void *buf, size_t len, int *fds, int max_fds, int *nfds) {
+    struct iovec iov;
+    struct msghdr msg;
+    char control[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)];
     
-    ssize_t written = write(fd, msg, strlen(msg));
-    if (written == -1) {
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            perror("write notification failed");
-        }
-    }
-}
-
-int receive_notification(int fd, char *buf, size_t size) {
-    if (fd == -1) {
-        fprintf(stderr, "Invalid FIFO fd\n");
-        return -1;
-    }
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
     
-    int bytes = read(fd, buf, size);
-    if (bytes == -1) {
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            perror("read notification failed");
+    *nfds = 0;
+    ssize_t bytes = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (bytes <= 0) return bytes;
+    
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int *passed = (int *)CMSG_DATA(cmsg);
+        for (int i = 0; i < count; i++) {
+            if (*nfds < max_fds) {
+                fds[(*nfds)++] = passed[i];
+            } else {
+                close(passed[i]);  // More than the caller expected
+            }
         }
-        return -1;
     }
-    
     return bytes;
-}
\ No newline at end of file
+}
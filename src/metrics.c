@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+#include "../include/metrics.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define HIST_MAX_US ((1L << 28) - 1)
+
+struct histogram {
+    uint64_t buckets[METRIC_HIST_BUCKETS];
+    uint64_t sum_us;
+    uint64_t count;
+};
+
+// One process's metrics. Block 0 is shared: it holds what dead processes
+// counted and takes updates from processes without a block of their own.
+struct metrics_block {
+    int32_t owner;          // Pid, 0 if free
+    uint64_t counters[METRIC_COUNTERS];
+    int64_t gauges[METRIC_GAUGES];
+    struct histogram hists[METRIC_HISTOGRAMS];
+} __attribute__((aligned(64)));
+
+struct metrics_region {
+    uint32_t fold_lock;     // Serialises folds
+    uint32_t fold_version;  // Odd while a block is being folded
+    struct metrics_block blocks[METRICS_BLOCKS];
+};
+
+static struct metrics_region *region;
+static struct metrics_block *mine;  // This process's block, or block 0
+
+static const struct {
+    const char *name, *help;
+} counter_info[METRIC_COUNTERS] = {
+    { "ttt_accepts_total", "Connections accepted." },
+    { "ttt_logins_total", "Players who logged in or registered." },
+    { "ttt_invites_total", "Invitations sent." },
+    { "ttt_games_started_total", "Games started, bot games included." },
+    { "ttt_games_finished_total", "Games whose players went back to the lobby." },
+    { "ttt_timeouts_total{kind=\"turn\"}", NULL },
+    { "ttt_timeouts_total{kind=\"invite\"}", NULL },
+    { "ttt_timeouts_total{kind=\"login\"}", NULL },
+};
+
+static const struct {
+    const char *name, *help;
+} gauge_info[METRIC_GAUGES] = {
+    { "ttt_lobby_players", "Logged-in players not in a game." },
+    { "ttt_live_games", "Games being played." },
+};
+
+static const struct {
+    const char *name, *help;
+} hist_info[METRIC_HISTOGRAMS] = {
+    { "ttt_login_seconds", "Time to handle a LOGIN or REGISTER line." },
+    { "ttt_leaderboard_seconds", "Time to render a leaderboard page." },
+    { "ttt_flock_wait_seconds", "Time blocked in flock on the user and stats files." },
+    { "ttt_move_seconds", "Time from reading a move to sending MOVE_MADE to both players." },
+};
+
+static int map_region(int oflag) {
+    int fd = shm_open(METRICS_NAME, oflag, 0644);
+    if (fd == -1) return -1;
+    if ((oflag & O_CREAT) && ftruncate(fd, sizeof(*region)) == -1) {
+        perror("ftruncate metrics failed");
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, sizeof(*region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap metrics failed");
+        return -1;
+    }
+    region = map;
+    mine = &region->blocks[0];
+    return 0;
+}
+
+int metrics_create() {
+    shm_unlink(METRICS_NAME);
+    if (map_region(O_RDWR | O_CREAT | O_EXCL) == -1) {
+        perror("shm_open metrics failed");
+        return -1;
+    }
+    return 0;
+}
+
+int metrics_open() {
+    return map_region(O_RDWR);
+}
+
+void metrics_remove() {
+    shm_unlink(METRICS_NAME);
+}
+
+static void fold_lock() {
+    while (__atomic_exchange_n(&region->fold_lock, 1, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    __atomic_add_fetch(&region->fold_version, 1, __ATOMIC_ACQ_REL);
+}
+
+static void fold_unlock() {
+    __atomic_add_fetch(&region->fold_version, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&region->fold_lock, 0, __ATOMIC_RELEASE);
+}
+
+// Add block 'b' to block 0 and free it. Gauges go with the process.
+static void fold_block(struct metrics_block *b) {
+    struct metrics_block *shared = &region->blocks[0];
+
+    for (int i = 0; i < METRIC_COUNTERS; i++) {
+        __atomic_fetch_add(&shared->counters[i], b->counters[i], __ATOMIC_RELAXED);
+    }
+    for (int h = 0; h < METRIC_HISTOGRAMS; h++) {
+        struct histogram *from = &b->hists[h], *to = &shared->hists[h];
+        for (int i = 0; i < METRIC_HIST_BUCKETS; i++) {
+            if (from->buckets[i]) {
+                __atomic_fetch_add(&to->buckets[i], from->buckets[i], __ATOMIC_RELAXED);
+            }
+        }
+        __atomic_fetch_add(&to->sum_us, from->sum_us, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&to->count, from->count, __ATOMIC_RELAXED);
+    }
+    int32_t owner = b->owner;
+    memset(b, 0, sizeof(*b));
+    b->owner = owner;
+    __atomic_store_n(&b->owner, 0, __ATOMIC_RELEASE);
+}
+
+// Blocks of processes that died without their parent reaping them
+static void fold_orphans() {
+    for (int n = 1; n < METRICS_BLOCKS; n++) {
+        struct metrics_block *b = &region->blocks[n];
+        pid_t owner = __atomic_load_n(&b->owner, __ATOMIC_ACQUIRE);
+        if (owner > 0 && kill(owner, 0) == -1 && errno == ESRCH) {
+            metrics_reap(owner);
+        }
+    }
+}
+
+static struct metrics_block *claim_block(pid_t pid) {
+    for (int n = 1; n < METRICS_BLOCKS; n++) {
+        struct metrics_block *b = &region->blocks[n];
+        int32_t free_owner = 0;
+        if (__atomic_compare_exchange_n(&b->owner, &free_owner, pid, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+void metrics_attach() {
+    if (!region) return;
+
+    pid_t pid = getpid();
+    struct metrics_block *b = claim_block(pid);
+    if (!b) {
+        fold_orphans();
+        b = claim_block(pid);
+    }
+    mine = b ? b : &region->blocks[0];
+}
+
+void metrics_reap(pid_t pid) {
+    if (!region || pid <= 0) return;
+
+    for (int n = 1; n < METRICS_BLOCKS; n++) {
+        struct metrics_block *b = &region->blocks[n];
+        if (__atomic_load_n(&b->owner, __ATOMIC_ACQUIRE) != pid) continue;
+        fold_lock();
+        if (__atomic_load_n(&b->owner, __ATOMIC_ACQUIRE) == pid) fold_block(b);
+        fold_unlock();
+        return;
+    }
+}
+
+void metrics_count(int counter) {
+    if (!mine) return;
+    __atomic_fetch_add(&mine->counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+void metrics_gauge_add(int gauge, int delta) {
+    if (!mine) return;
+    __atomic_fetch_add(&mine->gauges[gauge], delta, __ATOMIC_RELAXED);
+}
+
+// Values under 4 us get a bucket each; above that, four per power of two
+static int bucket_of(long us) {
+    if (us < 4) return us < 0 ? 0 : (int)us;
+    if (us > HIST_MAX_US) us = HIST_MAX_US;
+    int k = 63 - __builtin_clzl((unsigned long)us);
+    return 4 * (k - 1) + (int)((us >> (k - 2)) & 3);
+}
+
+// Largest value in bucket 'i', in us
+static long bucket_top(int i) {
+    if (i < 4) return i;
+    int k = i / 4 + 1, sub = i % 4;
+    return ((long)(5 + sub) << (k - 2)) - 1;
+}
+
+void metrics_observe(int histogram, long us) {
+    if (!mine) return;
+    struct histogram *h = &mine->hists[histogram];
+    __atomic_fetch_add(&h->buckets[bucket_of(us)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum_us, us > 0 ? (uint64_t)us : 0, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+}
+
+long long metrics_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// Every block added up, unless a fold moved counts between blocks meanwhile
+static void sum_blocks(struct metrics_block *total) {
+    while (1) {
+        uint32_t v = __atomic_load_n(&region->fold_version, __ATOMIC_ACQUIRE);
+        if (v & 1) {
+            sched_yield();
+            continue;
+        }
+
+        memset(total, 0, sizeof(*total));
+        for (int n = 0; n < METRICS_BLOCKS; n++) {
+            struct metrics_block *b = &region->blocks[n];
+            if (n > 0 && __atomic_load_n(&b->owner, __ATOMIC_ACQUIRE) <= 0) continue;
+            for (int i = 0; i < METRIC_COUNTERS; i++) {
+                total->counters[i] += __atomic_load_n(&b->counters[i], __ATOMIC_RELAXED);
+            }
+            for (int i = 0; i < METRIC_GAUGES; i++) {
+                total->gauges[i] += __atomic_load_n(&b->gauges[i], __ATOMIC_RELAXED);
+            }
+            for (int h = 0; h < METRIC_HISTOGRAMS; h++) {
+                struct histogram *from = &b->hists[h], *to = &total->hists[h];
+                for (int i = 0; i < METRIC_HIST_BUCKETS; i++) {
+                    to->buckets[i] += __atomic_load_n(&from->buckets[i], __ATOMIC_RELAXED);
+                }
+                to->sum_us += __atomic_load_n(&from->sum_us, __ATOMIC_RELAXED);
+                to->count += __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&region->fold_version, __ATOMIC_RELAXED) == v) return;
+    }
+}
+
+size_t metrics_render(char *buf, size_t size) {
+    static struct metrics_block total;
+    size_t len = 0;
+    if (!region || size == 0) return 0;
+    sum_blocks(&total);
+
+#define EMIT(...) do { \
+        int n_ = snprintf(buf + len, size - len, __VA_ARGS__); \
+        if (n_ < 0 || (size_t)n_ >= size - len) return len; \
+        len += n_; \
+    } while (0)
+
+    for (int i = 0; i < METRIC_COUNTERS; i++) {
+        if (i == METRIC_TURN_TIMEOUTS) {
+            EMIT("# HELP ttt_timeouts_total Turns, invitations and logins that ran out of time.\n"
+                 "# TYPE ttt_timeouts_total counter\n");
+        } else if (counter_info[i].help) {
+            EMIT("# HELP %s %s\n# TYPE %s counter\n", counter_info[i].name,
+                 counter_info[i].help, counter_info[i].name);
+        }
+        EMIT("%s %llu\n", counter_info[i].name, (unsigned long long)total.counters[i]);
+    }
+    for (int i = 0; i < METRIC_GAUGES; i++) {
+        EMIT("# HELP %s %s\n# TYPE %s gauge\n%s %lld\n", gauge_info[i].name, gauge_info[i].help,
+             gauge_info[i].name, gauge_info[i].name, (long long)total.gauges[i]);
+    }
+    for (int h = 0; h < METRIC_HISTOGRAMS; h++) {
+        const char *name = hist_info[h].name;
+        struct histogram *hist = &total.hists[h];
+        EMIT("# HELP %s %s\n# TYPE %s histogram\n", name, hist_info[h].help, name);
+        uint64_t cumulative = 0;
+        for (int i = 0; i < METRIC_HIST_BUCKETS - 1; i++) {
+            cumulative += hist->buckets[i];
+            EMIT("%s_bucket{le=\"%.6f\"} %llu\n", name, bucket_top(i) / 1e6,
+                 (unsigned long long)cumulative);
+        }
+        EMIT("%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)hist->count);
+        EMIT("%s_sum %.6f\n%s_count %llu\n", name, hist->sum_us / 1e6, name,
+             (unsigned long long)hist->count);
+    }
+#undef EMIT
+    return len;
+}
@@ -0,0 +1,175 @@
+#include "../include/ostree.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OSTREE_MIN_CAP 1024
+
+static int size_of(const struct ostree *t, int id) {
+    return id == -1 ? 0 : t->nodes[id].size;
+}
+
+static void update(struct ostree *t, int id) {
+    struct ostree_node *n = &t->nodes[id];
+    n->size = 1 + size_of(t, n->left) + size_of(t, n->right);
+}
+
+static uint32_t next_prio(struct ostree *t) {
+    // xorshift32
+    uint32_t x = t->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    t->seed = x;
+    return x;
+}
+
+// Split 'root' into the ids ordered before 'id' and the rest
+static void split(struct ostree *t, int root, int id, int *l, int *r) {
+    if (root == -1) {
+        *l = *r = -1;
+        return;
+    }
+    if (t->cmp(root, id, t->arg) < 0) {
+        split(t, t->nodes[root].right, id, &t->nodes[root].right, r);
+        *l = root;
+    } else {
+        split(t, t->nodes[root].left, id, l, &t->nodes[root].left);
+        *r = root;
+    }
+    update(t, root);
+}
+
+// Join two trees where every id in 'l' is ordered before every id in 'r'
+static int merge(struct ostree *t, int l, int r) {
+    if (l == -1) return r;
+    if (r == -1) return l;
+    if (t->nodes[l].prio > t->nodes[r].prio) {
+        t->nodes[l].right = merge(t, t->nodes[l].right, r);
+        update(t, l);
+        return l;
+    }
+    t->nodes[r].left = merge(t, l, t->nodes[r].left);
+    update(t, r);
+    return r;
+}
+
+static int insert_at(struct ostree *t, int root, int id) {
+    if (root == -1) return id;
+    if (t->nodes[id].prio > t->nodes[root].prio) {
+        split(t, root, id, &t->nodes[id].left, &t->nodes[id].right);
+        update(t, id);
+        return id;
+    }
+    if (t->cmp(id, root, t->arg) < 0) {
+        t->nodes[root].left = insert_at(t, t->nodes[root].left, id);
+    } else {
+        t->nodes[root].right = insert_at(t, t->nodes[root].right, id);
+    }
+    update(t, root);
+    return root;
+}
+
+static int remove_at(struct ostree *t, int root, int id) {
+    if (root == -1) return -1;
+    if (root == id) {
+        return merge(t, t->nodes[id].left, t->nodes[id].right);
+    }
+    if (t->cmp(id, root, t->arg) < 0) {
+        t->nodes[root].left = remove_at(t, t->nodes[root].left, id);
+    } else {
+        t->nodes[root].right = remove_at(t, t->nodes[root].right, id);
+    }
+    update(t, root);
+    return root;
+}
+
+void ostree_init(struct ostree *t, ostree_cmp cmp, void *arg) {
+    memset(t, 0, sizeof(*t));
+    t->root = -1;
+    t->seed = 2463534242u;
+    t->cmp = cmp;
+    t->arg = arg;
+}
+
+void ostree_free(struct ostree *t) {
+    free(t->nodes);
+    t->nodes = NULL;
+    t->cap = 0;
+    t->root = -1;
+}
+
+void ostree_clear(struct ostree *t) {
+    if (t->nodes) memset(t->nodes, 0, t->cap * sizeof(*t->nodes));
+    t->root = -1;
+}
+
+int ostree_insert(struct ostree *t, int id) {
+    if (id >= t->cap) {
+        int cap = t->cap ? t->cap : OSTREE_MIN_CAP;
+        while (cap <= id) cap *= 2;
+        struct ostree_node *nn = realloc(t->nodes, cap * sizeof(*nn));
+        if (!nn) {
+            perror("realloc order-statistic tree failed");
+            return -1;
+        }
+        memset(nn + t->cap, 0, (cap - t->cap) * sizeof(*nn));
+        t->nodes = nn;
+        t->cap = cap;
+    }
+    if (t->nodes[id].size) return 0;
+
+    struct ostree_node *n = &t->nodes[id];
+    n->left = n->right = -1;
+    n->size = 1;
+    n->prio = next_prio(t);
+    t->root = insert_at(t, t->root, id);
+    return 0;
+}
+
+void ostree_remove(struct ostree *t, int id) {
+    if (!ostree_contains(t, id)) return;
+    t->root = remove_at(t, t->root, id);
+    t->nodes[id].size = 0;
+}
+
+int ostree_contains(const struct ostree *t, int id) {
+    return id >= 0 && id < t->cap && t->nodes[id].size > 0;
+}
+
+int ostree_size(const struct ostree *t) {
+    return size_of(t, t->root);
+}
+
+int ostree_rank(const struct ostree *t, int id) {
+    if (!ostree_contains(t, id)) return -1;
+
+    int rank = 0, n = t->root;
+    while (n != -1 && n != id) {
+        if (t->cmp(id, n, t->arg) < 0) {
+            n = t->nodes[n].left;
+        } else {
+            rank += size_of(t, t->nodes[n].left) + 1;
+            n = t->nodes[n].right;
+        }
+    }
+    return n == id ? rank + size_of(t, t->nodes[id].left) : -1;
+}
+
+int ostree_select(const struct ostree *t, int k) {
+    int n = t->root;
+    if (k < 0 || k >= size_of(t, n)) return -1;
+
+    while (n != -1) {
+        int left = size_of(t, t->nodes[n].left);
+        if (k < left) {
+            n = t->nodes[n].left;
+        } else if (k == left) {
+            return n;
+        } else {
+            k -= left + 1;
+            n = t->nodes[n].right;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,216 @@
+#include "../include/outq.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define OUTQ_IOV_MAX 16     // Shared messages one writev sends
+
+struct outq_shared *outq_shared_new(const void *data, size_t len) {
+    struct outq_shared *m = malloc(sizeof(*m) + len);
+    if (!m) {
+        perror("malloc shared message failed");
+        return NULL;
+    }
+    m->refs = 1;
+    m->len = len;
+    memcpy(m->data, data, len);
+    return m;
+}
+
+void outq_shared_put(struct outq_shared *m) {
+    if (m && --m->refs == 0) free(m);
+}
+
+int outq_append_shared(struct outq *q, struct outq_shared *m) {
+    if (q->len + q->shared_len + m->len > OUTQ_LIMIT || q->shared_count == OUTQ_SHARED_MAX) {
+        return -1;
+    }
+    if (!q->shared) {
+        q->shared = malloc(OUTQ_SHARED_MAX * sizeof(*q->shared));
+        if (!q->shared) {
+            perror("malloc shared output queue failed");
+            return -1;
+        }
+        q->shared_head = 0;
+        q->shared_off = 0;
+    }
+
+    m->refs++;
+    q->shared[(q->shared_head + q->shared_count) % OUTQ_SHARED_MAX] = m;
+    q->shared_count++;
+    q->shared_len += m->len;
+    return 0;
+}
+
+// Make room for 'need' queued bytes, doubling the ring up to OUTQ_LIMIT.
+// What is queued moves to the front of the new ring.
+static int reserve(struct outq *q, size_t need) {
+    if (need <= q->cap) return 0;
+
+    size_t cap = q->cap ? q->cap : OUTQ_INITIAL;
+    while (cap < need) cap *= 2;
+    char *buf = malloc(cap);
+    if (!buf) {
+        perror("malloc output queue failed");
+        return -1;
+    }
+
+    size_t first = q->cap - q->head < q->len ? q->cap - q->head : q->len;
+    if (q->len > 0) {
+        memcpy(buf, q->buf + q->head, first);
+        memcpy(buf + first, q->buf, q->len - first);
+    }
+    free(q->buf);
+    q->buf = buf;
+    q->cap = cap;
+    q->head = 0;
+    return 0;
+}
+
+int outq_append(struct outq *q, const void *data, size_t len) {
+    if (len == 0) return 0;
+    if (q->len + q->shared_len + len > OUTQ_LIMIT) return -1;
+
+    if (q->shared_count > 0) {
+        // Goes after the shared messages already queued
+        struct outq_shared *m = outq_shared_new(data, len);
+        if (!m) return -1;
+        int rc = outq_append_shared(q, m);
+        outq_shared_put(m);
+        return rc;
+    }
+
+    if (reserve(q, q->len + len) == -1) return -1;
+
+    // Copy in up to two pieces around the end of the ring
+    size_t tail = (q->head + q->len) % q->cap;
+    size_t first = q->cap - tail < len ? q->cap - tail : len;
+    memcpy(q->buf + tail, data, first);
+    memcpy(q->buf, (const char *)data + first, len - first);
+    q->len += len;
+    return 0;
+}
+
+int outq_write(struct outq *q, int fd, const void *data, size_t len) {
+    if (q->len == 0 && q->shared_count == 0) {
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return -1;
+            sent = 0;
+        }
+        if ((size_t)sent == len) return 0;
+        data = (const char *)data + sent;
+        len -= sent;
+    }
+    // Keep the rest in order behind the backlog; EPOLLOUT will flush it
+    return outq_append(q, data, len);
+}
+
+// Drop 'sent' bytes from the front of the shared messages
+static void consume_shared(struct outq *q, size_t sent) {
+    q->shared_len -= sent;
+    while (sent > 0) {
+        struct outq_shared *m = q->shared[q->shared_head];
+        size_t left = m->len - q->shared_off;
+        if (sent < left) {
+            q->shared_off += sent;
+            return;
+        }
+        sent -= left;
+        outq_shared_put(m);
+        q->shared_head = (q->shared_head + 1) % OUTQ_SHARED_MAX;
+        q->shared_count--;
+        q->shared_off = 0;
+    }
+}
+
+int outq_flush(struct outq *q, int fd) {
+    while (q->len > 0) {
+        struct iovec iov[2];
+        int iovcnt = 1;
+        size_t first = q->cap - q->head < q->len ? q->cap - q->head : q->len;
+
+        iov[0].iov_base = q->buf + q->head;
+        iov[0].iov_len = first;
+        if (first < q->len) {
+            iov[1].iov_base = q->buf;
+            iov[1].iov_len = q->len - first;
+            iovcnt = 2;
+        }
+
+        ssize_t sent = writev(fd, iov, iovcnt);
+        if (sent == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        q->head = (q->head + sent) % q->cap;
+        q->len -= sent;
+    }
+
+    // Shared messages are sent from their one copy
+    while (q->shared_count > 0) {
+        struct iovec iov[OUTQ_IOV_MAX];
+        int iovcnt = 0;
+        for (int i = 0; i < q->shared_count && iovcnt < OUTQ_IOV_MAX; i++) {
+            struct outq_shared *m = q->shared[(q->shared_head + i) % OUTQ_SHARED_MAX];
+            size_t skip = i == 0 ? q->shared_off : 0;
+            iov[iovcnt].iov_base = m->data + skip;
+            iov[iovcnt].iov_len = m->len - skip;
+            iovcnt++;
+        }
+
+        ssize_t sent = writev(fd, iov, iovcnt);
+        if (sent == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        consume_shared(q, sent);
+    }
+
+    outq_clear(q);
+    return 0;
+}
+
+size_t outq_pending(const struct outq *q) {
+    return q->len + q->shared_len;
+}
+
+size_t outq_copy(const struct outq *q, char *dst, size_t cap) {
+    size_t n = q->len < cap ? q->len : cap;
+    size_t first = q->cap - q->head < n ? q->cap - q->head : n;
+
+    if (n > 0) {
+        memcpy(dst, q->buf + q->head, first);
+        memcpy(dst + first, q->buf, n - first);
+    }
+    for (int i = 0; i < q->shared_count && n < cap; i++) {
+        struct outq_shared *m = q->shared[(q->shared_head + i) % OUTQ_SHARED_MAX];
+        size_t skip = i == 0 ? q->shared_off : 0;
+        size_t part = m->len - skip < cap - n ? m->len - skip : cap - n;
+        memcpy(dst + n, m->data + skip, part);
+        n += part;
+    }
+    return n;
+}
+
+void outq_clear(struct outq *q) {
+    free(q->buf);
+    q->buf = NULL;
+    q->cap = 0;
+    q->head = 0;
+    q->len = 0;
+    for (int i = 0; i < q->shared_count; i++) {
+        outq_shared_put(q->shared[(q->shared_head + i) % OUTQ_SHARED_MAX]);
+    }
+    free(q->shared);
+    q->shared = NULL;
+    q->shared_head = 0;
+    q->shared_count = 0;
+    q->shared_off = 0;
+    q->shared_len = 0;
+}
@@ -0,0 +1,465 @@
+#define _GNU_SOURCE
+#include "../include/presence.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define PRESENCE_STRIPES 256
+#define RECLAIM_SHARE 8     // Tombstones are swept once 1/8 of the slots are dead
+
+#define SLOT_EMPTY 0
+#define SLOT_WRITING 1
+#define SLOT_USED 2
+#define SLOT_DEAD 3
+
+struct presence_slot {
+    uint32_t state;     // SLOT_*
+    uint32_t version;   // Odd while the slot is being rewritten
+    int32_t shard;
+    int32_t busy;
+    char name[PRESENCE_NAME_LEN];
+};
+
+// Robust and process-shared: a shard that dies holding one leaves it to
+// the next locker, which undoes the write it was part-way through
+struct presence_stripe {
+    pthread_mutex_t mutex;
+    int32_t writing;    // Slot the holder is rewriting, -1 if none
+};
+
+struct presence_dir {
+    size_t mask;        // capacity - 1 (capacity is a power of two)
+    uint32_t max_probe; // Longest probe any live entry needed: lookups stop there
+    uint32_t dead;      // SLOT_DEAD tombstones
+    struct presence_stripe stripes[PRESENCE_STRIPES];
+    struct presence_slot slots[];
+    // Followed by one bit per slot, set while it holds an entry, so walks
+    // skip empty stretches of the table 64 slots at a time
+};
+
+struct feed_slot {
+    uint32_t version;   // Version of the event stored here, 0 while being written
+    int32_t type;
+    char name[PRESENCE_NAME_LEN];
+};
+
+struct presence_feed {
+    size_t mask;        // slots - 1 (a power of two)
+    pthread_mutex_t lock;   // Serialises publishers so versions are published in order
+    uint32_t head;      // Last version handed out
+    struct feed_slot slots[];
+};
+
+static unsigned long hash_name(const char *s) {
+    // FNV-1a
+    unsigned long h = 2166136261UL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+static int init_shared_mutex(pthread_mutex_t *m) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    int ret = pthread_mutex_init(m, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return ret;
+}
+
+static uint64_t *occupied_map(struct presence_dir *d) {
+    return (uint64_t *)&d->slots[d->mask + 1];
+}
+
+static void mark_occupied(struct presence_dir *d, size_t i, int occupied) {
+    uint64_t bit = 1ULL << (i % 64);
+    if (occupied) __atomic_fetch_or(&occupied_map(d)[i / 64], bit, __ATOMIC_RELEASE);
+    else __atomic_fetch_and(&occupied_map(d)[i / 64], ~bit, __ATOMIC_RELEASE);
+}
+
+static void begin_write(struct presence_slot *s);
+static void end_write(struct presence_slot *s);
+
+// The stripe's last holder died: finish off the slot it was rewriting.
+// A claim it never completed becomes a tombstone.
+static void repair_stripe(struct presence_dir *d, struct presence_stripe *st) {
+    int32_t i = st->writing;
+    if (i >= 0) {
+        struct presence_slot *s = &d->slots[i];
+        if (s->version & 1) end_write(s);
+        if (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) == SLOT_WRITING) {
+            begin_write(s);
+            __atomic_store_n(&s->state, SLOT_DEAD, __ATOMIC_RELEASE);
+            end_write(s);
+            mark_occupied(d, i, 0);
+            __atomic_add_fetch(&d->dead, 1, __ATOMIC_RELAXED);
+        }
+    }
+    st->writing = -1;
+    fprintf(stderr, "[PRESENCE] Recovered a lock held by a dead process\n");
+}
+
+static struct presence_stripe *lock_stripe(struct presence_dir *d, size_t idx) {
+    struct presence_stripe *st = &d->stripes[idx];
+    if (pthread_mutex_lock(&st->mutex) == EOWNERDEAD) {
+        repair_stripe(d, st);
+        pthread_mutex_consistent(&st->mutex);
+    }
+    return st;
+}
+
+static struct presence_stripe *stripe_lock(struct presence_dir *d, unsigned long h) {
+    return lock_stripe(d, h % PRESENCE_STRIPES);
+}
+
+static void stripe_unlock(struct presence_dir *d, unsigned long h) {
+    pthread_mutex_unlock(&d->stripes[h % PRESENCE_STRIPES].mutex);
+}
+
+// Consistent copy of a slot. Returns its state.
+static uint32_t read_slot(struct presence_slot *s, struct presence_slot *copy) {
+    while (1) {
+        uint32_t v1 = __atomic_load_n(&s->version, __ATOMIC_ACQUIRE);
+        if (v1 & 1) {
+            sched_yield();
+            continue;
+        }
+        copy->state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+        copy->shard = s->shard;
+        copy->busy = s->busy;
+        memcpy(copy->name, s->name, sizeof(copy->name));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->version, __ATOMIC_RELAXED) == v1) {
+            copy->name[sizeof(copy->name) - 1] = '\0';
+            return copy->state;
+        }
+    }
+}
+
+static void begin_write(struct presence_slot *s) {
+    __atomic_add_fetch(&s->version, 1, __ATOMIC_ACQ_REL);
+}
+
+static void end_write(struct presence_slot *s) {
+    __atomic_add_fetch(&s->version, 1, __ATOMIC_RELEASE);
+}
+
+// Find a live slot for name; caller holds the stripe lock if it will write
+static struct presence_slot *find_slot(struct presence_dir *d, const char *name, unsigned long h) {
+    uint32_t max_probe = __atomic_load_n(&d->max_probe, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i <= max_probe && i <= d->mask; i++) {
+        struct presence_slot *s = &d->slots[(h + i) & d->mask];
+        struct presence_slot copy;
+        uint32_t state = read_slot(s, &copy);
+
+        if (state == SLOT_EMPTY) return NULL;
+        if (state == SLOT_USED && strcmp(copy.name, name) == 0) return s;
+    }
+    return NULL;
+}
+
+struct presence_dir *presence_create(size_t capacity) {
+    size_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+
+    if (cap < 64) cap = 64;
+
+    size_t size = sizeof(struct presence_dir) + cap * sizeof(struct presence_slot) + cap / 8;
+    struct presence_dir *d = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (d == MAP_FAILED) {
+        perror("mmap presence directory failed");
+        return NULL;
+    }
+    // Anonymous mappings are zero-filled: every slot starts SLOT_EMPTY
+    d->mask = cap - 1;
+    for (int i = 0; i < PRESENCE_STRIPES; i++) {
+        if (init_shared_mutex(&d->stripes[i].mutex) != 0) {
+            fprintf(stderr, "[PRESENCE] Cannot create shared locks\n");
+            munmap(d, size);
+            return NULL;
+        }
+        d->stripes[i].writing = -1;
+    }
+    return d;
+}
+
+int presence_claim(struct presence_dir *d, const char *name, int shard) {
+    unsigned long h = hash_name(name);
+    int ret = -1;
+
+    struct presence_stripe *st = stripe_lock(d, h);
+    if (find_slot(d, name, h) == NULL) {
+        for (size_t i = 0; i <= d->mask; i++) {
+            size_t n = (h + i) & d->mask;
+            struct presence_slot *s = &d->slots[n];
+            uint32_t state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+            if (state != SLOT_EMPTY && state != SLOT_DEAD) continue;
+
+            // Other stripes may race for the same free slot; CAS decides.
+            // Dying before 'writing' is set leaks the slot as SLOT_WRITING,
+            // which only lengthens chains; setting it first could let the
+            // repair kill another stripe's claim of the same slot.
+            if (__atomic_compare_exchange_n(&s->state, &state, SLOT_WRITING, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                st->writing = (int32_t)n;
+                if (state == SLOT_DEAD) __atomic_sub_fetch(&d->dead, 1, __ATOMIC_RELAXED);
+                // Lookups must reach this far before the entry is visible
+                uint32_t max_probe = __atomic_load_n(&d->max_probe, __ATOMIC_RELAXED);
+                while (max_probe < i &&
+                       !__atomic_compare_exchange_n(&d->max_probe, &max_probe, (uint32_t)i, 0,
+                                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+                }
+                mark_occupied(d, n, 1);
+                begin_write(s);
+                strncpy(s->name, name, sizeof(s->name) - 1);
+                s->name[sizeof(s->name) - 1] = '\0';
+                s->shard = shard;
+                s->busy = 0;
+                __atomic_store_n(&s->state, SLOT_USED, __ATOMIC_RELEASE);
+                end_write(s);
+                st->writing = -1;
+                ret = 0;
+                break;
+            }
+        }
+        if (ret == -1) {
+            fprintf(stderr, "[PRESENCE] Directory full, cannot add '%s'\n", name);
+        }
+    }
+    stripe_unlock(d, h);
+    return ret;
+}
+
+// Caller holds the entry's stripe lock
+static void kill_slot(struct presence_dir *d, struct presence_stripe *st, struct presence_slot *s) {
+    st->writing = (int32_t)(s - d->slots);
+    begin_write(s);
+    __atomic_store_n(&s->state, SLOT_DEAD, __ATOMIC_RELEASE);
+    end_write(s);
+    mark_occupied(d, s - d->slots, 0);
+    __atomic_add_fetch(&d->dead, 1, __ATOMIC_RELAXED);
+    st->writing = -1;
+}
+
+static int too_many_dead(struct presence_dir *d) {
+    return __atomic_load_n(&d->dead, __ATOMIC_RELAXED) > (d->mask + 1) / RECLAIM_SHARE;
+}
+
+// Turn tombstones back into empty slots. A tombstone only keeps probe chains
+// going, so one followed by an empty slot ends every chain through it and
+// can go; sweeping backwards from each empty slot clears whole runs. With
+// every stripe locked no claim is part-way down a chain, and lock-free
+// readers never miss a live entry, since none lies past an empty slot.
+// The probe high-water mark is recomputed from the live entries.
+static void reclaim_tombstones(struct presence_dir *d) {
+    for (int i = 0; i < PRESENCE_STRIPES; i++) lock_stripe(d, i);
+
+    if (too_many_dead(d)) {
+        size_t cap = d->mask + 1, start = 0;
+        while (start < cap && d->slots[start].state != SLOT_EMPTY) start++;
+        uint32_t reclaimed = 0, max_probe = 0;
+
+        // Walk once round the table backwards from an empty slot, so each
+        // run of tombstones is met right after the empty slot that ends it
+        int after_empty = 1;
+        for (size_t k = 1; start < cap && k <= cap; k++) {
+            size_t i = (start + cap - k) & d->mask;
+            struct presence_slot *s = &d->slots[i];
+            if (s->state == SLOT_DEAD && after_empty) {
+                begin_write(s);
+                __atomic_store_n(&s->state, SLOT_EMPTY, __ATOMIC_RELEASE);
+                end_write(s);
+                reclaimed++;
+                continue;
+            }
+            after_empty = s->state == SLOT_EMPTY;
+            if (s->state == SLOT_USED) {
+                uint32_t probe = (uint32_t)((i - hash_name(s->name)) & d->mask);
+                if (probe > max_probe) max_probe = probe;
+            }
+        }
+        if (start == cap) {
+            // No empty slot at all: every chain may run through every slot
+            max_probe = (uint32_t)d->mask;
+        }
+        __atomic_sub_fetch(&d->dead, reclaimed, __ATOMIC_RELAXED);
+        __atomic_store_n(&d->max_probe, max_probe, __ATOMIC_RELEASE);
+    }
+
+    for (int i = PRESENCE_STRIPES - 1; i >= 0; i--) pthread_mutex_unlock(&d->stripes[i].mutex);
+}
+
+void presence_release(struct presence_dir *d, const char *name) {
+    unsigned long h = hash_name(name);
+
+    struct presence_stripe *st = stripe_lock(d, h);
+    struct presence_slot *s = find_slot(d, name, h);
+    if (s) kill_slot(d, st, s);
+    stripe_unlock(d, h);
+
+    if (too_many_dead(d)) reclaim_tombstones(d);
+}
+
+int presence_update(struct presence_dir *d, const char *name, int shard, int busy) {
+    unsigned long h = hash_name(name);
+
+    struct presence_stripe *st = stripe_lock(d, h);
+    struct presence_slot *s = find_slot(d, name, h);
+    if (s) {
+        st->writing = (int32_t)(s - d->slots);
+        begin_write(s);
+        s->shard = shard;
+        s->busy = busy;
+        end_write(s);
+        st->writing = -1;
+    }
+    stripe_unlock(d, h);
+    return s ? 0 : -1;
+}
+
+int presence_lookup(struct presence_dir *d, const char *name, struct presence_info *out) {
+    unsigned long h = hash_name(name);
+    uint32_t max_probe = __atomic_load_n(&d->max_probe, __ATOMIC_ACQUIRE);
+
+    for (size_t i = 0; i <= max_probe && i <= d->mask; i++) {
+        struct presence_slot copy;
+        uint32_t state = read_slot(&d->slots[(h + i) & d->mask], &copy);
+
+        if (state == SLOT_EMPTY) return -1;
+        if (state == SLOT_USED && strcmp(copy.name, name) == 0) {
+            out->shard = copy.shard;
+            out->busy = copy.busy;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Occupied slot at or after 'from', or d->mask + 1 if none
+static size_t next_occupied(struct presence_dir *d, size_t from) {
+    uint64_t *map = occupied_map(d);
+    size_t words = (d->mask + 1) / 64;
+    for (size_t w = from / 64; w < words; w++) {
+        uint64_t bits = __atomic_load_n(&map[w], __ATOMIC_ACQUIRE);
+        if (w == from / 64) bits &= ~0ULL << (from % 64);
+        if (bits) return w * 64 + __builtin_ctzll(bits);
+    }
+    return d->mask + 1;
+}
+
+void presence_purge_shard(struct presence_dir *d, int shard, presence_visit_fn fn, void *arg) {
+    // Take and drop every lock first: any the dead shard held are repaired,
+    // so no slot it was rewriting is left looking busy to readers
+    for (int i = 0; i < PRESENCE_STRIPES; i++) {
+        lock_stripe(d, i);
+        pthread_mutex_unlock(&d->stripes[i].mutex);
+    }
+
+    for (size_t i = next_occupied(d, 0); i <= d->mask; i = next_occupied(d, i + 1)) {
+        struct presence_slot copy;
+        if (read_slot(&d->slots[i], &copy) != SLOT_USED || copy.shard != shard) continue;
+
+        // Re-check under the lock: the player may have moved shards meanwhile
+        unsigned long h = hash_name(copy.name);
+        struct presence_stripe *st = stripe_lock(d, h);
+        struct presence_slot *s = find_slot(d, copy.name, h);
+        int purged = s && s->shard == shard;
+        if (purged) kill_slot(d, st, s);
+        stripe_unlock(d, h);
+
+        if (purged && fn) {
+            struct presence_info info = { copy.shard, copy.busy };
+            fn(copy.name, &info, arg);
+        }
+    }
+
+    if (too_many_dead(d)) reclaim_tombstones(d);
+}
+
+void presence_for_each(struct presence_dir *d, presence_visit_fn fn, void *arg) {
+    for (size_t i = next_occupied(d, 0); i <= d->mask; i = next_occupied(d, i + 1)) {
+        struct presence_slot copy;
+        if (read_slot(&d->slots[i], &copy) == SLOT_USED) {
+            struct presence_info info = { copy.shard, copy.busy };
+            fn(copy.name, &info, arg);
+        }
+    }
+}
+
+struct presence_feed *presence_feed_create(size_t slots) {
+    size_t cap = 1;
+    while (cap < slots) cap <<= 1;
+
+    size_t size = sizeof(struct presence_feed) + cap * sizeof(struct feed_slot);
+    struct presence_feed *f = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (f == MAP_FAILED) {
+        perror("mmap presence feed failed");
+        return NULL;
+    }
+    f->mask = cap - 1;
+    if (init_shared_mutex(&f->lock) != 0) {
+        fprintf(stderr, "[PRESENCE] Cannot create shared locks\n");
+        munmap(f, size);
+        return NULL;
+    }
+    return f;
+}
+
+uint32_t presence_feed_publish(struct presence_feed *f, int type, const char *name) {
+    if (pthread_mutex_lock(&f->lock) == EOWNERDEAD) {
+        // The last publisher died mid-event: mark it lost, so readers that
+        // reach it start over from a snapshot instead of waiting on it
+        struct feed_slot *s = &f->slots[f->head & f->mask];
+        if (f->head && __atomic_load_n(&s->version, __ATOMIC_RELAXED) != f->head) {
+            s->type = 0;
+            __atomic_store_n(&s->version, f->head, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_consistent(&f->lock);
+    }
+    uint32_t v = f->head + 1;
+    struct feed_slot *s = &f->slots[v & f->mask];
+
+    // Readers treat version 0 as "not there yet" while the slot is rewritten
+    __atomic_store_n(&s->version, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&f->head, v, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    s->type = type;
+    strncpy(s->name, name, sizeof(s->name) - 1);
+    s->name[sizeof(s->name) - 1] = '\0';
+    __atomic_store_n(&s->version, v, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&f->lock);
+    return v;
+}
+
+uint32_t presence_feed_version(struct presence_feed *f) {
+    return __atomic_load_n(&f->head, __ATOMIC_ACQUIRE);
+}
+
+int presence_feed_read(struct presence_feed *f, uint32_t version, struct presence_event *out) {
+    struct feed_slot *s = &f->slots[version & f->mask];
+
+    uint32_t v1 = __atomic_load_n(&s->version, __ATOMIC_ACQUIRE);
+    if (v1 != version) {
+        // Overwritten once the publisher has moved a full lap past it
+        uint32_t head = __atomic_load_n(&f->head, __ATOMIC_ACQUIRE);
+        return (int32_t)(head - version) > (int32_t)f->mask ? -1 : 1;
+    }
+
+    out->version = version;
+    out->type = s->type;
+    memcpy(out->name, s->name, sizeof(out->name));
+    out->name[sizeof(out->name) - 1] = '\0';
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->version, __ATOMIC_RELAXED) != version) return -1;
+    return out->type == 0 ? -1 : 0;  // Lost with its publisher
+}
@@ -0,0 +1,315 @@
+#include "../include/protocol.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const struct {
+    int type;
+    const char *name;
+} commands[] = {
+    { CMD_INVITE, "INVITE" },
+    { CMD_ACCEPT, "ACCEPT" },
+    { CMD_DECLINE, "DECLINE" },
+    { CMD_LEADERBOARD, "LEADERBOARD" },
+    { CMD_QUIT, "QUIT" },
+    { CMD_MOVE, "MOVE" },
+    { CMD_LIST, "LIST" },
+    { CMD_PLAY_BOT, "PLAY_BOT" },
+    { CMD_SYNC, "SYNC" },
+    { CMD_RANK, "RANK" },
+    { CMD_REPLAY, "REPLAY" },
+    { CMD_WATCH, "WATCH" },
+    { CMD_UNWATCH, "UNWATCH" },
+    { CMD_QUICKMATCH, "QUICKMATCH" },
+    { CMD_CANCEL, "CANCEL" },
+    { CMD_RATING, "RATING" },
+};
+
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+// How a game that was not won on the board ended, by GAME_END_* reason
+static const char *end_reasons[] = { "", " (opponent timed out)", " (opponent left)" };
+
+// "alice bob" names X and O; returns the length of X's name
+static int split_names(const char *names, int n, const char **o, int *o_len) {
+    const char *space = memchr(names, ' ', n);
+    int x_len = space ? (int)(space - names) : n;
+    *o = space ? space + 1 : "";
+    *o_len = space ? n - x_len - 1 : 0;
+    return x_len;
+}
+
+// REPLAY_END and WATCH_END: winner, GAME_END_* reason, winner's name
+static int encode_result(const char *what, const char *p, int n, char *out, size_t cap) {
+    if (n == 0) return snprintf(out, cap, "%s\n", what);
+    if (n < 2) return -1;
+    int winner = (unsigned char)p[0];
+    const char *reason = (unsigned char)p[1] < 3 ? end_reasons[(unsigned char)p[1]] : "";
+    if (winner == 0) return snprintf(out, cap, "%s: DRAW\n", what);
+    return snprintf(out, cap, "%s: PLAYER_%d_WINS (%.*s wins%s)\n",
+                    what, winner, n - 2, p + 2, reason);
+}
+
+static size_t encode_frame(int type, const void *payload, size_t len, char *out, size_t cap) {
+    if (len > PROTO_MAX_PAYLOAD || PROTO_HEADER_SIZE + len > cap) return 0;
+
+    out[0] = (char)type;
+    out[1] = (char)(len >> 8);
+    out[2] = (char)(len & 0xff);
+    if (len > 0) memcpy(out + PROTO_HEADER_SIZE, payload, len);
+    return PROTO_HEADER_SIZE + len;
+}
+
+// Text form of a BOARD payload. The classic board keeps its original
+// drawing; larger boards get column letters and row numbers.
+static int encode_board(const char *p, int n, char *out, size_t cap) {
+    if (n < 2) return -1;
+    int rows = (unsigned char)p[0], cols = (unsigned char)p[1];
+    if (n != 2 + (rows * cols + 3) / 4) return -1;
+
+    char cell[BOARD_TEXT_MAX_CELLS];
+    static const char marks[4] = { ' ', 'X', 'O', '?' };
+    for (int i = 0; i < rows * cols && i < BOARD_TEXT_MAX_CELLS; i++) {
+        cell[i] = marks[(p[2 + i / 4] >> (6 - 2 * (i % 4))) & 3];
+    }
+    if (rows * cols > BOARD_TEXT_MAX_CELLS) return -1;
+
+    if (rows == 3 && cols == 3) {
+        return snprintf(out, cap,
+                        "BOARD:\n %c | %c | %c \n---+---+---\n %c | %c | %c \n"
+                        "---+---+---\n %c | %c | %c \n\n",
+                        cell[0], cell[1], cell[2], cell[3], cell[4],
+                        cell[5], cell[6], cell[7], cell[8]);
+    }
+
+    size_t len = snprintf(out, cap, "BOARD:\n   ");
+    for (int c = 0; c < cols && len < cap; c++) {
+        len += snprintf(out + len, cap - len, " %c", 'A' + c);
+    }
+    for (int r = 0; r < rows && len < cap; r++) {
+        len += snprintf(out + len, cap - len, "\n%3d", r + 1);
+        for (int c = 0; c < cols && len < cap; c++) {
+            char mark = cell[r * cols + c];
+            len += snprintf(out + len, cap - len, " %c", mark == ' ' ? '.' : mark);
+        }
+    }
+    if (len < cap) len += snprintf(out + len, cap - len, "\n\n");
+    return (int)len;
+}
+
+// The text rendering is exactly what the server sent before frames existed
+static int encode_text(int type, const char *p, int n, char *out, size_t cap) {
+    int num = n > 0 ? (unsigned char)p[0] : 0;
+    unsigned long version = n >= 4 ? proto_get_u32(p) : 0;
+
+    switch (type) {
+    case MSG_LOBBY:
+        if (n < 5) return -1;
+        if (p[4] & LOBBY_CONTINUED) {
+            return snprintf(out, cap, "LOBBY+ %lu:%.*s\n", version, n - 5, p + 5);
+        }
+        if (n == 5 && !(p[4] & LOBBY_MORE)) {
+            return snprintf(out, cap, "LOBBY %lu:No players available\n", version);
+        }
+        return snprintf(out, cap, "LOBBY %lu:%.*s\n", version, n - 5, p + 5);
+    case MSG_PLAYER_JOINED:
+    case MSG_PLAYER_LEFT:
+    case MSG_PLAYER_BUSY:
+    case MSG_PLAYER_AVAILABLE:
+        if (n < 4) return -1;
+        return snprintf(out, cap, "%s %lu %.*s\n",
+                        type == MSG_PLAYER_JOINED ? "PLAYER_JOINED" :
+                        type == MSG_PLAYER_LEFT ? "PLAYER_LEFT" :
+                        type == MSG_PLAYER_BUSY ? "PLAYER_BUSY" : "PLAYER_AVAILABLE",
+                        version, n - 4, p + 4);
+    case MSG_INVITE_FROM:
+        return snprintf(out, cap, "INVITE_FROM %.*s\n", n, p);
+    case MSG_INVITE_EXPIRED:
+        return snprintf(out, cap, "INVITE_EXPIRED to %.*s\n", n, p);
+    case MSG_INVITE_SENT:
+        return snprintf(out, cap, "INVITE_SENT to %.*s\n", n, p);
+    case MSG_INVITE_DECLINED_BY:
+        return snprintf(out, cap, "INVITE_DECLINED_BY %.*s\n", n, p);
+    case MSG_PLAYER_NOT_AVAILABLE:
+        return snprintf(out, cap, "PLAYER_NOT_AVAILABLE\n");
+    case MSG_GAME_START:
+        if (n >= 4 && !(p[1] == 3 && p[2] == 3 && p[3] == 3)) {
+            return snprintf(out, cap, "GAME_START: YOU_ARE_PLAYER_%d (%c) ON %dx%d, %d IN A ROW\n",
+                            num, num == 1 ? 'X' : 'O', p[1], p[2], p[3]);
+        }
+        return snprintf(out, cap, "GAME_START: YOU_ARE_PLAYER_%d (%c)\n",
+                        num, num == 1 ? 'X' : 'O');
+    case MSG_BOARD:
+        return encode_board(p, n, out, cap);
+    case MSG_YOUR_TURN:
+        return snprintf(out, cap, "YOUR_TURN\n");
+    case MSG_WAITING:
+        return snprintf(out, cap, "WAITING: Not your turn, wait for your opponent\n");
+    case MSG_INVALID_MOVE:
+        return snprintf(out, cap, "INVALID_MOVE: %.*s\n", n, p);
+    case MSG_MOVE_MADE: {
+        if (n < 7 || p[6] == 0) return -1;
+        int cell = ((unsigned char)p[2] << 8 | (unsigned char)p[3]) - 1;
+        int cols = (unsigned char)p[6];
+        if (p[5] == 3 && cols == 3) {
+            return snprintf(out, cap, "\nMOVE_MADE: %.*s played position %d\n",
+                            n - 7, p + 7, cell + 1);
+        }
+        return snprintf(out, cap, "\nMOVE_MADE: %.*s played %c%d\n",
+                        n - 7, p + 7, 'A' + cell % cols, cell / cols + 1);
+    }
+    case MSG_GAME_OVER:
+        if (num == 0) return snprintf(out, cap, "GAME_OVER: DRAW\n");
+        return snprintf(out, cap, "GAME_OVER: PLAYER_%d_WINS (%.*s wins!)\n",
+                        num, n - 1, p + 1);
+    case MSG_OPPONENT_TIMEOUT:
+        return snprintf(out, cap, "OPPONENT_TIMEOUT: %.*s failed to move in time. YOU_WIN!\n",
+                        n, p);
+    case MSG_TIMEOUT:
+        return snprintf(out, cap, "TIMEOUT: You failed to move in time. YOU_LOSE!\n");
+    case MSG_OPPONENT_DISCONNECTED:
+        return snprintf(out, cap, "OPPONENT_DISCONNECTED: %.*s left the game. YOU_WIN!\n",
+                        n, p);
+    case MSG_RETURN_TO_LOBBY:
+        return snprintf(out, cap, "RETURN_TO_LOBBY\n");
+    case MSG_LEADERBOARD:
+        return snprintf(out, cap, "%.*s", n, p);
+    case MSG_RANK: {
+        if (n < 20) return -1;
+        unsigned long w = proto_get_u32(p + 8), l = proto_get_u32(p + 12), d = proto_get_u32(p + 16);
+        return snprintf(out, cap, "RANK %.*s %lu of %lu | W:%3lu L:%3lu D:%3lu | Rate: %.1f%%\n",
+                        n - 20, p + 20, (unsigned long)proto_get_u32(p),
+                        (unsigned long)proto_get_u32(p + 4), w, l, d,
+                        w + l + d > 0 ? (double)w / (w + l + d) * 100 : 0.0);
+    }
+    case MSG_RATING:
+        if (n < 8) return -1;
+        return snprintf(out, cap, "RATING %.*s %d after %lu game%s\n", n - 8, p + 8,
+                        (int32_t)proto_get_u32(p), (unsigned long)proto_get_u32(p + 4),
+                        proto_get_u32(p + 4) == 1 ? "" : "s");
+    case MSG_GAME_RECORDED:
+        if (n < 4) return -1;
+        return snprintf(out, cap, "GAME_RECORDED %lu\n", version);
+    case MSG_REPLAY: {
+        if (n < 13) return -1;
+        time_t started = (time_t)proto_get_u32(p + 4);
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M UTC", gmtime(&started));
+        const char *o;
+        int o_len, x_len = split_names(p + 13, n - 13, &o, &o_len);
+        return snprintf(out, cap, "REPLAY %lu: %.*s (X) vs %.*s (O) on %dx%d, %d in a row, "
+                        "%d moves, %s\n", version, x_len, p + 13, o_len, o,
+                        p[8], p[9], p[10], (unsigned char)p[11] << 8 | (unsigned char)p[12], when);
+    }
+    case MSG_REPLAY_MOVE: {
+        if (n < 7 || p[6] == 0) return -1;
+        int seq = (unsigned char)p[0] << 8 | (unsigned char)p[1];
+        int cell = ((unsigned char)p[2] << 8 | (unsigned char)p[3]) - 1;
+        int cols = (unsigned char)p[6];
+        char mark = p[4] == 1 ? 'X' : 'O';
+        if (p[5] == 3 && cols == 3) {
+            return snprintf(out, cap, "REPLAY_MOVE %d: %c played position %d\n", seq, mark, cell + 1);
+        }
+        return snprintf(out, cap, "REPLAY_MOVE %d: %c played %c%d\n",
+                        seq, mark, 'A' + cell % cols, cell / cols + 1);
+    }
+    case MSG_REPLAY_END:
+        if (n < 2) return -1;
+        return encode_result("REPLAY_END", p, n, out, cap);
+    case MSG_WATCHING: {
+        if (n < 4) return -1;
+        const char *o;
+        int o_len, x_len = split_names(p + 4, n - 4, &o, &o_len);
+        return snprintf(out, cap, "WATCHING %.*s (X) vs %.*s (O) on %dx%d, %d in a row, "
+                        "%c to move\n", x_len, p + 4, o_len, o, p[0], p[1], p[2],
+                        p[3] == 1 ? 'X' : 'O');
+    }
+    case MSG_WATCH_END:
+        return encode_result("WATCH_END", p, n, out, cap);
+    case MSG_QUEUED:
+        if (n < 6) return -1;
+        return snprintf(out, cap, "QUEUED: %lu waiting, skill %d of %d\n",
+                        version, p[4] + 1, p[5]);
+    case MSG_MATCH_FOUND:
+        if (n < 4) return -1;
+        return snprintf(out, cap, "MATCH_FOUND %.*s after %.1f s\n",
+                        n - 4, p + 4, version / 1000.0);
+    case MSG_QUEUE_LEFT:
+        return snprintf(out, cap, "QUEUE_LEFT\n");
+    case MSG_GOODBYE:
+        return snprintf(out, cap, "GOODBYE\n");
+    case MSG_ERROR:
+        return snprintf(out, cap, "%.*s\n", n, p);
+    case CMD_MOVE:
+        if (n == 2) return snprintf(out, cap, "%c%d\n", 'A' + p[1] - 1, p[0]);
+        return snprintf(out, cap, "%d\n", num);
+    default:
+        for (size_t i = 0; i < COMMAND_COUNT; i++) {
+            if (commands[i].type != type) continue;
+            if (n == 0) return snprintf(out, cap, "%s\n", commands[i].name);
+            return snprintf(out, cap, "%s %.*s\n", commands[i].name, n, p);
+        }
+        return -1;
+    }
+}
+
+size_t proto_encode(int proto, int type, const void *payload, size_t len,
+                    char *out, size_t cap) {
+    if (proto == PROTO_BINARY) {
+        return encode_frame(type, payload, len, out, cap);
+    }
+    if (len > PROTO_MAX_PAYLOAD) return 0;
+
+    int n = encode_text(type, payload, (int)len, out, cap);
+    if (n < 0 || (size_t)n >= cap) return 0;
+    return n;
+}
+
+int proto_parse_frame(const char *buf, size_t len, int *type,
+                      const char **payload, size_t *plen) {
+    if (len < PROTO_HEADER_SIZE) return 0;
+
+    const unsigned char *h = (const unsigned char *)buf;
+    size_t n = ((size_t)h[1] << 8) | h[2];
+    if (h[0] == 0 || n > PROTO_MAX_PAYLOAD) return -1;
+    if (len < PROTO_HEADER_SIZE + n) return 0;
+
+    *type = h[0];
+    *payload = buf + PROTO_HEADER_SIZE;
+    *plen = n;
+    return (int)(PROTO_HEADER_SIZE + n);
+}
+
+int proto_parse_command(char *line, char **arg) {
+    size_t word = strcspn(line, " ");
+    char *rest = line + word;
+    while (*rest == ' ') rest++;
+    *arg = rest;
+
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        if (commands[i].type != CMD_MOVE && strlen(commands[i].name) == word &&
+            strncmp(line, commands[i].name, word) == 0) {
+            return commands[i].type;
+        }
+    }
+    return CMD_UNKNOWN;
+}
+
+const char *proto_command_name(int type) {
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        if (commands[i].type == type) return commands[i].name;
+    }
+    return "UNKNOWN";
+}
+
+void proto_put_u32(char *p, uint32_t v) {
+    p[0] = (char)(v >> 24);
+    p[1] = (char)(v >> 16);
+    p[2] = (char)(v >> 8);
+    p[3] = (char)v;
+}
+
+uint32_t proto_get_u32(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+    return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) | ((uint32_t)u[2] << 8) | u[3];
+}
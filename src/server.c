@@ -1,498 +1,2930 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <sched.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/prctl.h>
+#include <getopt.h>
+#include <time.h>
 #include "../include/database.h"
+#include "../include/gamelog.h"
+#include "../include/gametable.h"
+#include "../include/eventring.h"
+#include "../include/metrics.h"
 #include "../include/ipc.h"
+#include "../include/game.h"
+#include "../include/bot.h"
+#include "../include/presence.h"
+#include "../include/protocol.h"
+#include "../include/outq.h"
+#include "../include/timer.h"
 
 #define PORT 5555
-#define MAX_CLIENTS 20
 #define BUF_SIZE 1024
+#define MAX_EVENTS 256
+#define INITIAL_CONN_CAP 64
+#define INITIAL_HASH_BUCKETS 64
+#define GAME_SLOTS_PER_PAGE 1024
+#define DEFAULT_WORKERS 4
+#define MAX_WORKERS 256
+#define MAX_SHARDS 64
+#define PRESENCE_TICK_MS 50   // Presence changes are batched over this long
+#define LOBBY_CHUNK 1024      // Names per snapshot chunk, in bytes
+#define INVITE_TIMEOUT_SEC 60 // Unanswered invitations lapse after this long
+#define MAX_INVITES 4         // Outstanding invitations per player
+#define AUTH_TIMEOUT_SEC 10   // Time a new connection gets to send its credentials
+#define MAX_PENDING_AUTH 1024 // Connections waiting to authenticate, per shard
+#define WATCH_FLUSH_BATCH 256 // Spectator sockets written per pass of the event loop
+#define MATCH_BUCKETS 10      // Skill bands of the QUICKMATCH queue
+#define MATCH_BUCKET_WIDTH 100 // Rating points per band
+#define MATCH_TICK_MS 100     // The queue is paired in batches this often
+#define MATCH_WIDEN_MS 5000   // A waiting player's band widens by a bucket this often
+#define METRICS_CONNS 8       // Scrapes served at once, by shard 0
+#define ORPHAN_POLL_MS 1000   // Master checks on games that outlived their shard this often
+
+// How matches are hosted
+#define GAME_MODE_FORK 0    // fork + execl ./game_process per match
+#define GAME_MODE_INPROC 1  // state machine driven by this event loop
+#define GAME_MODE_POOL 2    // sockets handed to pre-forked game_process workers
+
+struct game_slot;
+
+struct client;
+
+// Spectators of one game. Allocated on the first WATCH and freed once the
+// game ends or its last spectator leaves.
+struct audience {
+    struct client *first;    // Linked through watch_prev/watch_next
+    int count;
+    struct game_slot *slot;  // Game hosted by this loop, or NULL
+    int match_id;            // Otherwise the match hosting it
+};
+
+// Connection states
+#define CLIENT_AUTH_PENDING 0  // Accepted; waiting for the LOGIN/REGISTER line
+#define CLIENT_ACTIVE 1        // Logged in and listed
+
+// Invitation a player has sent and not yet seen answered
+struct invite {
+    char to[64];            // Invited player, "" if the slot is free
+    struct board_shape shape;   // Board the game is played on if accepted
+    struct timer expiry;
+    struct client *from;
+};
 
 struct client {
     int fd;
+    int state;  // CLIENT_AUTH_PENDING or CLIENT_ACTIVE
+    struct timer auth_timer;  // Closes the connection if no credentials arrive
     char username[64];
     int in_game;  // 0 = in lobby, 1 = in game
-    pid_t game_pid;  // PID of game process if in_game == 1
+    int match_id;  // Match hosted by a game process or worker, -1 if none
+    struct game_slot *game;  // In-process game if in_game == 1 (inproc mode)
+    int player_no;  // 1 or 2 within the in-process game
+    int proto;  // PROTO_TEXT or PROTO_BINARY, chosen at login
+    char inbuf[BUF_SIZE];  // Partial command line or frame from the socket
+    size_t inlen;
+    long long read_us;  // When the last read from the socket returned, for move timing
+    struct outq out;  // Output the socket has not accepted yet
+    int closing;  // Dropped as a slow consumer; waiting for the EOF event
+    uint32_t lobby_version;  // Presence version the client's lobby view is at
+    struct invite invites[MAX_INVITES];
+    struct audience *watching;  // Game the client is spectating, NULL if none
+    struct client *watch_prev, *watch_next;  // The game's other spectators
+    int flush_queued;  // Has spectator output waiting for flush_spectators
+    struct client *flush_prev, *flush_next;
+    int queue_bucket;  // QUICKMATCH skill bucket, -1 if not queued
+    long long queued_at;  // When the client joined the queue, in ms
+    struct client *queue_prev, *queue_next;  // Same bucket, oldest first
+    struct client *hash_next;  // Username hash chain
+    struct client *prev, *next;  // List of all logged-in clients
+};
+
+// Match whose sockets were handed to a game process (fork mode) or a
+// pool worker. Ids index the match table and are reused via a free list.
+struct match {
+    pid_t pid;       // Per-match game_process (fork mode), 0 otherwise
+    int worker;      // Hosting pool worker, -1 in fork mode
+    int in_use;
+    int next_free;
+    struct client *players[2];
+    struct board board;          // As of the host's last watch_event
+    int table_slot;              // Live game table slot, -1 if unlisted
+    struct audience *audience;   // Spectators, NULL if none
+};
+
+// Datagram between shards, sent to the receiving shard's inbox socket
+#define SHARD_DELIVER 1        // Message for a player owned by the receiver
+#define SHARD_HANDOFF 2        // Player's socket (attached) moves to the receiver
+#define SHARD_LOBBY_CHANGED 3  // Presence feed has new changes to pass on
+#define SHARD_WATCH 4          // Spectator's socket (attached) moves to the receiver
+#define SHARD_QUEUE 5          // Player's socket (attached) moves to shard 0's QUICKMATCH queue
+
+struct shard_msg {
+    int type;
+    char from[64];          // HANDOFF: player whose socket is attached
+    char to[64];            // DELIVER: recipient; HANDOFF: opponent to start a game with;
+                            // WATCH: player whose game to watch
+    int msg_type;           // DELIVER: MSG_* type of the payload in text
+    int proto;              // HANDOFF, WATCH: wire format of the attached client
+    int textlen;            // Bytes used in text; the datagram ends there
+    int outlen;             // HANDOFF, WATCH: queued output following the input in text
+    char text[BUF_SIZE + OUTQ_LIMIT];  // DELIVER: payload; HANDOFF, WATCH: unread input + output
+};
+
+// Long-lived game_process hosting many matches
+struct worker {
+    pid_t pid;
+    int fd;          // Server end of the control socketpair
+    int load;        // Matches currently hosted
 };
 
-struct client clients[MAX_CLIENTS];
-int client_count = 0;
-int listen_fd;
-int msg_queue_id;
+// Players waiting in one skill band of the QUICKMATCH queue
+struct match_bucket {
+    struct client *head, *tail;
+    int count;
+};
+
+// In-process game; slots live in fixed pages so pointers stay valid
+struct game_slot {
+    struct game g;  // Must stay first: the send callback casts back from it
+    struct client *players[2];
+    struct audience *audience;  // Spectators, NULL if none
+    struct game_slot *next_free;
+};
+
+// Connection table indexed by fd, grown on demand
+struct client **conns = NULL;
+int conn_cap = 0;
+
+// Username -> client hash (chained, power-of-two buckets)
+struct client **name_buckets = NULL;
+size_t name_bucket_count = 0;
+
+// All logged-in clients, for lobby broadcasts and shutdown
+struct client *client_list = NULL;
+int client_count = 0;
+int pending_auth = 0;  // Connections in CLIENT_AUTH_PENDING
+
+struct match *matches = NULL;
+int match_cap = 0;
+int free_match = -1;
+
+struct worker workers[MAX_WORKERS];
+int worker_count = DEFAULT_WORKERS;
+
+struct game_slot **game_pages = NULL;
+int game_page_count = 0;
+struct game_slot *free_games = NULL;
+int live_games = 0;
+int game_mode = GAME_MODE_FORK;
+
+// A scrape in progress on the metrics socket
+struct metrics_conn {
+    int fd;                 // -1 if the slot is free
+    int replied;            // The reply is written or queued in 'out'
+    struct outq out;
+};
+
+int listen_fd = -1;
+int metrics_fd = -1;                     // Shard 0: Prometheus scrapes on METRICS_SOCKET
+struct metrics_conn metrics_conns[METRICS_CONNS];
+int epoll_fd = -1;
+int game_events[2] = { -1, -1 };         // Fork mode: game processes send on [0], read on [1]
+int signal_fd = -1;
+sigset_t blocked_signals;
+
+// The one process that commits results to the stats store
+pid_t stats_writer_pid = -1;
+int stats_fsync = 0;                     // fdatasync the journal after every batch
+
+// Sharding (--shards N > 1): N reactor processes with SO_REUSEPORT listeners
+int shard_count = 1;
+int shard_index = 0;
+struct presence_dir *directory = NULL;   // Shared presence, NULL when unsharded
+int shard_inbox[MAX_SHARDS][2];          // [k][0] send end, [k][1] shard k reads
+pid_t shard_pids[MAX_SHARDS];
+int peers_dirty = 0;                     // Tell other shards the lobby changed
+
+// Presence changes, shared with the other shards when sharded
+struct presence_feed *feed = NULL;
+uint32_t feed_seen = 0;                  // Last change passed on to lobby clients
+struct timer presence_timer;             // Pending changes are passed on when it fires
+
+// Turn deadlines, invitation expiries and batching delays for this shard
+struct timer_wheel timers;
+
+// Spectators with queued output, written WATCH_FLUSH_BATCH at a time
+struct client *flush_head = NULL, *flush_tail = NULL;
+
+// QUICKMATCH queue, one FIFO per skill bucket; held by shard 0 when sharded
+struct match_bucket match_queue[MATCH_BUCKETS];
+int queued_players = 0;
+struct timer match_timer;                // Pairs the queue while anyone is waiting
+
+void send_lobby(struct client *c);
+
+// Drop a client whose output backlog overflowed or whose socket failed.
+// The shutdown shows up as EOF in the event loop, which removes it.
+static void evict_client(struct client *c, const char *reason) {
+    if (c->closing) return;
+    printf("[SERVER] Dropping client '%s': %s (%zu bytes queued)\n",
+           c->username, reason, outq_pending(&c->out));
+    c->closing = 1;
+    outq_clear(&c->out);
+    shutdown(c->fd, SHUT_RDWR);
+}
+
+// Never blocks: what the socket does not take waits in the client's queue
+void client_write(struct client *c, const void *data, size_t len) {
+    if (c->closing) return;
+    if (outq_write(&c->out, c->fd, data, len) == -1) {
+        evict_client(c, outq_pending(&c->out) + len > OUTQ_LIMIT ? "output backlog over limit" :
+                        "send failed");
+    }
+}
+
+void flush_client(struct client *c) {
+    if (outq_pending(&c->out) > 0 && outq_flush(&c->out, c->fd) == -1) {
+        evict_client(c, "send failed");
+    }
+}
+
+// Encode a message in the client's wire format and send it
+void send_msg(struct client *c, int type, const void *payload, size_t len) {
+    char buf[PROTO_MAX_FRAME];
+    size_t n = proto_encode(c->proto, type, payload, len, buf, sizeof(buf));
+    if (n > 0) {
+        client_write(c, buf, n);
+    }
+}
+
+void send_error(struct client *c, const char *keyword) {
+    send_msg(c, MSG_ERROR, keyword, strlen(keyword));
+}
+
+static unsigned long hash_name(const char *s) {
+    // FNV-1a
+    unsigned long h = 2166136261UL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+static void name_table_insert(struct client *c) {
+    if ((size_t)client_count >= name_bucket_count) {
+        // Keep load factor <= 1 by doubling and rehashing
+        size_t new_count = name_bucket_count ? name_bucket_count * 2 : INITIAL_HASH_BUCKETS;
+        struct client **nb = calloc(new_count, sizeof(*nb));
+        if (nb) {
+            for (size_t b = 0; b < name_bucket_count; b++) {
+                struct client *e = name_buckets[b];
+                while (e) {
+                    struct client *next = e->hash_next;
+                    size_t nbkt = hash_name(e->username) & (new_count - 1);
+                    e->hash_next = nb[nbkt];
+                    nb[nbkt] = e;
+                    e = next;
+                }
+            }
+            free(name_buckets);
+            name_buckets = nb;
+            name_bucket_count = new_count;
+        } else if (name_bucket_count == 0) {
+            perror("calloc name table failed");
+            exit(1);
+        }
+    }
+
+    size_t b = hash_name(c->username) & (name_bucket_count - 1);
+    c->hash_next = name_buckets[b];
+    name_buckets[b] = c;
+}
+
+static void name_table_remove(struct client *c) {
+    if (name_bucket_count == 0) return;
+
+    struct client **pp = &name_buckets[hash_name(c->username) & (name_bucket_count - 1)];
+    while (*pp) {
+        if (*pp == c) {
+            *pp = c->hash_next;
+            return;
+        }
+        pp = &(*pp)->hash_next;
+    }
+}
+
+struct client *find_client(const char *user) {
+    if (name_bucket_count == 0) return NULL;
+
+    struct client *c = name_buckets[hash_name(user) & (name_bucket_count - 1)];
+    for (; c; c = c->hash_next) {
+        if (strcmp(c->username, user) == 0) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static int conn_table_reserve(int fd) {
+    if (fd < conn_cap) return 0;
+
+    int new_cap = conn_cap ? conn_cap : INITIAL_CONN_CAP;
+    while (new_cap <= fd) new_cap *= 2;
+
+    struct client **nc = realloc(conns, new_cap * sizeof(*nc));
+    if (!nc) {
+        perror("realloc connection table failed");
+        return -1;
+    }
+    memset(nc + conn_cap, 0, (new_cap - conn_cap) * sizeof(*nc));
+    conns = nc;
+    conn_cap = new_cap;
+    return 0;
+}
+
+static int set_nonblocking(int fd, int on) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) return -1;
+    flags = on ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(fd, F_SETFL, flags);
+}
+
+static int watch_client(struct client *c) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = c->fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) == -1) {
+        perror("epoll_ctl add client failed");
+        return -1;
+    }
+    return 0;
+}
+
+static void unwatch_client(struct client *c) {
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL) == -1) {
+        perror("epoll_ctl del client failed");
+    }
+}
+
+// Record a change for every lobby, here and on the other shards.
+// The state snapshots are built from must already reflect it.
+static void publish_presence(int type, const char *user) {
+    presence_feed_publish(feed, type, user);
+    peers_dirty = 1;
+}
+
+static void clear_invites(struct client *c) {
+    for (int i = 0; i < MAX_INVITES; i++) {
+        timer_cancel(&timers, &c->invites[i].expiry);
+        c->invites[i].to[0] = '\0';
+    }
+}
+
+static void invite_expired(void *arg) {
+    struct invite *inv = arg;
+    printf("[SERVER] Invitation from '%s' to '%s' expired\n", inv->from->username, inv->to);
+    metrics_count(METRIC_INVITE_TIMEOUTS);
+    send_msg(inv->from, MSG_INVITE_EXPIRED, inv->to, strlen(inv->to));
+    inv->to[0] = '\0';
+}
+
+// Record an invitation; a repeat refreshes it, and when all slots are
+// taken the one closest to lapsing makes way
+static void add_invite(struct client *c, const char *to, struct board_shape shape) {
+    struct invite *slot = NULL;
+    for (int i = 0; i < MAX_INVITES && !slot; i++) {
+        if (strcmp(c->invites[i].to, to) == 0) slot = &c->invites[i];
+    }
+    for (int i = 0; i < MAX_INVITES && !slot; i++) {
+        if (c->invites[i].to[0] == '\0') slot = &c->invites[i];
+    }
+    if (!slot) {
+        slot = &c->invites[0];
+        for (int i = 1; i < MAX_INVITES; i++) {
+            if (c->invites[i].expiry.expires < slot->expiry.expires) slot = &c->invites[i];
+        }
+    }
+
+    strncpy(slot->to, to, sizeof(slot->to) - 1);
+    slot->to[sizeof(slot->to) - 1] = '\0';
+    slot->shape = shape;
+    timer_arm(&timers, &slot->expiry, INVITE_TIMEOUT_SEC * 1000);
+}
+
+static struct invite *find_invite(struct client *c, const char *to) {
+    for (int i = 0; i < MAX_INVITES; i++) {
+        if (c->invites[i].to[0] && strcmp(c->invites[i].to, to) == 0) return &c->invites[i];
+    }
+    return NULL;
+}
+
+// Spectator output is queued on the spot and written a slice at a time
+// by the event loop, so a crowd never holds up the players' next move
+static void queue_flush(struct client *c) {
+    if (c->flush_queued) return;
+    c->flush_queued = 1;
+    c->flush_next = NULL;
+    c->flush_prev = flush_tail;
+    if (flush_tail) flush_tail->flush_next = c;
+    else flush_head = c;
+    flush_tail = c;
+}
+
+static void unqueue_flush(struct client *c) {
+    if (!c->flush_queued) return;
+    if (c->flush_prev) c->flush_prev->flush_next = c->flush_next;
+    else flush_head = c->flush_next;
+    if (c->flush_next) c->flush_next->flush_prev = c->flush_prev;
+    else flush_tail = c->flush_prev;
+    c->flush_queued = 0;
+}
+
+// Whatever a socket does not take now goes out on its EPOLLOUT
+void flush_spectators() {
+    for (int i = 0; i < WATCH_FLUSH_BATCH && flush_head; i++) {
+        struct client *c = flush_head;
+        unqueue_flush(c);
+        flush_client(c);
+    }
+}
+
+// Board, players and player to move of the game an audience watches
+static const struct board *watched_game(struct audience *a, const char *names[2], int *turn) {
+    if (a->slot) {
+        names[0] = a->slot->g.user[0];
+        names[1] = a->slot->g.user[1];
+        *turn = a->slot->g.turn;
+        return &a->slot->g.board;
+    }
+    struct match *m = &matches[a->match_id];
+    names[0] = m->players[0]->username;
+    names[1] = m->players[1]->username;
+    *turn = board_count(&m->board) % 2 + 1;  // X moves first
+    return &m->board;
+}
+
+// WATCHING and a BOARD, for a new spectator or one that lost step
+static void send_watch_snapshot(struct client *c) {
+    const char *names[2];
+    int turn;
+    const struct board *b = watched_game(c->watching, names, &turn);
+
+    char head[4 + 2 * 64];
+    head[0] = (char)b->shape.rows;
+    head[1] = (char)b->shape.cols;
+    head[2] = (char)b->shape.k;
+    head[3] = (char)turn;
+    int len = snprintf(head + 4, sizeof(head) - 4, "%s %s", names[0], names[1]);
+    send_msg(c, MSG_WATCHING, head, 4 + len);
+
+    char encoded[BOARD_ENCODED_MAX];
+    send_msg(c, MSG_BOARD, encoded, board_encode(b, encoded));
+}
+
+// Queue one update to every spectator. It is encoded once per wire format,
+// and each spectator's queue takes a reference to those bytes, not a copy.
+// Text spectators get the board redrawn after a move, as players do.
+static void send_to_audience(struct audience *a, const struct board *b, int type,
+                             const void *payload, size_t len) {
+    struct outq_shared *msgs[2] = { NULL, NULL };
+
+    for (struct client *c = a->first; c; c = c->watch_next) {
+        if (c->closing) continue;
+        if (!msgs[c->proto]) {
+            char buf[2 * PROTO_MAX_FRAME];
+            size_t n = proto_encode(c->proto, type, payload, len, buf, PROTO_MAX_FRAME);
+            if (type == MSG_MOVE_MADE && c->proto == PROTO_TEXT) {
+                char encoded[BOARD_ENCODED_MAX];
+                n += proto_encode(PROTO_TEXT, MSG_BOARD, encoded, board_encode(b, encoded),
+                                  buf + n, PROTO_MAX_FRAME);
+            }
+            if (n == 0 || !(msgs[c->proto] = outq_shared_new(buf, n))) continue;
+        }
+        if (outq_append_shared(&c->out, msgs[c->proto]) == -1) {
+            evict_client(c, "output backlog over limit");
+        } else {
+            queue_flush(c);
+        }
+    }
+    outq_shared_put(msgs[0]);
+    outq_shared_put(msgs[1]);
+}
+
+// A move in a watched game, as the MOVE_MADE delta the players got
+static void watch_move(struct audience *a, int player, int cell) {
+    const char *names[2];
+    int turn;
+    const struct board *b = watched_game(a, names, &turn);
+
+    char payload[GAME_MOVE_MAX];
+    size_t len = game_encode_move(payload, b, player, cell, names[player - 1]);
+    send_to_audience(a, b, MSG_MOVE_MADE, payload, len);
+}
+
+static void free_audience(struct audience *a) {
+    if (a->slot) a->slot->audience = NULL;
+    else matches[a->match_id].audience = NULL;
+    free(a);
+}
+
+// The game is over: send the result and let the spectators go.
+// A 'winner' of -1 means the result never arrived.
+static void close_audience(struct audience *a, int winner, int end) {
+    const char *names[2];
+    int turn;
+    const struct board *b = watched_game(a, names, &turn);
+
+    char payload[2 + 64];
+    size_t len = 0;
+    if (winner >= 0) {
+        const char *name = winner ? names[winner - 1] : "";
+        len = strlen(name);
+        payload[0] = (char)winner;
+        payload[1] = (char)end;
+        memcpy(payload + 2, name, len);
+        len += 2;
+    }
+    send_to_audience(a, b, MSG_WATCH_END, payload, len);
+
+    struct client *c = a->first;
+    while (c) {
+        struct client *next = c->watch_next;
+        c->watching = NULL;
+        c->watch_prev = c->watch_next = NULL;
+        c = next;
+    }
+    printf("[SERVER] %s vs %s ended with %d watching\n", names[0], names[1], a->count);
+    free_audience(a);
+}
+
+static void stop_watching(struct client *c) {
+    struct audience *a = c->watching;
+    if (!a) return;
+
+    if (c->watch_prev) c->watch_prev->watch_next = c->watch_next;
+    else a->first = c->watch_next;
+    if (c->watch_next) c->watch_next->watch_prev = c->watch_prev;
+    c->watching = NULL;
+    c->watch_prev = c->watch_next = NULL;
+    if (--a->count == 0) free_audience(a);
+}
+
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// Matchmaking skill: the player's rating in MATCH_BUCKET_WIDTH bands, with
+// newcomers' RATING_INITIAL in the middle one
+static int skill_bucket(const char *user) {
+    struct user_stats st;
+    get_user_stats(user, &st);
+    int above = st.rating - (RATING_INITIAL - MATCH_BUCKETS / 2 * MATCH_BUCKET_WIDTH);
+    int bucket = above < 0 ? 0 : above / MATCH_BUCKET_WIDTH;
+    return bucket < MATCH_BUCKETS ? bucket : MATCH_BUCKETS - 1;
+}
+
+static void send_queued(struct client *c) {
+    char payload[6];
+    proto_put_u32(payload, queued_players);
+    payload[4] = (char)c->queue_bucket;
+    payload[5] = MATCH_BUCKETS;
+    send_msg(c, MSG_QUEUED, payload, sizeof(payload));
+}
+
+static void join_queue(struct client *c) {
+    if (c->queue_bucket != -1) {
+        send_queued(c);
+        return;
+    }
+
+    struct match_bucket *b = &match_queue[skill_bucket(c->username)];
+    c->queue_bucket = (int)(b - match_queue);
+    c->queued_at = now_ms();
+    c->queue_prev = b->tail;
+    c->queue_next = NULL;
+    if (b->tail) b->tail->queue_next = c;
+    else b->head = c;
+    b->tail = c;
+    b->count++;
+    queued_players++;
+
+    if (!timer_pending(&match_timer)) timer_arm(&timers, &match_timer, MATCH_TICK_MS);
+    printf("[SERVER] '%s' queued for a quick match (skill %d, %d waiting)\n",
+           c->username, c->queue_bucket + 1, queued_players);
+    send_queued(c);
+}
+
+static void leave_queue(struct client *c) {
+    if (c->queue_bucket == -1) return;
+
+    struct match_bucket *b = &match_queue[c->queue_bucket];
+    if (c->queue_prev) c->queue_prev->queue_next = c->queue_next;
+    else b->head = c->queue_next;
+    if (c->queue_next) c->queue_next->queue_prev = c->queue_prev;
+    else b->tail = c->queue_prev;
+    b->count--;
+    queued_players--;
+    c->queue_bucket = -1;
+    c->queue_prev = c->queue_next = NULL;
+}
+
+static void set_in_game(struct client *c, int in_game) {
+    if (c->in_game != in_game) {
+        metrics_gauge_add(METRIC_LOBBY, in_game ? -1 : 1);
+    }
+    c->in_game = in_game;
+    if (in_game) {
+        clear_invites(c);  // Nobody can join a player who is busy
+        stop_watching(c);
+        leave_queue(c);
+    }
+    if (directory) {
+        presence_update(directory, c->username, shard_index, in_game);
+    }
+    publish_presence(in_game ? PRESENCE_BUSY : PRESENCE_AVAILABLE, c->username);
+}
+
+static int alloc_match() {
+    if (free_match == -1) {
+        int new_cap = match_cap ? match_cap * 2 : 16;
+        struct match *nm = realloc(matches, new_cap * sizeof(*nm));
+        if (!nm) {
+            perror("realloc match table failed");
+            return -1;
+        }
+        matches = nm;
+        for (int i = new_cap - 1; i >= match_cap; i--) {
+            matches[i].in_use = 0;
+            matches[i].next_free = free_match;
+            free_match = i;
+        }
+        match_cap = new_cap;
+    }
+
+    int id = free_match;
+    free_match = matches[id].next_free;
+    matches[id].in_use = 1;
+    matches[id].pid = 0;
+    matches[id].worker = -1;
+    matches[id].audience = NULL;
+    matches[id].table_slot = -1;
+    return id;
+}
+
+static void release_match(int id) {
+    matches[id].in_use = 0;
+    matches[id].next_free = free_match;
+    free_match = id;
+}
+
+void end_match(int id) {
+    // Return both players of a finished match to the lobby
+    struct match *m = &matches[id];
+
+    for (int p = 0; p < 2; p++) {
+        struct client *c = m->players[p];
+        if (m->pid > 0) {
+            printf("[SERVER] Returning '%s' to lobby after game (PID %d)\n",
+                   c->username, m->pid);
+        } else {
+            printf("[SERVER] Returning '%s' to lobby after game (worker %d)\n",
+                   c->username, m->worker);
+        }
+        set_in_game(c, 0);
+        c->match_id = -1;
+        c->inlen = 0;
+        set_nonblocking(c->fd, 1);
+        send_msg(c, MSG_RETURN_TO_LOBBY, NULL, 0);
+        send_lobby(c);
+        // Re-arm; a disconnect during the game shows up as EOF here
+        watch_client(c);
+    }
+
+    if (m->audience) {
+        close_audience(m->audience, -1, 0);  // The host went without a result
+    }
+    if (m->worker >= 0) {
+        workers[m->worker].load--;
+    }
+    gametable_release(m->table_slot);
+    release_match(id);
+    metrics_count(METRIC_GAMES_FINISHED);
+    metrics_gauge_add(METRIC_LIVE_GAMES, -1);
+}
+
+// A move or result reported by the process hosting a match
+static void handle_watch_event(const struct watch_event *ev) {
+    struct match *m = &matches[ev->game_id];
+
+    if (ev->event == WATCH_MOVE) {
+        size_t len = 2 + (m->board.shape.rows * m->board.shape.cols + 3) / 4;
+        if (board_decode(&m->board, ev->board, len) == -1) return;
+        if (m->audience && (ev->player == 1 || ev->player == 2) &&
+            ev->cell >= 1 && ev->cell <= board_cells(&m->board)) {
+            watch_move(m->audience, ev->player, ev->cell);
+        }
+    } else if (ev->event == WATCH_END && m->audience) {
+        close_audience(m->audience, ev->player == 1 || ev->player == 2 ? ev->player : 0, ev->end);
+    }
+}
+
+// Events from fork-mode game processes
+void handle_game_events() {
+    struct watch_event ev;
+
+    while (1) {
+        ssize_t bytes = recv(game_events[1], &ev, sizeof(ev), MSG_DONTWAIT);
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes <= 0) return;
+        if (bytes == sizeof(ev) && ev.type == WORKER_WATCH && ev.game_id >= 0 &&
+            ev.game_id < match_cap && matches[ev.game_id].in_use && matches[ev.game_id].pid > 0) {
+            handle_watch_event(&ev);
+        }
+    }
+}
+
+void return_players_to_lobby(pid_t game_pid) {
+    // Its last events are queued by now; pass them on before the match goes
+    if (game_events[1] != -1) {
+        handle_game_events();
+    }
+
+    // Find the match for this game process and return both players to lobby
+    for (int id = 0; id < match_cap; id++) {
+        if (matches[id].in_use && matches[id].pid == game_pid) {
+            end_match(id);
+            break;
+        }
+    }
+}
+
+int spawn_worker(int idx) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror("socketpair failed");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Child: keep only the worker end of the channel across exec
+        fcntl(sv[1], F_SETFD, 0);
+        sigprocmask(SIG_UNBLOCK, &blocked_signals, NULL);
+
+        char fd_str[16], idx_str[16];
+        snprintf(fd_str, sizeof(fd_str), "%d", sv[1]);
+        snprintf(idx_str, sizeof(idx_str), "%d", idx);
+        execl("./game_process", "game_process", "--worker", fd_str, idx_str, NULL);
+        perror("execl failed");
+        exit(1);
+    } else if (pid == -1) {
+        perror("fork failed");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    close(sv[1]);
+    set_nonblocking(sv[0], 1);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = sv[0];
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sv[0], &ev) == -1) {
+        perror("epoll_ctl add worker failed");
+    }
+
+    workers[idx].pid = pid;
+    workers[idx].fd = sv[0];
+    workers[idx].load = 0;
+    printf("[SERVER] Game worker %d started (PID %d)\n", idx, pid);
+    return 0;
+}
+
+int find_worker_by_fd(int fd) {
+    for (int w = 0; w < worker_count; w++) {
+        if (workers[w].fd == fd) return w;
+    }
+    return -1;
+}
+
+void handle_worker_exit(int w) {
+    printf("[SERVER] Game worker %d (PID %d) exited, respawning\n", w, workers[w].pid);
+    close(workers[w].fd);
+    workers[w].fd = -1;
+    workers[w].pid = 0;
+
+    // Its matches are gone; put the players back in the lobby
+    for (int id = 0; id < match_cap; id++) {
+        if (matches[id].in_use && matches[id].worker == w) {
+            end_match(id);
+        }
+    }
+
+    spawn_worker(w);
+}
+
+void handle_worker_messages(int w) {
+    static char buf[WORKER_MSG_MAX];
+    struct worker_msg msg;
+    int fds[2], nfds;
+
+    while (1) {
+        ssize_t bytes = recv_with_fds(workers[w].fd, buf, sizeof(buf), fds, 2, &nfds);
+        for (int i = 0; i < nfds; i++) close(fds[i]);  // Workers never send sockets back
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes <= 0) return;  // Drained, or worker gone (handled on SIGCHLD)
+        if ((size_t)bytes == sizeof(struct watch_event)) {
+            struct watch_event ev;
+            memcpy(&ev, buf, sizeof(ev));
+            if (ev.type == WORKER_WATCH && ev.game_id >= 0 && ev.game_id < match_cap &&
+                matches[ev.game_id].in_use && matches[ev.game_id].worker == w) {
+                handle_watch_event(&ev);
+            }
+            continue;
+        }
+        if ((size_t)bytes < sizeof(msg)) continue;
+        memcpy(&msg, buf, sizeof(msg));
+
+        if (msg.type == WORKER_GAME_DONE && msg.game_id >= 0 && msg.game_id < match_cap &&
+            matches[msg.game_id].in_use && matches[msg.game_id].worker == w &&
+            msg.pending[0] >= 0 && msg.pending[1] >= 0 &&
+            sizeof(msg) + msg.pending[0] + msg.pending[1] == (size_t)bytes) {
+            // Output the worker could not deliver goes out ahead of the lobby;
+            // re-arming the sockets in end_match triggers the flush
+            outq_append(&matches[msg.game_id].players[0]->out, buf + sizeof(msg), msg.pending[0]);
+            outq_append(&matches[msg.game_id].players[1]->out,
+                        buf + sizeof(msg) + msg.pending[0], msg.pending[1]);
+            end_match(msg.game_id);
+        }
+    }
+}
+
+// Started by the process that owns the shards (or the only shard), with
+// the signal mask still blocked so it finishes its queue on SIGTERM
+void spawn_stats_writer() {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        execl("./game_process", "game_process", "--stats-writer",
+              stats_fsync ? "fsync" : "nosync", NULL);
+        perror("execl stats writer failed");
+        exit(1);
+    } else if (pid == -1) {
+        perror("fork stats writer failed");
+    } else {
+        stats_writer_pid = pid;
+    }
+}
+
+void reap_children() {
+    // Reap all terminated child processes
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        metrics_reap(pid);
+        if (pid == stats_writer_pid) {
+            // Queued results wait in stats.bin for the new writer
+            printf("[SERVER] Stats writer (PID %d) exited, respawning\n", pid);
+            spawn_stats_writer();
+            continue;
+        }
+        int w;
+        for (w = 0; w < worker_count; w++) {
+            if (workers[w].pid == pid) break;
+        }
+        if (game_mode == GAME_MODE_POOL && w < worker_count) {
+            handle_worker_exit(w);
+            continue;
+        }
+
+        printf("[SERVER] Game process %d terminated\n", pid);
+        // Return players from this game to lobby
+        return_players_to_lobby(pid);
+    }
+}
+
+void remove_ipc_resources() {
+    eventring_remove();
+    gametable_remove();
+    metrics_remove();
+    unlink(METRICS_SOCKET);
+}
+
+void cleanup_resources() {
+    printf("[SERVER] Cleaning up resources...\n");
+
+    // Close all client connections
+    for (struct client *c = client_list; c; c = c->next) {
+        close(c->fd);
+    }
+
+    // Workers exit when their control channel closes
+    for (int w = 0; w < worker_count; w++) {
+        if (workers[w].pid > 0) {
+            close(workers[w].fd);
+        }
+    }
+
+    // Close listening sockets and event sources
+    if (listen_fd != -1) {
+        close(listen_fd);
+    }
+    if (metrics_fd != -1) {
+        close(metrics_fd);
+        for (int i = 0; i < METRICS_CONNS; i++) {
+            if (metrics_conns[i].fd != -1) {
+                close(metrics_conns[i].fd);
+                outq_clear(&metrics_conns[i].out);
+            }
+        }
+    }
+    if (signal_fd != -1) {
+        close(signal_fd);
+    }
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+    }
+
+    // Shared IPC belongs to the master when sharded
+    if (shard_count == 1) {
+        remove_ipc_resources();
+    }
+
+    printf("[SERVER] Cleanup complete. Exiting.\n");
+}
+
+void handle_signals() {
+    struct signalfd_siginfo si;
+
+    while (read(signal_fd, &si, sizeof(si)) == sizeof(si)) {
+        if (si.ssi_signo == SIGCHLD) {
+            reap_children();
+        } else if (si.ssi_signo == SIGINT || si.ssi_signo == SIGTERM) {
+            printf("\n[SERVER] Received %s. Shutting down...\n",
+                   si.ssi_signo == SIGINT ? "SIGINT" : "SIGTERM");
+            cleanup_resources();
+            exit(0);
+        }
+    }
+}
+
+// Snapshot of the available players, sent in LOBBY_CHUNK sized pieces
+struct lobby_walk {
+    struct client *c;
+    uint32_t version;
+    int chunks;
+    size_t len;
+    char payload[5 + LOBBY_CHUNK];  // Version, flags, names
+};
+
+static void send_lobby_chunk(struct lobby_walk *walk, int more) {
+    proto_put_u32(walk->payload, walk->version);
+    walk->payload[4] = (walk->chunks > 0 ? LOBBY_CONTINUED : 0) | (more ? LOBBY_MORE : 0);
+    send_msg(walk->c, MSG_LOBBY, walk->payload, 5 + walk->len);
+    walk->chunks++;
+    walk->len = 0;
+}
+
+static void add_lobby_name(struct lobby_walk *walk, const char *name) {
+    size_t n = strlen(name);
+    if (walk->len + n + 1 > LOBBY_CHUNK) {
+        send_lobby_chunk(walk, 1);
+    }
+    if (walk->len > 0) walk->payload[5 + walk->len++] = ',';
+    memcpy(walk->payload + 5 + walk->len, name, n);
+    walk->len += n;
+}
+
+static void visit_presence(const char *name, const struct presence_info *info, void *arg) {
+    if (!info->busy) {
+        add_lobby_name(arg, name);
+    }
+}
+
+// Full list of available players, as of the current presence version.
+// Only sent on login, on LIST and on return from a game; the lobby is kept
+// current with deltas after that.
+void send_lobby(struct client *c) {
+    static struct lobby_walk walk;
+
+    // Read the version first: changes after it may or may not be in the
+    // walk, and replaying them on top is harmless
+    walk.c = c;
+    walk.version = presence_feed_version(feed);
+    walk.chunks = 0;
+    walk.len = 0;
+    if (directory) {
+        // Every shard's available players
+        presence_for_each(directory, visit_presence, &walk);
+    } else {
+        for (struct client *e = client_list; e; e = e->next) {
+            if (e->in_game == 0) {  // Only show available players
+                add_lobby_name(&walk, e->username);
+            }
+        }
+    }
+    send_lobby_chunk(&walk, 0);
+    c->lobby_version = walk.version;
+}
+
+static const int presence_msg_types[] = {
+    [PRESENCE_JOINED] = MSG_PLAYER_JOINED,
+    [PRESENCE_LEFT] = MSG_PLAYER_LEFT,
+    [PRESENCE_BUSY] = MSG_PLAYER_BUSY,
+    [PRESENCE_AVAILABLE] = MSG_PLAYER_AVAILABLE,
+};
+
+// Send one batch of deltas to every lobby client not already past it
+static void send_presence_batch(char batch[2][PROTO_MAX_FRAME], size_t len[2], uint32_t last) {
+    for (struct client *c = client_list; c; c = c->next) {
+        if (c->in_game == 0 && c->lobby_version < last) {
+            client_write(c, batch[c->proto], len[c->proto]);
+            c->lobby_version = last;
+        }
+    }
+    len[PROTO_TEXT] = 0;
+    len[PROTO_BINARY] = 0;
+}
+
+// Pass presence changes since the last tick on to the lobby: each batch is
+// encoded once per wire format and written to each client in one go.
+// Runs from presence_timer.
+void flush_presence(void *arg) {
+    (void)arg;
+    static char batch[2][PROTO_MAX_FRAME];
+    size_t len[2] = { 0, 0 };
+    uint32_t last = feed_seen;
+    struct presence_event ev;
+    int ret = 0;
+
+    while (last != presence_feed_version(feed) &&
+           (ret = presence_feed_read(feed, last + 1, &ev)) == 0) {
+        char payload[4 + PRESENCE_NAME_LEN];
+        size_t plen = 4 + strlen(ev.name);
+        proto_put_u32(payload, ev.version);
+        memcpy(payload + 4, ev.name, plen - 4);
+
+        char encoded[2][PROTO_HEADER_SIZE + 32 + PRESENCE_NAME_LEN];
+        size_t n[2];
+        for (int proto = PROTO_TEXT; proto <= PROTO_BINARY; proto++) {
+            n[proto] = proto_encode(proto, presence_msg_types[ev.type], payload, plen,
+                                    encoded[proto], sizeof(encoded[proto]));
+        }
+        if (len[PROTO_TEXT] + n[PROTO_TEXT] > sizeof(batch[PROTO_TEXT]) ||
+            len[PROTO_BINARY] + n[PROTO_BINARY] > sizeof(batch[PROTO_BINARY])) {
+            // Batch full: send it and start the next one with this change
+            send_presence_batch(batch, len, last);
+        }
+        for (int proto = PROTO_TEXT; proto <= PROTO_BINARY; proto++) {
+            memcpy(batch[proto] + len[proto], encoded[proto], n[proto]);
+            len[proto] += n[proto];
+        }
+        last = ev.version;
+    }
+    if (len[PROTO_TEXT] > 0) {
+        send_presence_batch(batch, len, last);
+    }
+    feed_seen = last;
+
+    if (ret == -1) {
+        // Fell a whole feed behind; start every lobby over from a snapshot
+        printf("[SERVER] Presence feed overrun, resending lobby snapshots\n");
+        for (struct client *c = client_list; c; c = c->next) {
+            if (c->in_game == 0) send_lobby(c);
+        }
+        feed_seen = presence_feed_version(feed);
+    }
+    // ret == 1: a change is still being published; the next tick picks it up
+}
+
+// Set up a connection and start watching it; not listed until add_client
+static struct client *new_client(int fd) {
+    if (conn_table_reserve(fd) == -1) return NULL;
+
+    struct client *c = calloc(1, sizeof(*c));
+    if (!c) {
+        perror("calloc client failed");
+        return NULL;
+    }
+
+    c->fd = fd;
+    c->in_game = 0;
+    c->match_id = -1;
+    c->queue_bucket = -1;
+    for (int i = 0; i < MAX_INVITES; i++) {
+        timer_init(&c->invites[i].expiry, invite_expired, &c->invites[i]);
+        c->invites[i].from = c;
+    }
+
+    if (set_nonblocking(fd, 1) == -1 || watch_client(c) == -1) {
+        free(c);
+        return NULL;
+    }
+    // Replies (e.g. a bot's move) must not wait on the client's delayed ACK
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    conns[fd] = c;
+    return c;
+}
+
+// List an authenticated connection under its username
+static void list_client(struct client *c, const char *user) {
+    strncpy(c->username, user, sizeof(c->username) - 1);
+    c->username[sizeof(c->username) - 1] = '\0';
+    c->state = CLIENT_ACTIVE;
+
+    name_table_insert(c);
+    c->next = client_list;
+    if (client_list) client_list->prev = c;
+    client_list = c;
+    client_count++;
+    metrics_gauge_add(METRIC_LOBBY, 1);
+}
+
+struct client *add_client(int fd, const char *user) {
+    struct client *c = new_client(fd);
+    if (c) list_client(c, user);
+    return c;
+}
+
+// Drop a client from this shard's tables and free it
+static void forget_client(struct client *c) {
+    clear_invites(c);
+    stop_watching(c);
+    unqueue_flush(c);
+    leave_queue(c);
+    close(c->fd);  // Also drops the fd from the epoll set
+    outq_clear(&c->out);
+    if (!c->in_game) {
+        metrics_gauge_add(METRIC_LOBBY, -1);
+    }
+
+    conns[c->fd] = NULL;
+    name_table_remove(c);
+    if (c->prev) c->prev->next = c->next;
+    else client_list = c->next;
+    if (c->next) c->next->prev = c->prev;
+    client_count--;
+    free(c);
+}
+
+// Close a connection that never got past authentication
+static void drop_pending(struct client *c, const char *reply) {
+    if (reply) send(c->fd, reply, strlen(reply), MSG_NOSIGNAL);
+    timer_cancel(&timers, &c->auth_timer);
+    close(c->fd);  // Also drops the fd from the epoll set
+    outq_clear(&c->out);
+    conns[c->fd] = NULL;
+    pending_auth--;
+    free(c);
+}
+
+static void auth_expired(void *arg) {
+    struct client *c = arg;
+    printf("[SERVER] No credentials from fd %d within %d s, closing\n", c->fd, AUTH_TIMEOUT_SEC);
+    metrics_count(METRIC_LOGIN_TIMEOUTS);
+    drop_pending(c, "AUTH_TIMEOUT\n");
+}
+
+void remove_client(struct client *c) {
+    printf("[SERVER] Removing client '%s' (fd %d)\n", c->username, c->fd);
+    if (directory) {
+        presence_release(directory, c->username);
+    }
+    publish_presence(PRESENCE_LEFT, c->username);
+    forget_client(c);
+}
+
+void start_game(struct client *p1, struct client *p2, struct board_shape shape) {
+    int p1_fd = p1->fd;
+    int p2_fd = p2->fd;
+
+    printf("[SERVER] Starting game between %s (fd %d) and %s (fd %d)\n",
+           p1->username, p1_fd,
+           p2->username, p2_fd);
+
+    int id = alloc_match();
+    if (id == -1) {
+        send_msg(p2, MSG_PLAYER_NOT_AVAILABLE, NULL, 0);
+        return;
+    }
+    int table_slot = gametable_claim(p1->username, p2->username, shape);
+
+    int pid = fork();
+    if (pid == 0) {
+        // Child process: game_process
+        // Every other descriptor is close-on-exec; keep only the two players
+        // and the socket the game reports to spectators on
+        fcntl(p1_fd, F_SETFD, 0);
+        fcntl(p2_fd, F_SETFD, 0);
+        fcntl(game_events[0], F_SETFD, 0);
+
+        // game_process uses blocking I/O on the player sockets, with a
+        // send timeout so one stalled player cannot hold the game forever
+        struct timeval tv = { GAME_SEND_TIMEOUT_SEC, 0 };
+        set_nonblocking(p1_fd, 0);
+        set_nonblocking(p2_fd, 0);
+        setsockopt(p1_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        setsockopt(p2_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        sigprocmask(SIG_UNBLOCK, &blocked_signals, NULL);
+
+        // Deliver whatever the lobby still had queued before the game starts
+        outq_flush(&p1->out, p1_fd);
+        outq_flush(&p2->out, p2_fd);
+
+        // Prepare arguments
+        char fd1_str[16], fd2_str[16];
+        char slot_str[16];
+        char proto1_str[4], proto2_str[4];
+        char shape_str[16];
+        char events_str[16], id_str[16];
+
+        snprintf(fd1_str, sizeof(fd1_str), "%d", p1_fd);
+        snprintf(fd2_str, sizeof(fd2_str), "%d", p2_fd);
+        snprintf(slot_str, sizeof(slot_str), "%d", table_slot);
+        snprintf(proto1_str, sizeof(proto1_str), "%d", p1->proto);
+        snprintf(proto2_str, sizeof(proto2_str), "%d", p2->proto);
+        board_format_shape(shape, shape_str, sizeof(shape_str));
+        snprintf(events_str, sizeof(events_str), "%d", game_events[0]);
+        snprintf(id_str, sizeof(id_str), "%d", id);
+
+        // The game process keeps the position in our live game table slot
+        execl("./game_process", "game_process", fd1_str, fd2_str,
+              p1->username, p2->username, slot_str, proto1_str, proto2_str,
+              shape_str, events_str, id_str, NULL);
+        perror("execl failed");
+        exit(1);
+    } else if (pid > 0) {
+        // Parent process: hand the sockets to the game and store game PID
+        unwatch_client(p1);
+        unwatch_client(p2);
+        outq_clear(&p1->out);
+        outq_clear(&p2->out);
+        set_in_game(p1, 1);
+        p1->match_id = id;
+        set_in_game(p2, 1);
+        p2->match_id = id;
+
+        matches[id].pid = pid;
+        matches[id].players[0] = p1;
+        matches[id].players[1] = p2;
+        matches[id].table_slot = table_slot;
+        board_init(&matches[id].board, shape);
+        metrics_count(METRIC_GAMES_STARTED);
+        metrics_gauge_add(METRIC_LIVE_GAMES, 1);
+
+        printf("[SERVER] Game process spawned (PID %d)\n", pid);
+    } else {
+        perror("fork failed");
+        gametable_release(table_slot);
+        release_match(id);
+        send_msg(p2, MSG_PLAYER_NOT_AVAILABLE, NULL, 0);
+    }
+}
+
+void start_pool_game(struct client *p1, struct client *p2, struct board_shape shape) {
+    // Least-loaded worker gets the match
+    int w = -1;
+    for (int i = 0; i < worker_count; i++) {
+        if (workers[i].pid > 0 && (w == -1 || workers[i].load < workers[w].load)) {
+            w = i;
+        }
+    }
+
+    int id = (w == -1) ? -1 : alloc_match();
+    if (id == -1) {
+        send_msg(p2, MSG_PLAYER_NOT_AVAILABLE, NULL, 0);
+        return;
+    }
+
+    static char buf[WORKER_MSG_MAX];
+    struct worker_msg msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = WORKER_START_GAME;
+    msg.game_id = id;
+    strncpy(msg.users[0], p1->username, sizeof(msg.users[0]) - 1);
+    strncpy(msg.users[1], p2->username, sizeof(msg.users[1]) - 1);
+    msg.proto[0] = p1->proto;
+    msg.proto[1] = p2->proto;
+    msg.shape = shape;
+    msg.table_slot = gametable_claim(p1->username, p2->username, shape);
+    int fds[2] = { p1->fd, p2->fd };
+
+    // The worker takes over the players' queued output
+    size_t len = sizeof(msg);
+    msg.pending[0] = outq_copy(&p1->out, buf + len, OUTQ_LIMIT);
+    len += msg.pending[0];
+    msg.pending[1] = outq_copy(&p2->out, buf + len, OUTQ_LIMIT);
+    len += msg.pending[1];
+    memcpy(buf, &msg, sizeof(msg));
+
+    // Stop watching first so no lobby read races the worker for input
+    unwatch_client(p1);
+    unwatch_client(p2);
+
+    if (send_with_fds(workers[w].fd, buf, len, fds, 2) == -1) {
+        fprintf(stderr, "[SERVER ERROR] Could not hand match to worker %d\n", w);
+        watch_client(p1);
+        watch_client(p2);
+        gametable_release(msg.table_slot);
+        release_match(id);
+        send_msg(p2, MSG_PLAYER_NOT_AVAILABLE, NULL, 0);
+        return;
+    }
+
+    printf("[SERVER] Game between %s and %s handed to worker %d (match %d)\n",
+           p1->username, p2->username, w, id);
+    outq_clear(&p1->out);
+    outq_clear(&p2->out);
+
+    set_in_game(p1, 1);
+    p1->match_id = id;
+    set_in_game(p2, 1);
+    p2->match_id = id;
+    matches[id].worker = w;
+    matches[id].players[0] = p1;
+    matches[id].players[1] = p2;
+    matches[id].table_slot = msg.table_slot;
+    board_init(&matches[id].board, shape);
+    workers[w].load++;
+    metrics_count(METRIC_GAMES_STARTED);
+    metrics_gauge_add(METRIC_LIVE_GAMES, 1);
+}
+
+static void inproc_game_send(struct game *g, int player, const char *msg, size_t len) {
+    struct game_slot *slot = (struct game_slot *)g;
+    client_write(slot->players[player - 1], msg, len);
+}
+
+static void inproc_game_watch(struct game *g, int event, int a, int b) {
+    struct game_slot *slot = (struct game_slot *)g;
+    if (!slot->audience) return;
+    if (event == WATCH_MOVE) {
+        watch_move(slot->audience, a, b);
+    } else {
+        close_audience(slot->audience, a, b);
+    }
+}
+
+static struct game_slot *alloc_game_slot() {
+    if (!free_games) {
+        struct game_slot **np = realloc(game_pages, (game_page_count + 1) * sizeof(*np));
+        if (!np) {
+            perror("realloc game pages failed");
+            return NULL;
+        }
+        game_pages = np;
+
+        struct game_slot *page = calloc(GAME_SLOTS_PER_PAGE, sizeof(*page));
+        if (!page) {
+            perror("calloc game page failed");
+            return NULL;
+        }
+        game_pages[game_page_count++] = page;
+
+        for (int i = GAME_SLOTS_PER_PAGE - 1; i >= 0; i--) {
+            page[i].next_free = free_games;
+            free_games = &page[i];
+        }
+    }
+
+    struct game_slot *slot = free_games;
+    free_games = slot->next_free;
+    slot->next_free = NULL;
+    live_games++;
+    metrics_count(METRIC_GAMES_STARTED);
+    metrics_gauge_add(METRIC_LIVE_GAMES, 1);
+    return slot;
+}
+
+static void free_game_slot(struct game_slot *slot) {
+    timer_cancel(&timers, &slot->g.turn_timer);
+    gametable_release(slot->g.table_slot);
+    if (slot->audience) {
+        close_audience(slot->audience, -1, 0);
+    }
+    slot->players[0] = NULL;
+    slot->players[1] = NULL;
+    slot->next_free = free_games;
+    free_games = slot;
+    live_games--;
+    metrics_count(METRIC_GAMES_FINISHED);
+    metrics_gauge_add(METRIC_LIVE_GAMES, -1);
+}
+
+static void inproc_turn_expired(void *arg);
+
+void start_inproc_game(struct client *p1, struct client *p2, struct board_shape shape) {
+    printf("[SERVER] Starting in-process game between %s (fd %d) and %s (fd %d)\n",
+           p1->username, p1->fd, p2->username, p2->fd);
+
+    struct game_slot *slot = alloc_game_slot();
+    if (!slot) {
+        send_msg(p2, MSG_PLAYER_NOT_AVAILABLE, NULL, 0);
+        return;
+    }
+
+    slot->players[0] = p1;
+    slot->players[1] = p2;
+    set_in_game(p1, 1);
+    p1->game = slot;
+    p1->player_no = 1;
+    set_in_game(p2, 1);
+    p2->game = slot;
+    p2->player_no = 2;
+
+    game_init(&slot->g, p1->username, p2->username, inproc_game_send, NULL);
+    game_set_timers(&slot->g, &timers, inproc_turn_expired, slot);
+    game_set_watch(&slot->g, inproc_game_watch);
+    slot->g.proto[0] = p1->proto;
+    slot->g.proto[1] = p2->proto;
+    game_set_shape(&slot->g, shape);
+    slot->g.table_slot = gametable_claim(p1->username, p2->username, shape);
+    game_start(&slot->g);
+}
+
+// Bot games always run in this loop, whatever the game mode: the bot
+// answers from a precomputed table, so a match is only a slot.
+void start_bot_game(struct client *c, int level) {
+    struct game_slot *slot = alloc_game_slot();
+    if (!slot) {
+        send_msg(c, MSG_PLAYER_NOT_AVAILABLE, NULL, 0);
+        return;
+    }
+
+    char bot_name[64];
+    snprintf(bot_name, sizeof(bot_name), "Bot (%s)", bot_level_name(level));
+    printf("[SERVER] Starting %s bot game for %s (fd %d)\n",
+           bot_level_name(level), c->username, c->fd);
+
+    slot->players[0] = c;
+    slot->players[1] = NULL;
+    set_in_game(c, 1);
+    c->game = slot;
+    c->player_no = 1;
+
+    game_init(&slot->g, c->username, bot_name, inproc_game_send, NULL);
+    game_set_timers(&slot->g, &timers, inproc_turn_expired, slot);
+    game_set_watch(&slot->g, inproc_game_watch);
+    slot->g.proto[0] = c->proto;
+    game_set_bot(&slot->g, 2, level, (unsigned)time(NULL) ^ (unsigned)c->fd);
+    slot->g.table_slot = gametable_claim(c->username, bot_name, slot->g.board.shape);
+    game_start(&slot->g);
+}
+
+// Return both players of a finished in-process game to the lobby.
+// 'gone' is a player who is disconnecting and must not be messaged.
+void finish_inproc_game(struct game_slot *slot, struct client *gone) {
+    for (int p = 0; p < 2; p++) {
+        struct client *c = slot->players[p];
+        if (!c) continue;  // Bot
+        set_in_game(c, 0);
+        c->game = NULL;
+        c->player_no = 0;
+        if (c == gone) continue;
+
+        printf("[SERVER] Returning '%s' to lobby after in-process game\n", c->username);
+        send_msg(c, MSG_RETURN_TO_LOBBY, NULL, 0);
+        send_lobby(c);
+    }
+
+    free_game_slot(slot);
+}
+
+static void inproc_turn_expired(void *arg) {
+    struct game_slot *slot = arg;
+    if (game_handle_timeout(&slot->g) == GAME_FINISHED) {
+        finish_inproc_game(slot, NULL);
+    }
+}
+
+void handle_client_disconnect(struct client *c) {
+    if (c->state == CLIENT_AUTH_PENDING) {
+        printf("[SERVER] Connection closed before authenticating, fd %d\n", c->fd);
+        drop_pending(c, NULL);
+        return;
+    }
+    printf("[SERVER] Client '%s' disconnected\n", c->username);
+
+    if (c->game) {
+        // Opponent wins by default and goes back to the lobby
+        struct game_slot *slot = c->game;
+        game_handle_disconnect(&slot->g, c->player_no);
+        finish_inproc_game(slot, c);
+    } else if (c->in_game) {
+        // Client was in a game - the game_process will handle this
+        printf("[SERVER] Client was in game - game_process will handle cleanup\n");
+    }
+
+    remove_client(c);
+}
+
+// Check the LOGIN/REGISTER line and move the connection into the lobby.
+// Returns 1 if the connection was closed instead.
+static int authenticate(struct client *c, char *line) {
+    printf("[SERVER] Received: '%s'\n", line);
+
+    char *command = strtok(line, " ");
+    char *user = strtok(NULL, " ");
+    char *pass = strtok(NULL, " ");
+    char *format = strtok(NULL, " ");
+
+    if (!command || !user || !pass) {
+        printf("[SERVER] Invalid format → INVALID_FORMAT\n");
+        drop_pending(c, "INVALID_FORMAT\n");
+        return 1;
+    }
+
+    // Validate username and password length
+    if (strlen(user) >= 64 || strlen(pass) >= 64) {
+        drop_pending(c, "USERNAME_OR_PASSWORD_TOO_LONG\n");
+        return 1;
+    }
+
+    const char *reply;
+    if (strcmp(command, "REGISTER") == 0) {
+        printf("[SERVER] REGISTER request for '%s'\n", user);
+        // The directory claim stops two shards registering the same name at once
+        int claimed = directory && presence_claim(directory, user, shard_index) == 0;
+        if ((directory && !claimed) || register_user(user, pass) == -1) {
+            printf("[SERVER] User '%s' exists → USER_EXISTS\n", user);
+            if (claimed) {
+                presence_release(directory, user);
+                publish_presence(PRESENCE_LEFT, user);
+            }
+            drop_pending(c, "USER_EXISTS\n");
+            return 1;
+        }
+        printf("[SERVER] User '%s' registered\n", user);
+        reply = "REGISTER_OK\n";
+    }
+    else if (strcmp(command, "LOGIN") == 0) {
+        printf("[SERVER] LOGIN request for '%s'\n", user);
+        if (!validate_login(user, pass)) {
+            printf("[SERVER] Invalid credentials for '%s'\n", user);
+            drop_pending(c, "INVALID_LOGIN\n");
+            return 1;
+        }
+        if (find_client(user) != NULL ||
+            (directory && presence_claim(directory, user, shard_index) == -1)) {
+            printf("[SERVER] User '%s' already logged in\n", user);
+            drop_pending(c, "ALREADY_LOGGED_IN\n");
+            return 1;
+        }
+        printf("[SERVER] Login successful for '%s'\n", user);
+        reply = "LOGIN_OK\n";
+    }
+    else {
+        printf("[SERVER] Unknown command '%s'\n", command);
+        drop_pending(c, "INVALID_COMMAND\n");
+        return 1;
+    }
+
+    timer_cancel(&timers, &c->auth_timer);
+    pending_auth--;
+    list_client(c, user);
+    metrics_count(METRIC_LOGINS);
+    client_write(c, reply, strlen(reply));
+    // Everything after the text reply is framed for BINARY clients
+    if (format && strcmp(format, "BINARY") == 0) {
+        c->proto = PROTO_BINARY;
+    }
+    printf("[SERVER] Added '%s' to lobby (fd %d, total %d, %s protocol)\n",
+           user, c->fd, client_count, c->proto == PROTO_BINARY ? "binary" : "text");
+    publish_presence(PRESENCE_JOINED, c->username);
+    send_lobby(c);
+    return 0;
+}
+
+// Authenticate once the first line is complete. Returns 1 if the connection
+// was closed; otherwise it is still waiting or now in the lobby.
+static int process_auth(struct client *c) {
+    char *nl = memchr(c->inbuf, '\n', c->inlen);
+    if (!nl) {
+        if (c->inlen < sizeof(c->inbuf) - 1) return 0;
+        printf("[SERVER] Overlong first line on fd %d → INVALID_FORMAT\n", c->fd);
+        drop_pending(c, "INVALID_FORMAT\n");
+        return 1;
+    }
+
+    // Consume the line; anything after it is the client's first commands
+    char line[BUF_SIZE];
+    size_t consumed = nl + 1 - c->inbuf;
+    memcpy(line, c->inbuf, consumed);
+    line[strcspn(line, "\r\n")] = '\0';
+    memmove(c->inbuf, c->inbuf + consumed, c->inlen - consumed);
+    c->inlen -= consumed;
+
+    long long start = metrics_now_us();
+    int closed = authenticate(c, line);
+    metrics_observe(METRIC_LOGIN_TIME, metrics_now_us() - start);
+    return closed;
+}
+
+// New sockets wait in CLIENT_AUTH_PENDING like any other connection, so a
+// client that is slow to send its credentials never holds up the loop
+void handle_new_connection(int new_fd) {
+    printf("[SERVER] New connection accepted, fd = %d\n", new_fd);
+
+    struct client *c = pending_auth < MAX_PENDING_AUTH ? new_client(new_fd) : NULL;
+    if (c == NULL) {
+        printf("[SERVER] Server full → SERVER_FULL\n");
+        send(new_fd, "SERVER_FULL\n", 12, MSG_NOSIGNAL);
+        close(new_fd);
+        return;
+    }
+    c->state = CLIENT_AUTH_PENDING;
+    pending_auth++;
+    // Registering the socket reports any credentials that are already waiting
+    timer_init(&c->auth_timer, auth_expired, c);
+    timer_arm(&timers, &c->auth_timer, AUTH_TIMEOUT_SEC * 1000);
+}
+
+void accept_connections() {
+    // Edge-triggered: drain the whole accept backlog
+    while (1) {
+        int new_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (new_fd == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept failed");
+            break;
+        }
+        metrics_count(METRIC_ACCEPTS);
+        handle_new_connection(new_fd);
+    }
+}
+
+// Start a match on a 'shape' board between two local lobby players
+// (inviter is player 1). Returns 1 if the accepter's socket was handed to
+// a game process.
+int start_match(struct client *inviter, struct client *accepter, struct board_shape shape) {
+    if (game_mode == GAME_MODE_INPROC) {
+        start_inproc_game(inviter, accepter, shape);
+        return 0;
+    } else if (game_mode == GAME_MODE_POOL) {
+        start_pool_game(inviter, accepter, shape);
+    } else {
+        start_game(inviter, accepter, shape);
+    }
+    return accepter->in_game;
+}
+
+// Start a game between two queued players, X being the one who waited
+// longer. Returns the time both spent in the queue, in ms.
+static long long pair_players(struct client *a, struct client *b, long long now) {
+    struct client *first = a->queued_at <= b->queued_at ? a : b;
+    struct client *p[2] = { first, first == a ? b : a };
+    long long waited = 0;
+
+    for (int i = 0; i < 2; i++) {
+        char payload[4 + 64];
+        const char *opponent = p[1 - i]->username;
+        size_t len = strlen(opponent);
+        proto_put_u32(payload, (uint32_t)(now - p[i]->queued_at));
+        memcpy(payload + 4, opponent, len);
+        waited += now - p[i]->queued_at;
+        leave_queue(p[i]);
+        send_msg(p[i], MSG_MATCH_FOUND, payload, 4 + len);
+    }
+    // MATCH_FOUND has to go first: in fork and pool mode the sockets leave
+    // with the game. If it could not start, O has been told already.
+    start_match(p[0], p[1], BOARD_CLASSIC);
+    if (!p[0]->in_game) {
+        printf("[SERVER] Quick match between '%s' and '%s' could not start\n",
+               p[0]->username, p[1]->username);
+        send_msg(p[0], MSG_PLAYER_NOT_AVAILABLE, NULL, 0);
+    }
+    return waited;
+}
+
+// Runs from match_timer. Players are paired within their bucket first,
+// oldest first; the one left over in a bucket is then paired with the
+// nearest one above if either has waited long enough for the gap between
+// them. No one outside the queue is looked at.
+void match_queued_players(void *arg) {
+    (void)arg;
+    long long now = now_ms(), waited = 0;
+    int pairs = 0;
+
+    for (int b = 0; b < MATCH_BUCKETS; b++) {
+        struct match_bucket *q = &match_queue[b];
+        while (q->count >= 2) {
+            if (q->head->closing) {
+                leave_queue(q->head);
+            } else if (q->head->queue_next->closing) {
+                leave_queue(q->head->queue_next);
+            } else {
+                waited += pair_players(q->head, q->head->queue_next, now);
+                pairs++;
+            }
+        }
+    }
+
+    struct client *last = NULL;
+    for (int b = 0; b < MATCH_BUCKETS; b++) {
+        struct client *c = match_queue[b].head;
+        if (!c || c->closing) continue;
+        if (last) {
+            long long since = last->queued_at < c->queued_at ? last->queued_at : c->queued_at;
+            if (b - last->queue_bucket <= (now - since) / MATCH_WIDEN_MS) {
+                waited += pair_players(last, c, now);
+                pairs++;
+                last = NULL;
+                continue;
+            }
+        }
+        last = c;
+    }
+
+    if (pairs > 0) {
+        printf("[SERVER] Quick match: %d games started, %d still waiting, mean wait %lld ms\n",
+               pairs, queued_players, waited / (2 * pairs));
+    }
+    if (queued_players > 0) timer_arm(&timers, &match_timer, MATCH_TICK_MS);
+}
+
+void send_to_shard(int shard, struct shard_msg *msg, int fd) {
+    msg->outlen = 0;
+    size_t len = offsetof(struct shard_msg, text) + msg->textlen;
+    if (send_with_fds(shard_inbox[shard][0], msg, len, &fd, fd == -1 ? 0 : 1) == -1) {
+        fprintf(stderr, "[SERVER] Shard %d inbox full, dropped message type %d\n",
+                shard, msg->type);
+    }
+}
+
+// A declined invitation is withdrawn as the inviter hears of it
+static void deliver_local(struct client *t, int type, const char *about) {
+    struct invite *inv;
+    if (type == MSG_INVITE_DECLINED_BY && (inv = find_invite(t, about))) {
+        timer_cancel(&timers, &inv->expiry);
+        inv->to[0] = '\0';
+    }
+    send_msg(t, type, about, strlen(about));
+}
+
+// Deliver a message naming 'about' to a player, wherever it is connected
+void deliver_to_player(const char *user, int type, const char *about) {
+    struct client *t = find_client(user);
+    struct presence_info info;
+
+    if (t) {
+        deliver_local(t, type, about);
+    } else if (directory && presence_lookup(directory, user, &info) == 0 &&
+               info.shard != shard_index) {
+        struct shard_msg msg;
+        msg.type = SHARD_DELIVER;
+        msg.msg_type = type;
+        strncpy(msg.to, user, sizeof(msg.to) - 1);
+        msg.to[sizeof(msg.to) - 1] = '\0';
+        msg.textlen = snprintf(msg.text, sizeof(msg.text), "%s", about);
+        send_to_shard(info.shard, &msg, -1);
+    }
+}
+
+// Is an available player known here or on another shard?
+int player_available(const char *user, struct client *self) {
+    struct client *t = find_client(user);
+    struct presence_info info;
+
+    if (t) return t != self && t->in_game == 0 && !t->closing;
+    return directory && presence_lookup(directory, user, &info) == 0 &&
+           info.shard != shard_index && !info.busy;
+}
+
+// Move a lobby client to another shard, which then starts a match with
+// 'to' (SHARD_HANDOFF), lets the client watch the game 'to' is in
+// (SHARD_WATCH) or queues it for a quick match (SHARD_QUEUE). The
+// directory entry stays claimed throughout.
+static int handoff_to_shard(struct client *c, int shard, const char *to, int type) {
+    struct shard_msg msg;
+    msg.type = type;
+    strncpy(msg.from, c->username, sizeof(msg.from) - 1);
+    msg.from[sizeof(msg.from) - 1] = '\0';
+    strncpy(msg.to, to, sizeof(msg.to) - 1);
+    msg.to[sizeof(msg.to) - 1] = '\0';
+    msg.proto = c->proto;
+    memcpy(msg.text, c->inbuf, c->inlen);
+    msg.textlen = c->inlen;
+    msg.outlen = outq_copy(&c->out, msg.text + msg.textlen, OUTQ_LIMIT);
+
+    size_t len = offsetof(struct shard_msg, text) + msg.textlen + msg.outlen;
+    if (send_with_fds(shard_inbox[shard][0], &msg, len, &c->fd, 1) == -1) {
+        return -1;
+    }
+
+    if (type == SHARD_QUEUE) {
+        printf("[SERVER] Handed '%s' to shard %d to queue\n", c->username, shard);
+    } else {
+        printf("[SERVER] Handed '%s' to shard %d to %s '%s'\n",
+               c->username, shard, type == SHARD_WATCH ? "watch" : "play", to);
+    }
+    // The socket stays open in the other shard, so closing our fd would
+    // leave it registered here
+    unwatch_client(c);
+    forget_client(c);
+    return 0;
+}
+
+// Hand a lobby client to the shard that owns 'opponent'
+int handoff_client(struct client *c, const char *opponent, int type) {
+    struct presence_info info;
+    if (presence_lookup(directory, opponent, &info) == -1) return -1;
+    return handoff_to_shard(c, info.shard, opponent, type);
+}
+
+// Stream a recorded game: a header, one frame per move, then the result.
+// Only this game's record is read from its segment.
+void replay_game(struct client *c, const char *arg) {
+    char *end;
+    unsigned long id = strtoul(arg, &end, 10);
+    if (arg[0] < '0' || arg[0] > '9' || *end != '\0' || id == 0 || id > UINT32_MAX) {
+        send_error(c, "INVALID_REPLAY_FORMAT");
+        return;
+    }
+    struct gamelog_entry e;
+    uint8_t packed[GAMELOG_PACKED_MAX];
+    if (gamelog_read((uint32_t)id, &e, packed) == -1) {
+        send_error(c, "NO_SUCH_GAME");
+        return;
+    }
+
+    const char *names[2];
+    for (int p = 0; p < 2; p++) {
+        names[p] = e.player[p] == GAMELOG_BOT ? "Bot" : stats_user_name(e.player[p]);
+        if (!names[p]) names[p] = "?";
+    }
+    char head[13 + 2 * 64];
+    proto_put_u32(head, e.id);
+    proto_put_u32(head + 4, e.started);
+    head[8] = (char)e.rows;
+    head[9] = (char)e.cols;
+    head[10] = (char)e.k;
+    head[11] = (char)(e.moves >> 8);
+    head[12] = (char)e.moves;
+    int len = snprintf(head + 13, sizeof(head) - 13, "%s %s", names[0], names[1]);
+    send_msg(c, MSG_REPLAY, head, 13 + len);
+
+    // X always moves first
+    for (int i = 0; i < e.moves; i++) {
+        int cell = gamelog_move_at(packed, e.bits, i) + 1;
+        char move[7] = { (char)((i + 1) >> 8), (char)(i + 1), (char)(cell >> 8), (char)cell,
+                         (char)(i % 2 + 1), (char)e.rows, (char)e.cols };
+        send_msg(c, MSG_REPLAY_MOVE, move, sizeof(move));
+    }
+
+    char result[2 + 64];
+    const char *winner = e.winner ? names[e.winner - 1] : "";
+    size_t wlen = strlen(winner) < 64 ? strlen(winner) : 63;
+    result[0] = (char)e.winner;
+    result[1] = (char)e.end;
+    memcpy(result + 2, winner, wlen);
+    send_msg(c, MSG_REPLAY_END, result, 2 + wlen);
+}
+
+// Let a lobby client watch the game 'target' is playing: a snapshot now,
+// then every move. Returns 1 if the client was handed to the shard hosting
+// the game.
+int watch_player(struct client *c, const char *target) {
+    struct client *p = find_client(target);
+    struct presence_info info;
+
+    if (target[0] == '\0') {
+        send_error(c, "INVALID_WATCH_FORMAT");
+        return 0;
+    }
+    if (!p && directory && presence_lookup(directory, target, &info) == 0 &&
+        info.shard != shard_index && info.busy) {
+        if (handoff_client(c, target, SHARD_WATCH) == 0) return 1;
+        send_error(c, "NOT_PLAYING");
+        return 0;
+    }
+
+    // Leave any other game first; that may free its audience
+    stop_watching(c);
+
+    struct audience **owner = NULL;
+    if (p && p->game) {
+        owner = &p->game->audience;
+    } else if (p && p->match_id != -1) {
+        owner = &matches[p->match_id].audience;
+    }
+    if (!owner) {
+        send_error(c, "NOT_PLAYING");
+        return 0;
+    }
+    if (!*owner) {
+        *owner = calloc(1, sizeof(**owner));
+        if (!*owner) {
+            perror("calloc audience failed");
+            send_error(c, "NOT_PLAYING");
+            return 0;
+        }
+        (*owner)->slot = p->game;
+        (*owner)->match_id = p->match_id;
+    }
+
+    struct audience *a = *owner;
+    c->watch_prev = NULL;
+    c->watch_next = a->first;
+    if (a->first) a->first->watch_prev = c;
+    a->first = c;
+    a->count++;
+    c->watching = a;
+
+    printf("[SERVER] '%s' is watching '%s' (%d watching)\n", c->username, target, a->count);
+    send_watch_snapshot(c);
+    return 0;
+}
+
+// Returns 1 if the client was removed or its socket handed elsewhere
+int handle_lobby_command(struct client *c, int command, char *target) {
+    // Handle lobby commands
+    printf("[SERVER] From '%s': '%s %s'\n", c->username, proto_command_name(command), target);
+
+    if (command == CMD_INVITE) {
+        // "bob" or "bob 15x15"; the invitee sees the size next to our name
+        struct board_shape shape;
+        char *size = strchr(target, ' ');
+        if (size) *size++ = '\0';
+
+        if (target[0] == '\0') {
+            send_error(c, "INVALID_INVITE_FORMAT");
+        } else if (board_parse_shape(size ? size : "", &shape) == -1) {
+            send_error(c, "INVALID_BOARD_SIZE");
+        } else if (player_available(target, NULL)) {
+            char from[80];
+            if (board_is_classic(shape)) {
+                snprintf(from, sizeof(from), "%s", c->username);
+            } else {
+                char text[16];
+                board_format_shape(shape, text, sizeof(text));
+                snprintf(from, sizeof(from), "%s %s", c->username, text);
+            }
+            add_invite(c, target, shape);
+            deliver_to_player(target, MSG_INVITE_FROM, from);
+            send_msg(c, MSG_INVITE_SENT, target, strlen(target));
+            metrics_count(METRIC_INVITES);
+        } else {
+            send_msg(c, MSG_PLAYER_NOT_AVAILABLE, NULL, 0);
+        }
+    }
+    else if (command == CMD_ACCEPT) {
+        if (target[0] == '\0') {
+            send_error(c, "INVALID_ACCEPT_FORMAT");
+        } else if (!player_available(target, c)) {
+            send_msg(c, MSG_PLAYER_NOT_AVAILABLE, NULL, 0);
+        } else if (find_client(target)) {
+            struct invite *inv = find_invite(find_client(target), c->username);
+            if (!inv) {
+                send_error(c, "NO_PENDING_INVITE");
+                return 0;
+            }
+            return start_match(find_client(target), c, inv->shape);  // Inviter is player 1
+        } else if (handoff_client(c, target, SHARD_HANDOFF) == 0) {
+            return 1;
+        } else {
+            send_msg(c, MSG_PLAYER_NOT_AVAILABLE, NULL, 0);
+        }
+    }
+    else if (command == CMD_DECLINE) {
+        if (target[0] == '\0') {
+            send_error(c, "INVALID_DECLINE_FORMAT");
+        } else {
+            deliver_to_player(target, MSG_INVITE_DECLINED_BY, c->username);
+        }
+    }
+    else if (command == CMD_LEADERBOARD) {
+        char lb[PROTO_MAX_PAYLOAD];
+        int offset, limit, used = 0;
+        if (target[0] == '\0') {
+            get_leaderboard(lb, sizeof(lb));
+        } else if (sscanf(target, "%d %d%n", &offset, &limit, &used) != 2 || target[used] != '\0' ||
+                   offset < 0 || limit < 1) {
+            send_error(c, "INVALID_LEADERBOARD_FORMAT");
+            return 0;
+        } else {
+            get_leaderboard_page(offset, limit < LEADERBOARD_PAGE_MAX ? limit : LEADERBOARD_PAGE_MAX,
+                                 lb, sizeof(lb));
+        }
+        send_msg(c, MSG_LEADERBOARD, lb, strlen(lb));
+    }
+    else if (command == CMD_RANK) {
+        const char *who = target[0] ? target : c->username;
+        struct user_stats st;
+        int rank, ranked;
+        if (get_rank(who, &rank, &ranked) == -1 || get_user_stats(who, &st) == -1) {
+            send_error(c, "NOT_RANKED");
+        } else {
+            char payload[20 + 64];
+            size_t len = strlen(who) < 64 ? strlen(who) : 63;
+            proto_put_u32(payload, rank);
+            proto_put_u32(payload + 4, ranked);
+            proto_put_u32(payload + 8, st.wins);
+            proto_put_u32(payload + 12, st.losses);
+            proto_put_u32(payload + 16, st.draws);
+            memcpy(payload + 20, who, len);
+            send_msg(c, MSG_RANK, payload, 20 + len);
+        }
+    }
+    else if (command == CMD_RATING) {
+        const char *who = target[0] ? target : c->username;
+        struct user_stats st;
+        int games = get_user_stats(who, &st) == 0 ? st.wins + st.losses + st.draws : 0;
+        if (games == 0 && !user_exists(who)) {
+            send_error(c, "NOT_RATED");
+        } else {
+            char payload[8 + 64];
+            size_t len = strlen(who) < 64 ? strlen(who) : 63;
+            proto_put_u32(payload, (uint32_t)st.rating);
+            proto_put_u32(payload + 4, games);
+            memcpy(payload + 8, who, len);
+            send_msg(c, MSG_RATING, payload, 8 + len);
+        }
+    }
+    else if (command == CMD_REPLAY) {
+        replay_game(c, target);
+    }
+    else if (command == CMD_WATCH) {
+        return watch_player(c, target);
+    }
+    else if (command == CMD_UNWATCH) {
+        if (!c->watching) {
+            send_error(c, "NOT_WATCHING");
+        } else {
+            stop_watching(c);
+            send_msg(c, MSG_WATCH_END, NULL, 0);
+        }
+    }
+    else if (command == CMD_QUICKMATCH) {
+        // One queue for all shards; should shard 0 be down, queue here
+        if (shard_index != 0 && c->queue_bucket == -1 &&
+            handoff_to_shard(c, 0, "", SHARD_QUEUE) == 0) {
+            return 1;
+        }
+        join_queue(c);
+    }
+    else if (command == CMD_CANCEL) {
+        if (c->queue_bucket == -1) {
+            send_error(c, "NOT_QUEUED");
+        } else {
+            leave_queue(c);
+            send_msg(c, MSG_QUEUE_LEFT, NULL, 0);
+        }
+    }
+    else if (command == CMD_SYNC && c->watching) {
+        send_watch_snapshot(c);
+    }
+    else if (command == CMD_LIST) {
+        send_lobby(c);
+    }
+    else if (command == CMD_PLAY_BOT) {
+        int level = bot_parse_level(target);
+        if (level == -1) {
+            send_error(c, "INVALID_BOT_LEVEL");
+        } else {
+            start_bot_game(c, level);
+        }
+    }
+    else if (command == CMD_QUIT) {
+        send_msg(c, MSG_GOODBYE, NULL, 0);
+        handle_client_disconnect(c);
+        return 1;
+    }
+    else {
+        send_error(c, "UNKNOWN_COMMAND");
+    }
+    return 0;
+}
+
+// Route one text line to the client's in-process game or the lobby.
+// Returns 1 if the client is no longer served by this loop.
+int dispatch_line(struct client *c, char *line) {
+    if (c->game) {
+        struct game_slot *slot = c->game;
+        if (game_handle_input(&slot->g, c->player_no, line, c->read_us) == GAME_FINISHED) {
+            finish_inproc_game(slot, NULL);
+        }
+        return 0;
+    }
 
-void return_players_to_lobby(pid_t game_pid) {
-    // Find all players in this game and return them to lobby
-    for (int i = 0; i < client_count; i++) {
-        if (clients[i].in_game == 1 && clients[i].game_pid == game_pid) {
-            printf("[SERVER] Returning '%s' to lobby after game (PID %d)\n", 
-                   clients[i].username, game_pid);
-            clients[i].in_game = 0;
-            clients[i].game_pid = 0;
-            send(clients[i].fd, "RETURN_TO_LOBBY\n", 16, 0);
-            send_lobby(clients[i].fd);
+    char *arg;
+    int command = proto_parse_command(line, &arg);
+    return handle_lobby_command(c, command, arg);
+}
+
+// Same as dispatch_line for one binary frame
+int dispatch_frame(struct client *c, int type, const char *payload, size_t len) {
+    if (c->game) {
+        struct game_slot *slot = c->game;
+        if (game_handle_frame(&slot->g, c->player_no, type, payload, len,
+                              c->read_us) == GAME_FINISHED) {
+            finish_inproc_game(slot, NULL);
         }
+        return 0;
+    }
+
+    // Lobby arguments are names, ids and sizes, all shorter than a username
+    char arg[64];
+    if (len >= sizeof(arg)) {
+        printf("[SERVER] From '%s': %s with a %zu byte argument\n", c->username,
+               proto_command_name(type), len);
+        send_error(c, "ARGUMENT_TOO_LONG");
+        return 0;
     }
-    broadcast_lobby();
+    memcpy(arg, payload, len);
+    arg[len] = '\0';
+    return handle_lobby_command(c, type, arg);
 }
 
-void sigchld_handler(int sig) {
-    (void)sig;
-    // Reap all terminated child processes
-    int status;
-    pid_t pid;
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        printf("[SERVER] Game process %d terminated\n", pid);
-        // Return players from this game to lobby
-        return_players_to_lobby(pid);
+// Dispatch every complete frame in the input buffer
+int process_input_frames(struct client *c) {
+    int type, used;
+    const char *payload;
+    size_t len;
+
+    while ((used = proto_parse_frame(c->inbuf, c->inlen, &type, &payload, &len)) > 0) {
+        // Consume first: the handler may free the client or hand its input on
+        char frame[BUF_SIZE];
+        memcpy(frame, payload, len);
+        memmove(c->inbuf, c->inbuf + used, c->inlen - used);
+        c->inlen -= used;
+
+        if (dispatch_frame(c, type, frame, len)) return 1;
     }
+
+    if (used == -1 || c->inlen == sizeof(c->inbuf) - 1) {
+        printf("[SERVER] Bad frame from '%s', disconnecting\n", c->username);
+        handle_client_disconnect(c);
+        return 1;
+    }
+    return 0;
 }
 
-void cleanup_resources() {
-    printf("[SERVER] Cleaning up resources...\n");
-    
-    // Close all client connections
-    for (int i = 0; i < client_count; i++) {
-        close(clients[i].fd);
+// Dispatch every complete line in the input buffer
+int process_input_lines(struct client *c) {
+    if (c->state == CLIENT_AUTH_PENDING) {
+        if (process_auth(c)) return 1;
+        if (c->state == CLIENT_AUTH_PENDING) return 0;
     }
-    
-    // Close listening socket
-    if (listen_fd != -1) {
-        close(listen_fd);
+    if (c->proto == PROTO_BINARY) {
+        return process_input_frames(c);
     }
-    
-    // Remove message queue
-    if (msg_queue_id != -1) {
-        msgctl(msg_queue_id, IPC_RMID, NULL);
+
+    char *nl;
+    while ((nl = memchr(c->inbuf, '\n', c->inlen)) != NULL) {
+        *nl = '\0';
+        char *cr = strchr(c->inbuf, '\r');
+        if (cr) *cr = '\0';
+
+        size_t consumed = nl + 1 - c->inbuf;
+        char cmd[BUF_SIZE];
+        memcpy(cmd, c->inbuf, consumed);
+        memmove(c->inbuf, c->inbuf + consumed, c->inlen - consumed);
+        c->inlen -= consumed;
+
+        if (cmd[0] == '\0') continue;
+        if (dispatch_line(c, cmd)) return 1;
     }
-    
-    // Remove FIFO
-    unlink(FIFO_PATH);
-    
-    printf("[SERVER] Cleanup complete. Exiting.\n");
+    return 0;
 }
 
-void sigint_handler(int sig) {
-    (void)sig;
-    printf("\n[SERVER] Received SIGINT. Shutting down...\n");
-    cleanup_resources();
-    exit(0);
+void handle_client_input(struct client *c) {
+    // Edge-triggered: read until the socket is drained
+    while (1) {
+        if (c->inlen == sizeof(c->inbuf) - 1 && c->proto == PROTO_TEXT) {
+            // Overlong line - process what we have as one command
+            c->inbuf[c->inlen] = '\0';
+            c->inlen = 0;
+            if (dispatch_line(c, c->inbuf)) return;
+        }
+
+        ssize_t bytes = recv(c->fd, c->inbuf + c->inlen,
+                             sizeof(c->inbuf) - 1 - c->inlen, 0);
+        c->read_us = metrics_now_us();
+        if (bytes == 0) {
+            handle_client_disconnect(c);
+            return;
+        }
+        if (bytes == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            handle_client_disconnect(c);
+            return;
+        }
+        c->inlen += bytes;
+
+        if (process_input_lines(c)) return;
+    }
 }
 
-void send_lobby(int fd) {
-    char buf[BUF_SIZE] = "LOBBY:";
-    int online_count = 0;
-    
-    for (int i = 0; i < client_count; i++) {
-        if (clients[i].in_game == 0) {  // Only show available players
-            strncat(buf, clients[i].username, sizeof(buf) - strlen(buf) - 1);
-            strncat(buf, ",", sizeof(buf) - strlen(buf) - 1);
-            online_count++;
+void adopt_client(struct shard_msg *msg, int fd) {
+    msg->from[sizeof(msg->from) - 1] = '\0';
+    msg->to[sizeof(msg->to) - 1] = '\0';
+
+    struct client *c = add_client(fd, msg->from);
+    if (!c) {
+        if (directory) {
+            presence_release(directory, msg->from);
+            publish_presence(PRESENCE_LEFT, msg->from);
         }
+        close(fd);
+        return;
     }
-    
-    if (online_count > 0) {
-        buf[strlen(buf) - 1] = '\n';  // Replace last comma with newline
-    } else {
-        strncat(buf, "No players available\n", sizeof(buf) - strlen(buf) - 1);
+    c->proto = msg->proto == PROTO_BINARY ? PROTO_BINARY : PROTO_TEXT;
+    presence_update(directory, c->username, shard_index, 0);
+    printf("[SERVER] Adopted '%s' from another shard (fd %d)\n", c->username, fd);
+
+    if (msg->textlen > 0 && (size_t)msg->textlen < sizeof(c->inbuf)) {
+        memcpy(c->inbuf, msg->text, msg->textlen);
+        c->inlen = msg->textlen;
+    }
+    // Flushed by the EPOLLOUT event that registering the socket produces
+    if (msg->textlen >= 0 && msg->outlen > 0 && msg->outlen <= OUTQ_LIMIT &&
+        (size_t)msg->textlen < sizeof(c->inbuf)) {
+        outq_append(&c->out, msg->text + msg->textlen, msg->outlen);
+    }
+
+    if (msg->type == SHARD_WATCH) {
+        if (watch_player(c, msg->to)) return;
+        process_input_lines(c);
+        return;
+    }
+    if (msg->type == SHARD_QUEUE) {
+        join_queue(c);
+        process_input_lines(c);
+        return;
     }
-    
-    if (send(fd, buf, strlen(buf), 0) == -1) {
-        perror("send lobby failed");
+
+    // The invitation, and the board it named, is held on the inviter's shard
+    struct client *inviter = find_client(msg->to);
+    struct invite *inv = inviter ? find_invite(inviter, c->username) : NULL;
+    if (inviter && inviter->in_game == 0 && !inv) {
+        send_error(c, "NO_PENDING_INVITE");
+    } else if (inviter && inviter->in_game == 0) {
+        if (start_match(inviter, c, inv->shape)) return;
+    } else {
+        send_msg(c, MSG_PLAYER_NOT_AVAILABLE, NULL, 0);
     }
+    process_input_lines(c);
 }
 
-void broadcast_lobby() {
-    for (int i = 0; i < client_count; i++) {
-        if (clients[i].in_game == 0) {  // Only send to players in lobby
-            send_lobby(clients[i].fd);
+void handle_shard_inbox() {
+    struct shard_msg msg;
+    int fd, nfds;
+
+    while (1) {
+        ssize_t bytes = recv_with_fds(shard_inbox[shard_index][1], &msg, sizeof(msg), &fd, 1, &nfds);
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes <= 0) return;
+        if ((size_t)bytes < offsetof(struct shard_msg, text)) {
+            if (nfds) close(fd);
+            continue;
+        }
+
+        if ((msg.type == SHARD_HANDOFF || msg.type == SHARD_WATCH || msg.type == SHARD_QUEUE) &&
+            nfds == 1) {
+            adopt_client(&msg, fd);
+            continue;
+        }
+        if (nfds) close(fd);
+
+        if (msg.type == SHARD_DELIVER) {
+            msg.to[sizeof(msg.to) - 1] = '\0';
+            struct client *t = find_client(msg.to);
+            if (t && msg.textlen >= 0 && (size_t)msg.textlen < sizeof(msg.text)) {
+                msg.text[msg.textlen] = '\0';
+                deliver_local(t, msg.msg_type, msg.text);
+            }
         }
+        // SHARD_LOBBY_CHANGED only wakes the loop, which then reads the feed
     }
 }
 
-int find_client(const char *user) {
-    for (int i = 0; i < client_count; i++) {
-        if (strcmp(clients[i].username, user) == 0) {
-            return i;
+void notify_peer_shards() {
+    struct shard_msg msg;
+    msg.type = SHARD_LOBBY_CHANGED;
+    msg.textlen = 0;
+    for (int k = 0; k < shard_count; k++) {
+        if (k != shard_index) {
+            send_to_shard(k, &msg, -1);
         }
     }
-    return -1;
+    peers_dirty = 0;
 }
 
-void remove_client(int idx) {
-    if (idx < 0 || idx >= client_count) return;
-    
-    printf("[SERVER] Removing client '%s' (fd %d)\n", clients[idx].username, clients[idx].fd);
-    close(clients[idx].fd);
-    
-    // Shift remaining clients
-    memmove(&clients[idx], &clients[idx + 1], 
-            sizeof(struct client) * (client_count - idx - 1));
-    client_count--;
-    
-    broadcast_lobby();
+void raise_fd_limit() {
+    // Idle lobby connections are cheap; let the fd limit be the only cap
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
 }
 
-void start_game(int p1_idx, int p2_idx) {
-    if (p1_idx < 0 || p2_idx < 0 || p1_idx >= client_count || p2_idx >= client_count) {
-        fprintf(stderr, "[SERVER ERROR] Invalid player indices\n");
-        return;
+// --list-games: the running server's games as their hosts last wrote them
+int list_live_games() {
+    if (gametable_open() == -1) {
+        perror("shm_open game table failed - is the server running?");
+        return 1;
     }
-    
-    int p1_fd = clients[p1_idx].fd;
-    int p2_fd = clients[p2_idx].fd;
-    
-    printf("[SERVER] Starting game between %s (fd %d) and %s (fd %d)\n",
-           clients[p1_idx].username, p1_fd,
-           clients[p2_idx].username, p2_fd);
-    
-    int pid = fork();
-    if (pid == 0) {
-        // Child process: game_process
-        
-        // Close listening socket
-        close(listen_fd);
-        
-        // Close all other client sockets except the two players
-        for (int i = 0; i < client_count; i++) {
-            if (clients[i].fd != p1_fd && clients[i].fd != p2_fd) {
-                close(clients[i].fd);
-            }
+
+    time_t now = time(NULL);
+    int live = 0, used = gametable_used();
+    printf("%-5s %-7s %-6s %-5s %-6s %s\n", "SLOT", "HOST", "SIZE", "MOVES", "AGE", "GAME");
+    for (int n = 0; n < used; n++) {
+        struct live_game g;
+        if (gametable_read(n, &g) == -1) continue;
+
+        char shape[16], state[80];
+        board_format_shape(g.board.shape, shape, sizeof(shape));
+        if (g.turn == 1 || g.turn == 2) {
+            snprintf(state, sizeof(state), "%s to move", g.player[g.turn - 1]);
+        } else if (g.winner == 1 || g.winner == 2) {
+            snprintf(state, sizeof(state), "%s won", g.player[g.winner - 1]);
+        } else {
+            snprintf(state, sizeof(state), "draw");
         }
-        
-        // Prepare arguments
-        char fd1_str[16], fd2_str[16];
-        char u1[64], u2[64];
-        char sem_key_str[16];
-        
-        snprintf(fd1_str, sizeof(fd1_str), "%d", p1_fd);
-        snprintf(fd2_str, sizeof(fd2_str), "%d", p2_fd);
-        snprintf(sem_key_str, sizeof(sem_key_str), "%d", getpid());  // Use PID as unique key
-        
-        strncpy(u1, clients[p1_idx].username, sizeof(u1) - 1);
-        u1[sizeof(u1) - 1] = '\0';
-        strncpy(u2, clients[p2_idx].username, sizeof(u2) - 1);
-        u2[sizeof(u2) - 1] = '\0';
-        
-        // Execute game process with semaphore key
-        execl("./game_process", "game_process", fd1_str, fd2_str, u1, u2, sem_key_str, NULL);
-        perror("execl failed");
-        exit(1);
-    } else if (pid > 0) {
-        // Parent process: mark players as in-game and store game PID
-        clients[p1_idx].in_game = 1;
-        clients[p1_idx].game_pid = pid;
-        clients[p2_idx].in_game = 1;
-        clients[p2_idx].game_pid = pid;
-        
-        printf("[SERVER] Game process spawned (PID %d)\n", pid);
-        
-        // Send notification via message queue
-        struct game_msg notification;
-        notification.mtype = 1;
-        notification.player = 0;
-        notification.move = 0;
-        // Truncate message if too long to fit
-        char game_msg_str[128];
-        snprintf(game_msg_str, sizeof(game_msg_str), "Game: %s vs %s", 
-                 clients[p1_idx].username, clients[p2_idx].username);
-        strncpy(notification.username, game_msg_str, sizeof(notification.username) - 1);
-        notification.username[sizeof(notification.username) - 1] = '\0';
-        msgsnd(msg_queue_id, &notification, sizeof(notification) - sizeof(long), IPC_NOWAIT);
-        
-        // Update lobby for remaining players
-        broadcast_lobby();
-    } else {
-        perror("fork failed");
+        printf("%-5d %-7d %-6s %-5d %-6ld %s vs %s, %s\n", n, (int)g.host, shape,
+               board_count(&g.board), (long)(now - g.started), g.player[0], g.player[1], state);
+        live++;
     }
+    printf("%d live game%s\n", live, live == 1 ? "" : "s");
+    return 0;
 }
 
-void handle_client_disconnect(int idx) {
-    printf("[SERVER] Client '%s' disconnected\n", clients[idx].username);
-    
-    if (clients[idx].in_game) {
-        // Client was in a game - the game_process will handle this
-        printf("[SERVER] Client was in game - game_process will handle cleanup\n");
+// --tail-events: follow the running server's game events, as tail -f does
+#define TAIL_BACKLOG 10         // Events already in the ring shown first
+#define TAIL_POLL_MS 50
+#define TAIL_STALL_POLLS 20     // Give up on a record left half-written this long
+
+int tail_events() {
+    if (eventring_open() == -1) {
+        perror("shm_open event ring failed - is the server running?");
+        return 1;
+    }
+
+    uint64_t head = eventring_head();
+    uint64_t next = head > TAIL_BACKLOG ? head - TAIL_BACKLOG : 0;
+    struct eventring_counters seen;
+    eventring_get_counters(&seen);
+    int stalled = 0;
+
+    while (1) {
+        struct game_event ev;
+        int rc = eventring_read(&next, &ev);
+        if (rc == 1) {
+            char line[192], when[16];
+            time_t t = ev.time;
+            strftime(when, sizeof(when), "%H:%M:%S", localtime(&t));
+            eventring_format(&ev, line, sizeof(line));
+            printf("%s %s\n", when, line);
+            stalled = 0;
+            continue;
+        }
+        if (rc == -1 && ++stalled >= TAIL_STALL_POLLS) {
+            eventring_skip(&next);
+            stalled = 0;
+            continue;
+        }
+
+        struct eventring_counters now;
+        eventring_get_counters(&now);
+        if (now.dropped != seen.dropped || now.overflow != seen.overflow) {
+            printf("[EVENTS] %llu of %llu missed, %llu dropped by publishers\n",
+                   (unsigned long long)now.overflow, (unsigned long long)now.published,
+                   (unsigned long long)now.dropped);
+            seen = now;
+        }
+        fflush(stdout);
+        usleep(TAIL_POLL_MS * 1000);
     }
-    
-    remove_client(idx);
 }
 
-int main() {
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--games fork|inproc|pool] [--workers N] [--shards N] [--stats-log]\n"
+            "       [--stats-fsync] | --list-games | --tail-events\n", prog);
+    fprintf(stderr, "  --games fork    Fork a game_process per match (default)\n");
+    fprintf(stderr, "  --games inproc  Host matches inside the server event loop\n");
+    fprintf(stderr, "  --games pool    Hand matches to pre-forked game_process workers\n");
+    fprintf(stderr, "  --workers N     Worker pool size for --games pool (default %d)\n",
+            DEFAULT_WORKERS);
+    fprintf(stderr, "  --shards N      Run N reactor processes on SO_REUSEPORT listeners\n");
+    fprintf(stderr, "  --stats-log     Also append every result to data/stats.db\n");
+    fprintf(stderr, "  --stats-fsync   fdatasync the stats journal after every batch\n");
+    fprintf(stderr, "  --list-games    Show the running server's live games and exit\n");
+    fprintf(stderr, "  --tail-events   Follow the running server's game events\n");
+}
+
+int create_listener() {
     struct sockaddr_in addr;
-    fd_set rfds;
-    int max_fd;
-    
-    // Set up signal handlers
-    signal(SIGCHLD, sigchld_handler);
-    signal(SIGINT, sigint_handler);
-    signal(SIGTERM, sigint_handler);
-    
-    // Create IPC resources
-    if (create_fifo() == -1) {
-        fprintf(stderr, "[SERVER] Warning: FIFO creation failed\n");
-    }
-    msg_queue_id = create_msg_queue();
-    
-    // Create data directory
-    mkdir("data", 0755);
-    
-    // Create listening socket
-    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd == -1) {
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
         perror("socket failed");
         exit(1);
     }
-    
+
     int opt = 1;
-    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
         perror("setsockopt failed");
     }
-    
+    // Each shard binds its own socket; the kernel spreads connections across them
+    if (shard_count > 1 &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        perror("setsockopt SO_REUSEPORT failed");
+        exit(1);
+    }
+
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
     addr.sin_port = htons(PORT);
-    
-    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
         perror("bind failed");
         exit(1);
     }
-    
-    if (listen(listen_fd, 10) == -1) {
+
+    if (listen(fd, SOMAXCONN) == -1) {
         perror("listen failed");
         exit(1);
     }
-    
-    printf("[SERVER] Running on port %d\n", PORT);
-    printf("[SERVER] Press Ctrl+C to shutdown gracefully\n");
-    
+    return fd;
+}
+
+// Shard 0's scrape endpoint. A stale socket from a crashed server is replaced.
+int create_metrics_listener() {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, METRICS_SOCKET, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket metrics failed");
+        return -1;
+    }
+    unlink(METRICS_SOCKET);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(fd, METRICS_CONNS) == -1) {
+        perror("bind metrics socket failed");
+        close(fd);
+        return -1;
+    }
+    for (int i = 0; i < METRICS_CONNS; i++) {
+        metrics_conns[i].fd = -1;
+    }
+    printf("[SERVER] Metrics on unix:%s\n", METRICS_SOCKET);
+    return fd;
+}
+
+static void epoll_add_or_die(int fd, const char *what) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        fprintf(stderr, "epoll_ctl %s failed: %s\n", what, strerror(errno));
+        exit(1);
+    }
+}
+
+void accept_metrics_scrapes() {
     while (1) {
-        FD_ZERO(&rfds);
-        FD_SET(listen_fd, &rfds);
-        max_fd = listen_fd;
-        
-        // Only monitor clients in lobby (not in-game)
-        for (int i = 0; i < client_count; i++) {
-            if (clients[i].in_game == 0) {  // Only lobby clients
-                FD_SET(clients[i].fd, &rfds);
-                if (clients[i].fd > max_fd) max_fd = clients[i].fd;
+        int fd = accept4(metrics_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        int i = 0;
+        while (i < METRICS_CONNS && metrics_conns[i].fd != -1) i++;
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        if (i == METRICS_CONNS || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            close(fd);  // Too many scrapes at once; the scraper retries
+            continue;
+        }
+        metrics_conns[i].fd = fd;
+        metrics_conns[i].replied = 0;
+    }
+}
+
+static struct metrics_conn *find_metrics_conn(int fd) {
+    for (int i = 0; i < METRICS_CONNS; i++) {
+        if (metrics_conns[i].fd == fd) return &metrics_conns[i];
+    }
+    return NULL;
+}
+
+static void close_metrics_conn(struct metrics_conn *m) {
+    close(m->fd);  // Also drops the fd from the epoll set
+    outq_clear(&m->out);
+    m->fd = -1;
+}
+
+// Any request gets the metrics: the reply is a complete HTTP/1.0 response,
+// so curl and Prometheus can scrape the socket directly. What the socket
+// does not take at once waits in the scrape's output queue for EPOLLOUT.
+void serve_metrics_scrape(struct metrics_conn *m, uint32_t events) {
+    static char body[METRICS_TEXT_MAX];
+    static char reply[METRICS_TEXT_MAX + 128];
+
+    if (!m->replied && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) {
+        char discard[1024];
+        while (recv(m->fd, discard, sizeof(discard), 0) > 0) {
+        }
+
+        size_t len = metrics_render(body, sizeof(body));
+        int head = snprintf(reply, sizeof(reply),
+                            "HTTP/1.0 200 OK\r\n"
+                            "Content-Type: text/plain; version=0.0.4\r\n"
+                            "Content-Length: %zu\r\n\r\n", len);
+        memcpy(reply + head, body, len);
+        m->replied = 1;
+        if (outq_write(&m->out, m->fd, reply, head + len) == -1) {
+            close_metrics_conn(m);
+            return;
+        }
+    } else if (m->replied && (events & EPOLLOUT) && outq_flush(&m->out, m->fd) == -1) {
+        close_metrics_conn(m);
+        return;
+    }
+
+    // HTTP/1.0: the reply ends when the connection does
+    if (m->replied && outq_pending(&m->out) == 0) {
+        close_metrics_conn(m);
+    } else if (events & (EPOLLHUP | EPOLLERR)) {
+        close_metrics_conn(m);
+    }
+}
+
+// One reactor: listener, lobby, games. Never returns.
+void run_shard() {
+    struct epoll_event events[MAX_EVENTS];
+    int inbox_fd = -1;
+
+    signal_fd = signalfd(-1, &blocked_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1) {
+        perror("signalfd failed");
+        exit(1);
+    }
+
+    if (shard_count > 1) {
+        // Pin each shard to its own core
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(shard_index % (cpus > 0 ? cpus : 1), &set);
+        if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+            perror("sched_setaffinity failed");
+        }
+
+        inbox_fd = shard_inbox[shard_index][1];
+        set_nonblocking(inbox_fd, 1);
+    }
+
+    listen_fd = create_listener();
+    metrics_attach();
+    if (shard_index == 0) {
+        metrics_fd = create_metrics_listener();
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("epoll_create1 failed");
+        exit(1);
+    }
+    epoll_add_or_die(listen_fd, "listen");
+    epoll_add_or_die(signal_fd, "signalfd");
+    if (metrics_fd != -1) {
+        epoll_add_or_die(metrics_fd, "metrics");
+    }
+    if (timer_wheel_init(&timers) == -1) {
+        exit(1);
+    }
+    epoll_add_or_die(timers.fd, "timerfd");
+    timer_init(&presence_timer, flush_presence, NULL);
+    timer_init(&match_timer, match_queued_players, NULL);
+    if (inbox_fd != -1) {
+        epoll_add_or_die(inbox_fd, "shard inbox");
+    }
+    if (game_mode == GAME_MODE_FORK) {
+        // Game processes report moves and results here for spectators
+        if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, game_events) == -1) {
+            perror("socketpair game events failed");
+            exit(1);
+        }
+        set_nonblocking(game_events[1], 1);
+        epoll_add_or_die(game_events[1], "game events");
+    }
+
+    if (game_mode == GAME_MODE_POOL) {
+        for (int w = 0; w < worker_count; w++) {
+            if (spawn_worker(w) == -1) {
+                exit(1);
             }
         }
-        
-        if (select(max_fd + 1, &rfds, NULL, NULL, NULL) == -1) {
+    } else {
+        worker_count = 0;
+    }
+
+    if (shard_count > 1) {
+        printf("[SERVER] Shard %d running on port %d (PID %d)\n", shard_index, PORT, getpid());
+    } else {
+        printf("[SERVER] Running on port %d (%s games)\n", PORT,
+               game_mode == GAME_MODE_INPROC ? "in-process" :
+               game_mode == GAME_MODE_POOL ? "pooled" : "forked");
+        printf("[SERVER] Press Ctrl+C to shutdown gracefully\n");
+    }
+
+    feed_seen = presence_feed_version(feed);
+
+    while (1) {
+        // Every deadline is on the timer wheel, which wakes us via its timerfd.
+        // Spectator output still to write keeps the loop from sleeping.
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, flush_head ? 0 : -1);
+        if (n == -1) {
             if (errno == EINTR) continue;
-            perror("select failed");
+            perror("epoll_wait failed");
             break;
         }
-        
-        // Handle new connections
-        if (FD_ISSET(listen_fd, &rfds)) {
-            int new_fd = accept(listen_fd, NULL, NULL);
-            if (new_fd == -1) {
-                perror("accept failed");
-                continue;
-            }
-            printf("[SERVER] New connection accepted, fd = %d\n", new_fd);
-            
-            char buf[BUF_SIZE];
-            int bytes = recv(new_fd, buf, BUF_SIZE - 1, 0);
-            if (bytes <= 0) {
-                printf("[SERVER] Connection closed early (bytes = %d), closing fd %d\n", bytes, new_fd);
-                close(new_fd);
-                continue;
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == listen_fd) {
+                accept_connections();
+            } else if (fd == signal_fd) {
+                handle_signals();
+            } else if (fd == inbox_fd) {
+                handle_shard_inbox();
+            } else if (fd == timers.fd) {
+                timer_wheel_run(&timers);
+            } else if (fd == game_events[1]) {
+                handle_game_events();
+            } else if (fd == metrics_fd) {
+                accept_metrics_scrapes();
+            } else if (fd < conn_cap && conns[fd]) {
+                // Sockets handed to a game process are unregistered; skip stale events
+                struct client *c = conns[fd];
+                if (c->match_id != -1) continue;
+                if (events[i].events & EPOLLOUT) {
+                    flush_client(c);
+                }
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    handle_client_input(c);
+                }
+            } else if (find_metrics_conn(fd)) {
+                serve_metrics_scrape(find_metrics_conn(fd), events[i].events);
+            } else {
+                int w = find_worker_by_fd(fd);
+                if (w != -1) {
+                    handle_worker_messages(w);
+                }
             }
-            buf[bytes] = '\0';
-            
-            // Remove trailing newline/whitespace
-            buf[strcspn(buf, "\r\n")] = '\0';
-            
-            printf("[SERVER] Received: '%s'\n", buf);
-            
-            char *command = strtok(buf, " ");
-            char *user = strtok(NULL, " ");
-            char *pass = strtok(NULL, " ");
-            
-            if (!command || !user || !pass) {
-                printf("[SERVER] Invalid format → INVALID_FORMAT\n");
-                send(new_fd, "INVALID_FORMAT\n", 15, 0);
-                close(new_fd);
-                continue;
+        }
+
+        // Players' sockets were served above; spectators get the next slice
+        flush_spectators();
+
+        // Changes in the same tick reach each lobby client as one batch
+        if (!timer_pending(&presence_timer) && presence_feed_version(feed) != feed_seen) {
+            timer_arm(&timers, &presence_timer, PRESENCE_TICK_MS);
+        }
+
+        // One wakeup per batch for the other shards
+        if (peers_dirty && shard_count > 1) {
+            notify_peer_shards();
+        }
+    }
+
+    cleanup_resources();
+    exit(1);
+}
+
+pid_t spawn_shard(int idx) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        shard_index = idx;
+        run_shard();
+    } else if (pid == -1) {
+        perror("fork shard failed");
+    } else {
+        shard_pids[idx] = pid;
+    }
+    return pid;
+}
+
+// The crashed shard's players are gone from every lobby
+static void publish_departure(const char *name, const struct presence_info *info, void *arg) {
+    (void)info;
+    (void)arg;
+    presence_feed_publish(feed, PRESENCE_LEFT, name);
+}
+
+static void wake_shards() {
+    struct shard_msg msg;
+    msg.type = SHARD_LOBBY_CHANGED;
+    for (int k = 0; k < shard_count; k++) {
+        send(shard_inbox[k][0], &msg, offsetof(struct shard_msg, text), MSG_DONTWAIT);
+    }
+}
+
+// Supervise the shards: respawn crashed ones, stop all on SIGINT/SIGTERM
+void run_master() {
+    printf("[SERVER] Running on port %d with %d shards (%s games)\n", PORT, shard_count,
+           game_mode == GAME_MODE_INPROC ? "in-process" :
+           game_mode == GAME_MODE_POOL ? "pooled" : "forked");
+    printf("[SERVER] Press Ctrl+C to shutdown gracefully\n");
+
+    // Game processes of dead shards still listed in the game table. They are
+    // not our children, so the master polls for them to exit.
+    int orphans = 0;
+
+    while (1) {
+        siginfo_t si;
+        struct timespec poll = { ORPHAN_POLL_MS / 1000, (ORPHAN_POLL_MS % 1000) * 1000000L };
+        int sig = orphans ? sigtimedwait(&blocked_signals, &si, &poll)
+                          : sigwaitinfo(&blocked_signals, &si);
+        if (orphans) {
+            int freed = gametable_purge_orphans(&orphans);
+            if (freed) {
+                printf("[SERVER] Freed %d live game table slots of games that outlived their shard\n",
+                       freed);
             }
-            
-            // Validate username and password length
-            if (strlen(user) >= 64 || strlen(pass) >= 64) {
-                send(new_fd, "USERNAME_OR_PASSWORD_TOO_LONG\n", 30, 0);
-                close(new_fd);
-                continue;
+        }
+        if (sig == -1) continue;
+
+        if (si.si_signo == SIGINT || si.si_signo == SIGTERM) {
+            printf("\n[SERVER] Received %s. Stopping shards...\n",
+                   si.si_signo == SIGINT ? "SIGINT" : "SIGTERM");
+            for (int k = 0; k < shard_count; k++) {
+                if (shard_pids[k] > 0) kill(shard_pids[k], SIGTERM);
             }
-            
-            if (strcmp(command, "REGISTER") == 0) {
-                printf("[SERVER] REGISTER request for '%s'\n", user);
-                if (user_exists(user)) {
-                    printf("[SERVER] User '%s' exists → USER_EXISTS\n", user);
-                    send(new_fd, "USER_EXISTS\n", 12, 0);
-                    close(new_fd);
-                } else {
-                    register_user(user, pass);
-                    printf("[SERVER] User '%s' registered\n", user);
-                    send(new_fd, "REGISTER_OK\n", 12, 0);
-                    
-                    if (client_count < MAX_CLIENTS) {
-                        clients[client_count].fd = new_fd;
-                        strncpy(clients[client_count].username, user, 
-                                sizeof(clients[client_count].username) - 1);
-                        clients[client_count].username[sizeof(clients[client_count].username) - 1] = '\0';
-                        clients[client_count].in_game = 0;
-                        client_count++;
-                        printf("[SERVER] Added '%s' to lobby (fd %d, total %d)\n", 
-                               user, new_fd, client_count);
-                        broadcast_lobby();
-                    } else {
-                        printf("[SERVER] Server full → SERVER_FULL\n");
-                        send(new_fd, "SERVER_FULL\n", 12, 0);
-                        close(new_fd);
-                    }
+            // Stop the writer last so results from the final games are kept
+            while (1) {
+                pid_t pid = wait(NULL);
+                if (pid == -1 && errno == EINTR) continue;
+                if (pid == -1) break;
+                int shards_left = 0;
+                for (int k = 0; k < shard_count; k++) {
+                    if (shard_pids[k] == pid) shard_pids[k] = -1;
+                    if (shard_pids[k] > 0) shards_left++;
                 }
-            }
-            else if (strcmp(command, "LOGIN") == 0) {
-                printf("[SERVER] LOGIN request for '%s'\n", user);
-                if (validate_login(user, pass)) {
-                    if (find_client(user) != -1) {
-                        printf("[SERVER] User '%s' already logged in\n", user);
-                        send(new_fd, "ALREADY_LOGGED_IN\n", 18, 0);
-                        close(new_fd);
-                        continue;
-                    }
-                    
-                    send(new_fd, "LOGIN_OK\n", 9, 0);
-                    printf("[SERVER] Login successful for '%s'\n", user);
-                    
-                    if (client_count < MAX_CLIENTS) {
-                        clients[client_count].fd = new_fd;
-                        strncpy(clients[client_count].username, user,
-                                sizeof(clients[client_count].username) - 1);
-                        clients[client_count].username[sizeof(clients[client_count].username) - 1] = '\0';
-                        clients[client_count].in_game = 0;
-                        client_count++;
-                        printf("[SERVER] Added '%s' to lobby (fd %d, total %d)\n",
-                               user, new_fd, client_count);
-                        broadcast_lobby();
-                    } else {
-                        printf("[SERVER] Server full → SERVER_FULL\n");
-                        send(new_fd, "SERVER_FULL\n", 12, 0);
-                        close(new_fd);
-                    }
-                } else {
-                    printf("[SERVER] Invalid credentials for '%s'\n", user);
-                    send(new_fd, "INVALID_LOGIN\n", 14, 0);
-                    close(new_fd);
+                if (!shards_left && stats_writer_pid > 0) {
+                    kill(stats_writer_pid, SIGTERM);
+                    stats_writer_pid = -1;
                 }
             }
-            else {
-                printf("[SERVER] Unknown command '%s'\n", command);
-                send(new_fd, "INVALID_COMMAND\n", 16, 0);
-                close(new_fd);
-            }
+            remove_ipc_resources();
+            printf("[SERVER] Cleanup complete. Exiting.\n");
+            exit(0);
         }
-        
-        // Handle messages from lobby clients only
-        for (int i = 0; i < client_count; ) {
-            // Skip in-game clients - they're handled by game_process
-            if (clients[i].in_game == 1) {
-                i++;
+
+        pid_t pid;
+        while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+            metrics_reap(pid);
+            if (pid == stats_writer_pid) {
+                printf("[SERVER] Stats writer (PID %d) exited, respawning\n", pid);
+                spawn_stats_writer();
                 continue;
             }
-            
-            if (FD_ISSET(clients[i].fd, &rfds)) {
-                char buf[BUF_SIZE];
-                int bytes = recv(clients[i].fd, buf, BUF_SIZE - 1, 0);
-                
-                if (bytes <= 0) {
-                    handle_client_disconnect(i);
-                    continue;  // Don't increment i
-                }
-                
-                buf[bytes] = '\0';
-                buf[strcspn(buf, "\r\n")] = '\0';  // Remove newline
-                
-                // Handle lobby commands
-                printf("[SERVER] From '%s': '%s'\n", clients[i].username, buf);
-                
-                char *command = strtok(buf, " ");
-                
-                if (strcmp(command, "INVITE") == 0) {
-                    char *target = strtok(NULL, "\n");
-                    if (!target) {
-                        send(clients[i].fd, "INVALID_INVITE_FORMAT\n", 22, 0);
-                    } else {
-                        int target_idx = find_client(target);
-                        if (target_idx != -1 && clients[target_idx].in_game == 0) {
-                            char notify[BUF_SIZE];
-                            snprintf(notify, sizeof(notify), "INVITE_FROM %s\n", 
-                                    clients[i].username);
-                            send(clients[target_idx].fd, notify, strlen(notify), 0);
-                            
-                            snprintf(notify, sizeof(notify), "INVITE_SENT to %s\n", target);
-                            send(clients[i].fd, notify, strlen(notify), 0);
-                        } else {
-                            send(clients[i].fd, "PLAYER_NOT_AVAILABLE\n", 21, 0);
-                        }
-                    }
-                }
-                else if (strcmp(command, "ACCEPT") == 0) {
-                    char *target = strtok(NULL, "\n");
-                    if (!target) {
-                        send(clients[i].fd, "INVALID_ACCEPT_FORMAT\n", 22, 0);
-                    } else {
-                        int target_idx = find_client(target);
-                        if (target_idx != -1 && clients[target_idx].in_game == 0) {
-                            start_game(target_idx, i);  // Inviter is player 1
-                            continue;  // Don't increment i, clients array changed
-                        } else {
-                            send(clients[i].fd, "PLAYER_NOT_AVAILABLE\n", 21, 0);
-                        }
-                    }
-                }
-                else if (strcmp(command, "DECLINE") == 0) {
-                    char *target = strtok(NULL, "\n");
-                    if (!target) {
-                        send(clients[i].fd, "INVALID_DECLINE_FORMAT\n", 23, 0);
-                    } else {
-                        int target_idx = find_client(target);
-                        if (target_idx != -1) {
-                            char notify[BUF_SIZE];
-                            snprintf(notify, sizeof(notify), "INVITE_DECLINED_BY %s\n",
-                                    clients[i].username);
-                            send(clients[target_idx].fd, notify, strlen(notify), 0);
-                        }
-                    }
+            for (int k = 0; k < shard_count; k++) {
+                if (shard_pids[k] != pid) continue;
+                printf("[SERVER] Shard %d (PID %d) exited, respawning\n", k, pid);
+                presence_purge_shard(directory, k, publish_departure, NULL);
+                int left = 0;
+                int freed = gametable_purge(pid, &left);
+                if (freed) {
+                    printf("[SERVER] Freed %d live game table slots of shard %d\n", freed, k);
                 }
-                else if (strcmp(command, "LEADERBOARD") == 0) {
-                    char lb[BUF_SIZE];
-                    get_leaderboard(lb, sizeof(lb));
-                    send(clients[i].fd, lb, strlen(lb), 0);
-                }
-                else if (strcmp(command, "QUIT") == 0) {
-                    send(clients[i].fd, "GOODBYE\n", 8, 0);
-                    handle_client_disconnect(i);
-                    continue;  // Don't increment i
-                }
-                else {
-                    send(clients[i].fd, "UNKNOWN_COMMAND\n", 16, 0);
+                if (left) {
+                    printf("[SERVER] Games of shard %d still running: %d\n", k, left);
+                    orphans += left;
                 }
+                wake_shards();
+                spawn_shard(k);
             }
-            i++;
         }
     }
-    
-    cleanup_resources();
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option long_opts[] = {
+        {"games", required_argument, NULL, 'g'},
+        {"workers", required_argument, NULL, 'w'},
+        {"shards", required_argument, NULL, 's'},
+        {"stats-log", no_argument, NULL, 'l'},
+        {"stats-fsync", no_argument, NULL, 'f'},
+        {"list-games", no_argument, NULL, 'G'},
+        {"tail-events", no_argument, NULL, 'E'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt_c;
+    while ((opt_c = getopt_long(argc, argv, "g:w:s:lfh", long_opts, NULL)) != -1) {
+        if (opt_c == 'g' && strcmp(optarg, "fork") == 0) {
+            game_mode = GAME_MODE_FORK;
+        } else if (opt_c == 'g' && strcmp(optarg, "inproc") == 0) {
+            game_mode = GAME_MODE_INPROC;
+        } else if (opt_c == 'g' && strcmp(optarg, "pool") == 0) {
+            game_mode = GAME_MODE_POOL;
+        } else if (opt_c == 'w' && atoi(optarg) > 0 && atoi(optarg) <= MAX_WORKERS) {
+            worker_count = atoi(optarg);
+        } else if (opt_c == 's' && atoi(optarg) > 0 && atoi(optarg) <= MAX_SHARDS) {
+            shard_count = atoi(optarg);
+        } else if (opt_c == 'l') {
+            // Inherited by the shards and every game_process
+            setenv(STATS_LOG_ENV, "1", 1);
+        } else if (opt_c == 'f') {
+            stats_fsync = 1;
+        } else if (opt_c == 'G') {
+            exit(list_live_games());
+        } else if (opt_c == 'E') {
+            exit(tail_events());
+        } else {
+            usage(argv[0]);
+            exit(opt_c == 'h' ? 0 : 1);
+        }
+    }
+
+    // Route signals through the event loop instead of async handlers
+    sigemptyset(&blocked_signals);
+    sigaddset(&blocked_signals, SIGCHLD);
+    sigaddset(&blocked_signals, SIGINT);
+    sigaddset(&blocked_signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &blocked_signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    raise_fd_limit();
+
+    // Create IPC resources
+    if (eventring_create() == -1) {
+        fprintf(stderr, "[SERVER] Warning: event ring unavailable, game events disabled\n");
+    }
+    if (gametable_create() == -1) {
+        fprintf(stderr, "[SERVER] Warning: live game table unavailable, games go unlisted\n");
+    }
+    if (metrics_create() == -1) {
+        fprintf(stderr, "[SERVER] Warning: metrics unavailable\n");
+    }
+
+    // Create data directory
+    mkdir("data", 0755);
+    spawn_stats_writer();
+
+    // Solve the bot's positions once; shards share the table copy-on-write
+    bot_init();
+
+    feed = presence_feed_create(PRESENCE_FEED_SLOTS);
+    if (!feed) {
+        exit(1);
+    }
+
+    if (shard_count == 1) {
+        run_shard();
+    }
+
+    // Shared state must exist before the shards are forked
+    directory = presence_create(PRESENCE_DEFAULT_CAPACITY);
+    if (!directory) {
+        exit(1);
+    }
+    for (int k = 0; k < shard_count; k++) {
+        if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, shard_inbox[k]) == -1) {
+            perror("socketpair shard inbox failed");
+            exit(1);
+        }
+    }
+    for (int k = 0; k < shard_count; k++) {
+        if (spawn_shard(k) == -1) {
+            exit(1);
+        }
+    }
+
+    run_master();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,140 @@
+#define _GNU_SOURCE
+#include "../include/timer.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/timerfd.h>
+
+#define TIMER_MAX_TICKS ((1ull << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1)
+
+static void link_timer(struct timer **head, struct timer *t) {
+    t->next = *head;
+    if (t->next) t->next->pprev = &t->next;
+    *head = t;
+    t->pprev = head;
+}
+
+static void unlink_timer(struct timer *t) {
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+// File the timer in the coarsest level whose slots still tell its tick apart
+static void place(struct timer_wheel *w, struct timer *t) {
+    uint64_t delta = t->expires - w->now;
+    int level = 0;
+
+    while (level < TIMER_LEVELS - 1 && delta >> (TIMER_SLOT_BITS * (level + 1))) level++;
+    int slot = (t->expires >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1);
+    link_timer(&w->slots[level][slot], t);
+}
+
+static void set_timerfd(struct timer_wheel *w, int on) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (on) {
+        its.it_interval.tv_nsec = TIMER_TICK_MS * 1000000L;
+        its.it_value = its.it_interval;
+    }
+    if (timerfd_settime(w->fd, 0, &its, NULL) == -1) {
+        perror("timerfd_settime failed");
+        return;
+    }
+    w->running = on;
+}
+
+int timer_wheel_init(struct timer_wheel *w) {
+    memset(w, 0, sizeof(*w));
+    w->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (w->fd == -1) {
+        perror("timerfd_create failed");
+        return -1;
+    }
+    return 0;
+}
+
+void timer_init(struct timer *t, timer_fn fn, void *arg) {
+    t->next = NULL;
+    t->pprev = NULL;
+    t->expires = 0;
+    t->fn = fn;
+    t->arg = arg;
+}
+
+void timer_arm(struct timer_wheel *w, struct timer *t, unsigned ms) {
+    // One extra tick: the current one is already partly over
+    uint64_t ticks = (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS + 1;
+    if (ticks > TIMER_MAX_TICKS) ticks = TIMER_MAX_TICKS;
+
+    if (t->pprev) {
+        unlink_timer(t);
+    } else {
+        w->count++;
+    }
+    t->expires = w->now + ticks;
+    place(w, t);
+
+    if (!w->running) set_timerfd(w, 1);
+}
+
+void timer_cancel(struct timer_wheel *w, struct timer *t) {
+    if (!t->pprev) return;
+    unlink_timer(t);
+    w->count--;
+}
+
+int timer_pending(const struct timer *t) {
+    return t->pprev != NULL;
+}
+
+// Move one slot of a coarser level down now that its range has come up
+static void cascade(struct timer_wheel *w, int level, int slot) {
+    struct timer *t = w->slots[level][slot];
+    w->slots[level][slot] = NULL;
+
+    while (t) {
+        struct timer *next = t->next;
+        place(w, t);
+        t = next;
+    }
+}
+
+static void tick(struct timer_wheel *w) {
+    w->now++;
+    int slot = w->now & (TIMER_SLOTS - 1);
+
+    for (int level = 1; level < TIMER_LEVELS; level++) {
+        if ((w->now >> (TIMER_SLOT_BITS * (level - 1))) & (TIMER_SLOTS - 1)) break;
+        cascade(w, level, (w->now >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1));
+    }
+
+    // Detach the slot first: callbacks may re-arm into it or cancel timers
+    // still waiting in this batch
+    struct timer *expired = w->slots[0][slot];
+    w->slots[0][slot] = NULL;
+    if (expired) expired->pprev = &expired;
+
+    while (expired) {
+        struct timer *t = expired;
+        unlink_timer(t);
+        w->count--;
+        t->fn(t->arg);
+    }
+}
+
+void timer_wheel_run(struct timer_wheel *w) {
+    uint64_t ticks;
+
+    if (read(w->fd, &ticks, sizeof(ticks)) != sizeof(ticks)) {
+        if (errno != EAGAIN) perror("timerfd read failed");
+        return;
+    }
+    while (ticks-- > 0 && w->count > 0) {
+        tick(w);
+    }
+    // Let the timerfd sleep while nothing is armed
+    if (w->count == 0 && w->running) set_timerfd(w, 0);
+}